@@ -0,0 +1,137 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the per-call cost of heap and arena allocated messages for the
+// request path of an Rpc: parse a 'RangeDataBatch' from a 'ByteBuffer', build
+// a downsampled response and serialize it.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+
+#include "async_grpc/common/make_unique.h"
+#include "async_grpc/proto/benchmark.pb.h"
+#include "glog/logging.h"
+#include "google/protobuf/arena.h"
+#include "grpc++/grpc++.h"
+#include "grpc++/impl/codegen/proto_utils.h"
+
+namespace async_grpc {
+namespace {
+
+constexpr int kNumRangeData = 10;
+constexpr int kNumPointsPerCloud = 1000;
+constexpr int kNumIterations = 500;
+
+using Serializer = ::grpc::SerializationTraits<::google::protobuf::Message>;
+
+void FillPointCloud(int num_points, proto::PointCloud* point_cloud) {
+  for (int i = 0; i < num_points; ++i) {
+    proto::Point* point = point_cloud->add_points();
+    point->set_x(i);
+    point->set_y(2.f * i);
+    point->set_z(0.5f * i);
+    point_cloud->add_intensities(i % 255);
+  }
+}
+
+::grpc::ByteBuffer CreateRequest() {
+  proto::RangeDataBatch batch;
+  for (int i = 0; i < kNumRangeData; ++i) {
+    proto::RangeData* range_data = batch.add_range_data();
+    range_data->set_timestamp(i);
+    range_data->set_frame_id("horizontal_laser_link");
+    FillPointCloud(kNumPointsPerCloud, range_data->mutable_returns());
+    FillPointCloud(kNumPointsPerCloud / 10, range_data->mutable_misses());
+  }
+  ::grpc::ByteBuffer buffer;
+  bool own_buffer;
+  CHECK(Serializer::Serialize(batch, &buffer, &own_buffer).ok());
+  return buffer;
+}
+
+// Keeps every other return, the kind of work a handler does per request.
+void Downsample(const proto::RangeDataBatch& request,
+                proto::RangeDataBatch* response) {
+  for (const proto::RangeData& range_data : request.range_data()) {
+    proto::RangeData* downsampled = response->add_range_data();
+    downsampled->set_timestamp(range_data.timestamp());
+    downsampled->set_frame_id(range_data.frame_id());
+    for (int i = 0; i < range_data.returns().points_size(); i += 2) {
+      *downsampled->mutable_returns()->add_points() =
+          range_data.returns().points(i);
+    }
+  }
+}
+
+void HandleOnHeap(const ::grpc::ByteBuffer& request_buffer) {
+  ::grpc::ByteBuffer buffer = request_buffer;
+  auto request = common::make_unique<proto::RangeDataBatch>();
+  CHECK(Serializer::Deserialize(&buffer, request.get()).ok());
+  auto response = common::make_unique<proto::RangeDataBatch>();
+  Downsample(*request, response.get());
+  bool own_buffer;
+  CHECK(Serializer::Serialize(*response, &buffer, &own_buffer).ok());
+}
+
+void HandleOnArena(const ::grpc::ByteBuffer& request_buffer,
+                   google::protobuf::Arena* arena) {
+  ::grpc::ByteBuffer buffer = request_buffer;
+  auto* request =
+      google::protobuf::Arena::CreateMessage<proto::RangeDataBatch>(arena);
+  CHECK(Serializer::Deserialize(&buffer, request).ok());
+  auto* response =
+      google::protobuf::Arena::CreateMessage<proto::RangeDataBatch>(arena);
+  Downsample(*request, response);
+  bool own_buffer;
+  CHECK(Serializer::Serialize(*response, &buffer, &own_buffer).ok());
+  // What 'Rpc' does after every handler callback.
+  arena->Reset();
+}
+
+double MeasureMicrosecondsPerCall(const std::function<void()>& call) {
+  call();  // Warm up.
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kNumIterations; ++i) {
+    call();
+  }
+  const std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kNumIterations;
+}
+
+void Run() {
+  const ::grpc::ByteBuffer request_buffer = CreateRequest();
+  std::printf("Request: %d range data, %zu bytes\n", kNumRangeData,
+              request_buffer.Length());
+  const double heap_us = MeasureMicrosecondsPerCall(
+      [&request_buffer]() { HandleOnHeap(request_buffer); });
+  google::protobuf::Arena arena;
+  const double arena_us = MeasureMicrosecondsPerCall(
+      [&request_buffer, &arena]() { HandleOnArena(request_buffer, &arena); });
+  std::printf("heap:  %8.1f us/call\n", heap_us);
+  std::printf("arena: %8.1f us/call (%.2fx)\n", arena_us, heap_us / arena_us);
+}
+
+}  // namespace
+}  // namespace async_grpc
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  async_grpc::Run();
+  return 0;
+}
@@ -17,12 +17,16 @@
 #ifndef ASYNC_GRPC_ASYNC_CLIENT_H
 #define ASYNC_GRPC_ASYNC_CLIENT_H
 
+#include <chrono>
 #include <memory>
 
+#include "async_grpc/compression.h"
+#include "async_grpc/local_call.h"
 #include "async_grpc/rpc_service_method_traits.h"
 #include "common/make_unique.h"
 #include "completion_queue_pool.h"
 #include "glog/logging.h"
+#include "grpc++/alarm.h"
 #include "grpc++/grpc++.h"
 #include "grpc++/impl/codegen/async_stream.h"
 #include "grpc++/impl/codegen/async_unary_call.h"
@@ -43,6 +47,31 @@ class AsyncClientInterface {
       const CompletionQueue::ClientEvent& client_event) = 0;
 };
 
+// Delivers the events of local calls, see 'LocalClientCall', through the
+// completion queue of an 'AsyncClient' so that callbacks run on the same
+// threads as for calls through gRPC. At most one event may be in flight.
+class LocalClientEventNotifier {
+ public:
+  explicit LocalClientEventNotifier(::grpc::CompletionQueue* completion_queue)
+      : completion_queue_(completion_queue) {}
+
+  void Notify(CompletionQueue::ClientEvent* client_event, bool ok) {
+    if (ok) {
+      alarm_.Set(completion_queue_, std::chrono::system_clock::now(),
+                 client_event);
+      return;
+    }
+    // A cancelled alarm delivers its tag with ok=false.
+    alarm_.Set(completion_queue_, std::chrono::system_clock::time_point::max(),
+               client_event);
+    alarm_.Cancel();
+  }
+
+ private:
+  ::grpc::CompletionQueue* const completion_queue_;
+  ::grpc::Alarm alarm_;
+};
+
 template <typename RpcServiceMethodConcept,
           ::grpc::internal::RpcMethod::RpcType StreamType =
               RpcServiceMethodTraits<RpcServiceMethodConcept>::StreamType>
@@ -66,9 +95,28 @@ class AsyncClient<RpcServiceMethodConcept,
         rpc_method_name_(RpcServiceMethod::MethodName()),
         rpc_method_(rpc_method_name_.c_str(), RpcServiceMethod::StreamType,
                     channel_),
+        local_event_notifier_(completion_queue_),
         finish_event_(CompletionQueue::ClientEvent::Event::FINISH, this) {}
 
+  // Compresses the request as decided by 'compressor', see
+  // 'Client::SetCompressor()'. Must be called before 'WriteAsync()'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   void WriteAsync(const RequestType& request) {
+    local_call_ =
+        LocalClientCall<RpcServiceMethod>::Start(channel_.get(), &request);
+    if (local_call_) {
+      local_call_->FinishAsync([this](const ::grpc::Status&) {
+        status_ = local_call_->FinishUnary(&response_);
+        local_event_notifier_.Notify(&finish_event_, true /* ok */);
+      });
+      return;
+    }
+    if (compressor_) {
+      compressor_->ConfigureContext(request, &client_context_);
+    }
     response_reader_ =
         std::unique_ptr<::grpc::ClientAsyncResponseReader<ResponseType>>(
             ::grpc::internal::ClientAsyncResponseReaderFactory<
@@ -91,7 +139,11 @@ class AsyncClient<RpcServiceMethodConcept,
 
   void HandleFinishEvent(const CompletionQueue::ClientEvent& client_event) {
     if (callback_) {
-      callback_(status_, status_.ok() ? &response_ : nullptr);
+      // The callback may destroy this client, so it must not be touched
+      // afterwards.
+      CallbackType callback = std::move(callback_);
+      callback_ = nullptr;
+      callback(status_, status_.ok() ? &response_ : nullptr);
     }
   }
 
@@ -104,9 +156,12 @@ class AsyncClient<RpcServiceMethodConcept,
   const ::grpc::internal::RpcMethod rpc_method_;
   std::unique_ptr<::grpc::ClientAsyncResponseReader<ResponseType>>
       response_reader_;
+  std::unique_ptr<LocalClientCall<RpcServiceMethod>> local_call_;
+  LocalClientEventNotifier local_event_notifier_;
   CompletionQueue::ClientEvent finish_event_;
   ::grpc::Status status_;
   ResponseType response_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 template <typename RpcServiceMethodConcept>
@@ -127,12 +182,28 @@ class AsyncClient<RpcServiceMethodConcept,
         rpc_method_name_(RpcServiceMethod::MethodName()),
         rpc_method_(rpc_method_name_.c_str(), RpcServiceMethod::StreamType,
                     channel_),
+        local_event_notifier_(completion_queue_),
         write_event_(CompletionQueue::ClientEvent::Event::WRITE, this),
         read_event_(CompletionQueue::ClientEvent::Event::READ, this),
         finish_event_(CompletionQueue::ClientEvent::Event::FINISH, this) {}
 
+  // Compresses the request as decided by 'compressor', see
+  // 'Client::SetCompressor()'. Must be called before 'WriteAsync()'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   void WriteAsync(const RequestType& request) {
     // Start the call.
+    local_call_ =
+        LocalClientCall<RpcServiceMethod>::Start(channel_.get(), &request);
+    if (local_call_) {
+      local_event_notifier_.Notify(&write_event_, true /* ok */);
+      return;
+    }
+    if (compressor_) {
+      compressor_->ConfigureContext(request, &client_context_);
+    }
     response_reader_ = std::unique_ptr<::grpc::ClientAsyncReader<ResponseType>>(
         ::grpc::internal::ClientAsyncReaderFactory<ResponseType>::Create(
             channel_.get(), completion_queue_, rpc_method_, &client_context_,
@@ -166,11 +237,11 @@ class AsyncClient<RpcServiceMethodConcept,
         callback_ = nullptr;
       }
       finish_status_ = status;
-      response_reader_->Finish(&finish_status_, (void*)&finish_event_);
+      StartFinish();
       return;
     }
 
-    response_reader_->Read(&response_, (void*)&read_event_);
+    StartRead();
   }
 
   void HandleReadEvent(const CompletionQueue::ClientEvent& client_event) {
@@ -179,11 +250,32 @@ class AsyncClient<RpcServiceMethodConcept,
         callback_(::grpc::Status(), &response_);
         if (!client_event.ok) callback_ = nullptr;
       }
-      response_reader_->Read(&response_, (void*)&read_event_);
+      StartRead();
     } else {
       finish_status_ = ::grpc::Status();
-      response_reader_->Finish(&finish_status_, (void*)&finish_event_);
+      StartFinish();
+    }
+  }
+
+  void StartRead() {
+    if (local_call_) {
+      local_call_->ReadAsync(&response_, [this](bool ok) {
+        local_event_notifier_.Notify(&read_event_, ok);
+      });
+      return;
+    }
+    response_reader_->Read(&response_, (void*)&read_event_);
+  }
+
+  void StartFinish() {
+    if (local_call_) {
+      local_call_->FinishAsync([this](const ::grpc::Status& status) {
+        finish_status_ = status;
+        local_event_notifier_.Notify(&finish_event_, true /* ok */);
+      });
+      return;
     }
+    response_reader_->Finish(&finish_status_, (void*)&finish_event_);
   }
 
   void HandleFinishEvent(const CompletionQueue::ClientEvent& client_event) {
@@ -191,13 +283,16 @@ class AsyncClient<RpcServiceMethodConcept,
       if (!client_event.ok) {
         LOG(ERROR) << "Finish failed in async server streaming.";
       }
-      callback_(
+      // The final callback may destroy this client, so it must not be
+      // touched afterwards.
+      CallbackType callback = std::move(callback_);
+      callback_ = nullptr;
+      callback(
           client_event.ok
               ? ::grpc::Status()
               : ::grpc::Status(::grpc::INTERNAL,
                                "Finish failed in async server streaming."),
           nullptr);
-      callback_ = nullptr;
     }
   }
 
@@ -209,12 +304,15 @@ class AsyncClient<RpcServiceMethodConcept,
   const std::string rpc_method_name_;
   const ::grpc::internal::RpcMethod rpc_method_;
   std::unique_ptr<::grpc::ClientAsyncReader<ResponseType>> response_reader_;
+  std::unique_ptr<LocalClientCall<RpcServiceMethod>> local_call_;
+  LocalClientEventNotifier local_event_notifier_;
   CompletionQueue::ClientEvent write_event_;
   CompletionQueue::ClientEvent read_event_;
   CompletionQueue::ClientEvent finish_event_;
   ::grpc::Status status_;
   ResponseType response_;
   ::grpc::Status finish_status_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 }  // namespace async_grpc
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_BATCHING_RPC_HANDLER_H
+#define CPP_GRPC_BATCHING_RPC_HANDLER_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "async_grpc/common/make_unique.h"
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/common/port.h"
+#include "async_grpc/rpc_handler.h"
+#include "async_grpc/rpc_handler_interface.h"
+#include "glog/logging.h"
+
+namespace async_grpc {
+
+// Evaluates concurrent unary calls of a method together, e.g. lookups which
+// are much cheaper in bulk:
+//
+//   class GetPoseHandler : public BatchingRpcHandler<GetPoseMethod> {
+//    public:
+//     std::vector<std::unique_ptr<proto::GetPoseResponse>> OnBatch(
+//         const std::vector<const proto::GetPoseRequest*>& requests) override {
+//       auto poses = GetContext<PoseContext>();
+//       ...
+//     }
+//   };
+//
+// Requests are collected across all Rpcs of the method until
+// 'RpcHandlerOptions::max_request_batch_size' calls arrived or
+// 'RpcHandlerOptions::request_batch_window' passed since the first one. The
+// handler of the call which closed the batch then runs 'OnBatch()' on its
+// event thread and each response is sent to the Rpc of its request, which may
+// be served by another event thread.
+template <typename RpcServiceMethodConcept>
+class BatchingRpcHandler : public RpcHandler<RpcServiceMethodConcept> {
+  using Base = RpcHandler<RpcServiceMethodConcept>;
+
+ public:
+  using RpcServiceMethod = typename Base::RpcServiceMethod;
+  using RequestType = typename Base::RequestType;
+  using ResponseType = typename Base::ResponseType;
+  static_assert(RpcServiceMethod::StreamType ==
+                    ::grpc::internal::RpcMethod::NORMAL_RPC,
+                "Only unary calls can be batched.");
+
+  // Pending calls of the method, shared by all its handlers. Created by
+  // 'Server::Builder::RegisterHandler()'.
+  class SharedState {
+   public:
+    explicit SharedState(const RpcHandlerOptions& rpc_handler_options)
+        : max_batch_size_(rpc_handler_options.max_request_batch_size),
+          batch_window_(rpc_handler_options.request_batch_window) {}
+
+   private:
+    friend class BatchingRpcHandler;
+
+    struct Call {
+      // Copied, as the requests of other calls are only valid during their
+      // 'OnRequest()'.
+      std::unique_ptr<RequestType> request;
+      typename Base::Writer writer;
+    };
+
+    // Zero means batches are only closed by 'batch_window_'.
+    const size_t max_batch_size_;
+    const common::Duration batch_window_;
+    common::Mutex mutex_;
+    std::vector<Call> pending_calls_ GUARDED_BY(mutex_);
+    // Identifies the batch of 'pending_calls_' for its window timer.
+    int64 batch_id_ GUARDED_BY(mutex_) = 0;
+  };
+
+  // Returns one response per request in the same order. A 'nullptr' response
+  // fails its call with an INTERNAL error.
+  virtual std::vector<std::unique_ptr<ResponseType>> OnBatch(
+      const std::vector<const RequestType*>& requests) = 0;
+
+  void SetSharedState(std::shared_ptr<SharedState> shared_state) {
+    shared_state_ = std::move(shared_state);
+  }
+
+  void OnRequest(const RequestType& request) final {
+    CHECK(shared_state_) << RpcServiceMethod::MethodName()
+                         << " must be registered with a 'Server'.";
+    std::vector<typename SharedState::Call> batch;
+    bool opened_batch = false;
+    {
+      common::MutexLocker locker(&shared_state_->mutex_);
+      shared_state_->pending_calls_.push_back(typename SharedState::Call{
+          common::make_unique<RequestType>(request), this->GetWriter()});
+      if (shared_state_->pending_calls_.size() ==
+          shared_state_->max_batch_size_) {
+        batch.swap(shared_state_->pending_calls_);
+        ++shared_state_->batch_id_;
+      } else if (shared_state_->pending_calls_.size() == 1) {
+        opened_batch = true;
+        opened_batch_id_ = shared_state_->batch_id_;
+      }
+    }
+    if (opened_batch) {
+      const int64 batch_id = opened_batch_id_;
+      this->ScheduleAfter(shared_state_->batch_window_,
+                          [this, batch_id]() { CloseBatch(batch_id); });
+    }
+    RunBatch(&batch);
+  }
+
+  // The timer of a batch is dropped with the call which opened it, so the
+  // batch is closed early instead.
+  void OnCancel() override {
+    if (shared_state_) {
+      CloseBatch(opened_batch_id_);
+    }
+  }
+
+ private:
+  void CloseBatch(int64 batch_id) {
+    std::vector<typename SharedState::Call> batch;
+    {
+      common::MutexLocker locker(&shared_state_->mutex_);
+      if (shared_state_->batch_id_ != batch_id) {
+        return;
+      }
+      batch.swap(shared_state_->pending_calls_);
+      ++shared_state_->batch_id_;
+    }
+    RunBatch(&batch);
+  }
+
+  void RunBatch(std::vector<typename SharedState::Call>* batch) {
+    // Cancelled calls are skipped, their responses would be discarded.
+    std::vector<const RequestType*> requests;
+    std::vector<const typename Base::Writer*> writers;
+    for (const auto& call : *batch) {
+      if (!call.writer.IsCancelled()) {
+        requests.push_back(call.request.get());
+        writers.push_back(&call.writer);
+      }
+    }
+    if (requests.empty()) {
+      return;
+    }
+    std::vector<std::unique_ptr<ResponseType>> responses = OnBatch(requests);
+    CHECK_EQ(responses.size(), requests.size())
+        << RpcServiceMethod::MethodName()
+        << " returned the wrong number of responses.";
+    for (size_t i = 0; i < responses.size(); ++i) {
+      if (responses[i]) {
+        writers[i]->Write(std::move(responses[i]));
+      } else {
+        writers[i]->Finish(
+            ::grpc::Status(::grpc::INTERNAL, "No response in batch."));
+      }
+    }
+  }
+
+  std::shared_ptr<SharedState> shared_state_;
+  int64 opened_batch_id_ = -1;
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_BATCHING_RPC_HANDLER_H
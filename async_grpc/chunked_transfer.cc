@@ -0,0 +1,254 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/chunked_transfer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "glog/logging.h"
+#include "grpc++/impl/codegen/proto_utils.h"
+
+namespace async_grpc {
+namespace {
+
+enum ChunkHeader : uint8_t { kMoreChunks = 0, kLastChunk = 1 };
+
+// Splits 'chunk' into its header and its non-empty payload slices.
+::grpc::Status ParseChunk(const ::grpc::ByteBuffer& chunk, bool* last_chunk,
+                          std::vector<::grpc::Slice>* payload) {
+  std::vector<::grpc::Slice> slices;
+  ::grpc::Status status = chunk.Dump(&slices);
+  if (!status.ok()) {
+    return status;
+  }
+  bool has_header = false;
+  for (::grpc::Slice& slice : slices) {
+    if (slice.size() == 0) {
+      continue;
+    }
+    if (!has_header) {
+      const uint8_t header = slice.begin()[0];
+      if (header != kMoreChunks && header != kLastChunk) {
+        return ::grpc::Status(::grpc::INTERNAL, "Malformed chunk.");
+      }
+      *last_chunk = header == kLastChunk;
+      has_header = true;
+      if (slice.size() == 1) {
+        continue;
+      }
+      slice = slice.sub(1, slice.size());
+    }
+    payload->push_back(std::move(slice));
+  }
+  if (!has_header) {
+    return ::grpc::Status(::grpc::INTERNAL, "Empty chunk.");
+  }
+  return ::grpc::Status::OK;
+}
+
+size_t TotalSize(const std::vector<::grpc::Slice>& slices, size_t begin) {
+  size_t size = 0;
+  for (size_t i = begin; i < slices.size(); ++i) {
+    size += slices[i].size();
+  }
+  return size;
+}
+
+::grpc::Status MessageTooLarge() {
+  return ::grpc::Status(::grpc::RESOURCE_EXHAUSTED,
+                        "Chunked message exceeds the maximum size.");
+}
+
+}  // namespace
+
+ChunkedMessageWriter::ChunkedMessageWriter(
+    const google::protobuf::Message& message, size_t chunk_size)
+    : chunk_size_(chunk_size) {
+  ::grpc::ByteBuffer serialized_message;
+  bool own_buffer;
+  const ::grpc::Status status =
+      ::grpc::SerializationTraits<google::protobuf::Message>::Serialize(
+          message, &serialized_message, &own_buffer);
+  CHECK(status.ok()) << status.error_message();
+  Initialize(serialized_message);
+}
+
+ChunkedMessageWriter::ChunkedMessageWriter(
+    const ::grpc::ByteBuffer& serialized_message, size_t chunk_size)
+    : chunk_size_(chunk_size) {
+  Initialize(serialized_message);
+}
+
+void ChunkedMessageWriter::Initialize(
+    const ::grpc::ByteBuffer& serialized_message) {
+  CHECK_GT(chunk_size_, 0);
+  if (serialized_message.Valid()) {
+    CHECK(serialized_message.Dump(&slices_).ok());
+  }
+}
+
+::grpc::ByteBuffer ChunkedMessageWriter::NextChunk() {
+  CHECK(!done_);
+  // The header is filled in once we know whether this is the last chunk.
+  std::vector<::grpc::Slice> chunk(1);
+  size_t remaining = chunk_size_;
+  while (remaining > 0 && slice_index_ < slices_.size()) {
+    const ::grpc::Slice& slice = slices_[slice_index_];
+    const size_t size = std::min(remaining, slice.size() - slice_offset_);
+    if (size > 0) {
+      chunk.push_back(slice.sub(slice_offset_, slice_offset_ + size));
+    }
+    slice_offset_ += size;
+    remaining -= size;
+    if (slice_offset_ == slice.size()) {
+      // Drops our reference, the chunks keep what is still in flight.
+      slices_[slice_index_] = ::grpc::Slice();
+      ++slice_index_;
+      slice_offset_ = 0;
+    }
+  }
+  done_ = slice_index_ == slices_.size();
+  const char header = done_ ? kLastChunk : kMoreChunks;
+  chunk.front() = ::grpc::Slice(&header, 1);
+  return ::grpc::ByteBuffer(chunk.data(), chunk.size());
+}
+
+bool ChunkedMessageWriter::WriteChunks(
+    const std::function<bool(::grpc::ByteBuffer*)>& try_write) {
+  while (!done_ || pending_chunk_.Valid()) {
+    if (!pending_chunk_.Valid()) {
+      pending_chunk_ = NextChunk();
+    }
+    if (!try_write(&pending_chunk_)) {
+      return false;
+    }
+    pending_chunk_.Clear();
+  }
+  return true;
+}
+
+ChunkedMessageReader::ChunkedMessageReader(size_t max_message_size)
+    : max_message_size_(max_message_size) {}
+
+::grpc::Status ChunkedMessageReader::AddChunk(
+    const ::grpc::ByteBuffer& chunk) {
+  if (complete_) {
+    return ::grpc::Status(::grpc::FAILED_PRECONDITION,
+                          "The previous message was not taken.");
+  }
+  const size_t begin = slices_.size();
+  bool last_chunk = false;
+  ::grpc::Status status = ParseChunk(chunk, &last_chunk, &slices_);
+  if (!status.ok()) {
+    return status;
+  }
+  size_ += TotalSize(slices_, begin);
+  if (size_ > max_message_size_) {
+    slices_.clear();
+    size_ = 0;
+    return MessageTooLarge();
+  }
+  complete_ = last_chunk;
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status ChunkedMessageReader::TakeMessage(
+    google::protobuf::Message* message) {
+  if (!complete_) {
+    return ::grpc::Status(::grpc::FAILED_PRECONDITION,
+                          "The message is incomplete.");
+  }
+  std::vector<::grpc::Slice> slices;
+  slices.swap(slices_);
+  size_ = 0;
+  complete_ = false;
+  if (slices.empty()) {
+    message->Clear();
+    return ::grpc::Status::OK;
+  }
+  ::grpc::ByteBuffer buffer(slices.data(), slices.size());
+  slices.clear();
+  return ::grpc::SerializationTraits<google::protobuf::Message>::Deserialize(
+      &buffer, message);
+}
+
+ChunkInputStream::ChunkInputStream(ReadChunkFunction read_chunk,
+                                   size_t max_message_size)
+    : read_chunk_(std::move(read_chunk)), max_message_size_(max_message_size) {}
+
+bool ChunkInputStream::Next(const void** data, int* size) {
+  while (slice_index_ == slices_.size()) {
+    if (last_chunk_ || !status_.ok() || !ReadNextChunk()) {
+      return false;
+    }
+  }
+  const ::grpc::Slice& slice = slices_[slice_index_];
+  const size_t offset = backed_up_ > 0 ? slice.size() - backed_up_ : 0;
+  *data = slice.begin() + offset;
+  *size = slice.size() - offset;
+  byte_count_ += *size;
+  backed_up_ = 0;
+  ++slice_index_;
+  return true;
+}
+
+void ChunkInputStream::BackUp(int count) {
+  CHECK_GT(slice_index_, 0);
+  --slice_index_;
+  backed_up_ = count;
+  byte_count_ -= count;
+}
+
+bool ChunkInputStream::Skip(int count) {
+  while (count > 0) {
+    const void* data;
+    int size;
+    if (!Next(&data, &size)) {
+      return false;
+    }
+    if (size > count) {
+      BackUp(size - count);
+      return true;
+    }
+    count -= size;
+  }
+  return true;
+}
+
+bool ChunkInputStream::ReadNextChunk() {
+  ::grpc::ByteBuffer chunk;
+  if (!read_chunk_(&chunk)) {
+    status_ = ::grpc::Status(::grpc::DATA_LOSS,
+                             "The stream ended before the last chunk.");
+    return false;
+  }
+  // Releases the previous chunk before parsing continues.
+  slices_.clear();
+  slice_index_ = 0;
+  backed_up_ = 0;
+  status_ = ParseChunk(chunk, &last_chunk_, &slices_);
+  if (!status_.ok()) {
+    return false;
+  }
+  if (byte_count_ + TotalSize(slices_, 0) > max_message_size_) {
+    status_ = MessageTooLarge();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_CHUNKED_TRANSFER_H
+#define CPP_GRPC_CHUNKED_TRANSFER_H
+
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/message.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// Helpers to transfer protobuf messages larger than the maximum message size,
+// e.g. whole submaps or serialized states, over a server or client streaming
+// method with '::grpc::ByteBuffer' messages, see 'RawRpcHandler'. A message is
+// serialized once and split into chunks of bounded size which reference the
+// serialized bytes without copying them. Each chunk starts with a one byte
+// header marking the last chunk of a message, so several messages can follow
+// each other on the same stream.
+//
+// Server streaming:
+//   void OnRequest(const ::grpc::ByteBuffer& request) override {
+//     SetSendQueueWaterMarks(4, 2);
+//     writer_ = common::make_unique<ChunkedMessageWriter>(submap);
+//     OnWritable();
+//   }
+//   void OnWritable() override {
+//     if (writer_->WriteChunks([this](::grpc::ByteBuffer* chunk) {
+//           return TrySend(chunk);
+//         })) {
+//       Finish(::grpc::Status::OK);
+//     }
+//   }
+// and on the client 'ReadChunkedMessage(&client, &submap)'.
+//
+// Client streaming: 'WriteChunkedMessage(&client, submap)' and a
+// 'ChunkedMessageReader' in the handler.
+
+constexpr size_t kDefaultChunkSize = 1024 * 1024;  // 1 MB
+// Protobuf cannot parse larger messages.
+constexpr size_t kDefaultMaxChunkedMessageSize = INT_MAX;
+
+class ChunkedMessageWriter {
+ public:
+  explicit ChunkedMessageWriter(const google::protobuf::Message& message,
+                                size_t chunk_size = kDefaultChunkSize);
+  // For messages that are already serialized.
+  explicit ChunkedMessageWriter(const ::grpc::ByteBuffer& serialized_message,
+                                size_t chunk_size = kDefaultChunkSize);
+
+  bool done() const { return done_; }
+
+  // Returns the next chunk. Must not be called once 'done()'.
+  ::grpc::ByteBuffer NextChunk();
+
+  // Hands chunks to 'try_write' until it returns false, which keeps the
+  // rejected chunk for the next call, or until all chunks were written.
+  // Returns true once all chunks were written.
+  bool WriteChunks(const std::function<bool(::grpc::ByteBuffer*)>& try_write);
+
+ private:
+  void Initialize(const ::grpc::ByteBuffer& serialized_message);
+
+  const size_t chunk_size_;
+  std::vector<::grpc::Slice> slices_;
+  size_t slice_index_ = 0;
+  size_t slice_offset_ = 0;
+  bool done_ = false;
+  // Rejected by 'try_write' in 'WriteChunks()'.
+  ::grpc::ByteBuffer pending_chunk_;
+};
+
+// Reassembles messages from chunks delivered one by one, e.g. to
+// 'RawRpcHandler::OnRequest()'. The received slices are referenced, not
+// copied, until the message is parsed.
+class ChunkedMessageReader {
+ public:
+  explicit ChunkedMessageReader(
+      size_t max_message_size = kDefaultMaxChunkedMessageSize);
+
+  // Fails for malformed chunks and messages larger than 'max_message_size'.
+  ::grpc::Status AddChunk(const ::grpc::ByteBuffer& chunk);
+  // True once the last chunk of a message was added.
+  bool HasMessage() const { return complete_; }
+  // Parses the reassembled message and gets ready for the next one.
+  ::grpc::Status TakeMessage(google::protobuf::Message* message);
+
+ private:
+  const size_t max_message_size_;
+  std::vector<::grpc::Slice> slices_;
+  size_t size_ = 0;
+  bool complete_ = false;
+};
+
+// Presents the chunks of a single message as a stream that protobuf parses
+// while the chunks arrive. Only the current chunk is held in memory.
+class ChunkInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  // Blocks until the next chunk is available. Returns false at the end of the
+  // stream.
+  using ReadChunkFunction = std::function<bool(::grpc::ByteBuffer*)>;
+
+  ChunkInputStream(ReadChunkFunction read_chunk, size_t max_message_size);
+
+  bool Next(const void** data, int* size) override;
+  void BackUp(int count) override;
+  bool Skip(int count) override;
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  // Not OK if the stream ended before the last chunk or was malformed.
+  const ::grpc::Status& status() const { return status_; }
+
+ private:
+  bool ReadNextChunk();
+
+  const ReadChunkFunction read_chunk_;
+  const size_t max_message_size_;
+  std::vector<::grpc::Slice> slices_;
+  size_t slice_index_ = 0;
+  // Bytes of the current slice that were backed up.
+  int backed_up_ = 0;
+  bool last_chunk_ = false;
+  google::protobuf::int64 byte_count_ = 0;
+  ::grpc::Status status_;
+};
+
+// Reads a single chunked message from the response stream of 'client', e.g. a
+// 'Client' of a server streaming method, parsing it incrementally.
+template <typename ClientType>
+::grpc::Status ReadChunkedMessage(
+    ClientType* client, google::protobuf::Message* message,
+    size_t max_message_size = kDefaultMaxChunkedMessageSize) {
+  ChunkInputStream stream(
+      [client](::grpc::ByteBuffer* chunk) { return client->StreamRead(chunk); },
+      max_message_size);
+  const bool parsed = message->ParseFromZeroCopyStream(&stream);
+  if (!stream.status().ok()) {
+    return stream.status();
+  }
+  if (!parsed) {
+    return ::grpc::Status(::grpc::INTERNAL, "Failed to parse chunked message.");
+  }
+  return ::grpc::Status::OK;
+}
+
+// Writes 'message' in chunks to the request stream of 'client', e.g. a
+// 'Client' of a client streaming method. gRPC's flow control blocks each
+// write until the server caught up. Returns false if the call failed.
+template <typename ClientType>
+bool WriteChunkedMessage(ClientType* client,
+                         const google::protobuf::Message& message,
+                         size_t chunk_size = kDefaultChunkSize) {
+  ChunkedMessageWriter writer(message, chunk_size);
+  return writer.WriteChunks(
+      [client](::grpc::ByteBuffer* chunk) { return client->Write(*chunk); });
+}
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_CHUNKED_TRANSFER_H
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/chunked_transfer.h"
+
+#include <deque>
+
+#include "async_grpc/proto/benchmark.pb.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+proto::PointCloud MakePointCloud(int num_points) {
+  proto::PointCloud point_cloud;
+  for (int i = 0; i < num_points; ++i) {
+    proto::Point* point = point_cloud.add_points();
+    point->set_x(i);
+    point->set_y(2 * i);
+    point->set_z(3 * i);
+  }
+  return point_cloud;
+}
+
+std::deque<::grpc::ByteBuffer> Split(const google::protobuf::Message& message,
+                                     size_t chunk_size) {
+  std::deque<::grpc::ByteBuffer> chunks;
+  ChunkedMessageWriter writer(message, chunk_size);
+  while (!writer.done()) {
+    chunks.push_back(writer.NextChunk());
+  }
+  return chunks;
+}
+
+TEST(ChunkedTransferTest, ChunksAreBounded) {
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  const size_t size = point_cloud.ByteSizeLong();
+  const std::deque<::grpc::ByteBuffer> chunks = Split(point_cloud, 100);
+  EXPECT_EQ(chunks.size(), (size + 99) / 100);
+  for (const ::grpc::ByteBuffer& chunk : chunks) {
+    // One byte header.
+    EXPECT_LE(chunk.Length(), 101);
+  }
+}
+
+TEST(ChunkedTransferTest, EmptyMessageIsASingleChunk) {
+  EXPECT_EQ(Split(proto::PointCloud(), 100).size(), 1);
+}
+
+TEST(ChunkedTransferTest, Reassemble) {
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  ChunkedMessageReader reader;
+  for (int i = 0; i < 2; ++i) {
+    for (const ::grpc::ByteBuffer& chunk : Split(point_cloud, 100)) {
+      EXPECT_FALSE(reader.HasMessage());
+      EXPECT_TRUE(reader.AddChunk(chunk).ok());
+    }
+    ASSERT_TRUE(reader.HasMessage());
+    proto::PointCloud reassembled;
+    EXPECT_TRUE(reader.TakeMessage(&reassembled).ok());
+    EXPECT_EQ(reassembled.SerializeAsString(), point_cloud.SerializeAsString());
+  }
+  EXPECT_FALSE(reader.HasMessage());
+}
+
+TEST(ChunkedTransferTest, ReaderEnforcesMaxMessageSize) {
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  ChunkedMessageReader reader(point_cloud.ByteSizeLong() - 1);
+  ::grpc::Status status;
+  for (const ::grpc::ByteBuffer& chunk : Split(point_cloud, 100)) {
+    status = reader.AddChunk(chunk);
+    if (!status.ok()) {
+      break;
+    }
+  }
+  EXPECT_EQ(status.error_code(), ::grpc::RESOURCE_EXHAUSTED);
+  EXPECT_FALSE(reader.HasMessage());
+}
+
+TEST(ChunkedTransferTest, WriteChunksResumesRejectedChunk) {
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  ChunkedMessageWriter writer(point_cloud, 100);
+  ChunkedMessageReader reader;
+  int capacity = 3;
+  const auto try_write = [&reader, &capacity](::grpc::ByteBuffer* chunk) {
+    if (capacity == 0) {
+      return false;
+    }
+    --capacity;
+    EXPECT_TRUE(reader.AddChunk(*chunk).ok());
+    return true;
+  };
+  while (!writer.WriteChunks(try_write)) {
+    EXPECT_EQ(capacity, 0);
+    capacity = 3;
+  }
+  ASSERT_TRUE(reader.HasMessage());
+  proto::PointCloud reassembled;
+  EXPECT_TRUE(reader.TakeMessage(&reassembled).ok());
+  EXPECT_EQ(reassembled.SerializeAsString(), point_cloud.SerializeAsString());
+}
+
+TEST(ChunkedTransferTest, ParseIncrementally) {
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  std::deque<::grpc::ByteBuffer> chunks = Split(point_cloud, 100);
+  ChunkInputStream stream(
+      [&chunks](::grpc::ByteBuffer* chunk) {
+        if (chunks.empty()) {
+          return false;
+        }
+        *chunk = chunks.front();
+        chunks.pop_front();
+        return true;
+      },
+      kDefaultMaxChunkedMessageSize);
+  proto::PointCloud parsed;
+  EXPECT_TRUE(parsed.ParseFromZeroCopyStream(&stream));
+  EXPECT_TRUE(stream.status().ok());
+  EXPECT_EQ(parsed.SerializeAsString(), point_cloud.SerializeAsString());
+  EXPECT_EQ(stream.ByteCount(), point_cloud.ByteSizeLong());
+}
+
+TEST(ChunkedTransferTest, IncrementalParseDetectsTruncation) {
+  std::deque<::grpc::ByteBuffer> chunks = Split(MakePointCloud(1000), 100);
+  chunks.pop_back();
+  ChunkInputStream stream(
+      [&chunks](::grpc::ByteBuffer* chunk) {
+        if (chunks.empty()) {
+          return false;
+        }
+        *chunk = chunks.front();
+        chunks.pop_front();
+        return true;
+      },
+      kDefaultMaxChunkedMessageSize);
+  proto::PointCloud parsed;
+  parsed.ParseFromZeroCopyStream(&stream);
+  EXPECT_EQ(stream.status().error_code(), ::grpc::DATA_LOSS);
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -18,6 +18,8 @@
 #define CPP_GRPC_CLIENT_H
 
 #include "async_grpc/common/optional.h"
+#include "async_grpc/compression.h"
+#include "async_grpc/local_call.h"
 #include "async_grpc/retry.h"
 #include "async_grpc/rpc_handler_interface.h"
 #include "async_grpc/rpc_service_method_traits.h"
@@ -35,6 +37,12 @@ namespace async_grpc {
 // server streaming, or bidirectional.
 // It cannot be used for multiple invocations.
 // It is not thread safe.
+// On an in-process channel of a server with in-process bypass enabled, calls
+// to protobuf methods hand the messages to the server without serializing
+// them, see 'Server::Builder::EnableInProcessBypass()'.
+// 'SetCompressor()' compresses requests as decided by the given 'Compressor',
+// which may be shared by many clients to aggregate its statistics. It must be
+// called before the first 'Write()'.
 template <typename RpcServiceMethodConcept,
           ::grpc::internal::RpcMethod::RpcType StreamType =
               RpcServiceMethodTraits<RpcServiceMethodConcept>::StreamType>
@@ -67,6 +75,11 @@ class Client<RpcServiceMethodConcept, ::grpc::internal::RpcMethod::NORMAL_RPC> {
         timeout_(timeout),
         retry_strategy_(retry_strategy) {}
 
+  // See 'Client'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   bool Write(const RequestType& request, ::grpc::Status* status = nullptr) {
     ::grpc::Status internal_status;
     common::optional<std::chrono::system_clock::time_point> deadline;
@@ -108,6 +121,13 @@ class Client<RpcServiceMethodConcept, ::grpc::internal::RpcMethod::NORMAL_RPC> {
   }
   ::grpc::Status MakeBlockingUnaryCall(const RequestType& request,
                                        ResponseType* response) {
+    if (auto local_call = LocalClientCall<RpcServiceMethod>::Start(
+            channel_.get(), &request, client_context_->deadline())) {
+      return local_call->FinishUnary(response);
+    }
+    if (compressor_) {
+      compressor_->ConfigureContext(request, client_context_.get());
+    }
     return ::grpc::internal::BlockingUnaryCall(
         channel_.get(), rpc_method_, client_context_.get(), request, response);
   }
@@ -120,6 +140,7 @@ class Client<RpcServiceMethodConcept, ::grpc::internal::RpcMethod::NORMAL_RPC> {
 
   ResponseType response_;
   RetryStrategy retry_strategy_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 template <typename RpcServiceMethodConcept>
@@ -137,6 +158,11 @@ class Client<RpcServiceMethodConcept,
         rpc_method_(rpc_method_name_.c_str(), RpcServiceMethod::StreamType,
                     channel_) {}
 
+  // See 'Client'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   bool Write(const RequestType& request, ::grpc::Status* status = nullptr) {
     ::grpc::Status internal_status;
     WriteImpl(request, &internal_status);
@@ -148,11 +174,17 @@ class Client<RpcServiceMethodConcept,
 
   bool StreamWritesDone() {
     InstantiateClientWriterIfNeeded();
+    if (local_call_) {
+      return local_call_->WritesDone();
+    }
     return client_writer_->WritesDone();
   }
 
   ::grpc::Status StreamFinish() {
     InstantiateClientWriterIfNeeded();
+    if (local_call_) {
+      return local_call_->FinishUnary(&response_);
+    }
     return client_writer_->Finish();
   }
 
@@ -161,11 +193,26 @@ class Client<RpcServiceMethodConcept,
  private:
   bool WriteImpl(const RequestType& request, ::grpc::Status* status) {
     InstantiateClientWriterIfNeeded();
-    return client_writer_->Write(request);
+    if (local_call_) {
+      return local_call_->Write(request);
+    }
+    return client_writer_->Write(request, GetWriteOptions(request));
+  }
+
+  ::grpc::WriteOptions GetWriteOptions(const RequestType& request) {
+    return compressor_ ? compressor_->GetWriteOptions(request)
+                       : ::grpc::WriteOptions();
   }
 
   void InstantiateClientWriterIfNeeded() {
-    if (!client_writer_) {
+    if (client_writer_ || local_call_) {
+      return;
+    }
+    local_call_ = LocalClientCall<RpcServiceMethod>::Start(channel_.get());
+    if (!local_call_) {
+      if (compressor_) {
+        compressor_->ConfigureContext(client_context_.get());
+      }
       client_writer_.reset(
           ::grpc::internal::ClientWriterFactory<RequestType>::Create(
               channel_.get(), rpc_method_, client_context_.get(), &response_));
@@ -178,7 +225,9 @@ class Client<RpcServiceMethodConcept,
   const ::grpc::internal::RpcMethod rpc_method_;
 
   std::unique_ptr<::grpc::ClientWriter<RequestType>> client_writer_;
+  std::unique_ptr<LocalClientCall<RpcServiceMethod>> local_call_;
   ResponseType response_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 template <typename RpcServiceMethodConcept>
@@ -197,10 +246,18 @@ class Client<RpcServiceMethodConcept,
                     channel_) {}
 
   bool StreamRead(ResponseType* response) {
+    if (local_call_) {
+      return local_call_->Read(response);
+    }
     CHECK(client_reader_);
     return client_reader_->Read(response);
   }
 
+  // See 'Client'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   bool Write(const RequestType& request, ::grpc::Status* status = nullptr) {
     ::grpc::Status internal_status;
     WriteImpl(request, &internal_status);
@@ -211,6 +268,9 @@ class Client<RpcServiceMethodConcept,
   }
 
   ::grpc::Status StreamFinish() {
+    if (local_call_) {
+      return local_call_->Finish();
+    }
     CHECK(client_reader_);
     return client_reader_->Finish();
   }
@@ -222,6 +282,14 @@ class Client<RpcServiceMethodConcept,
   }
 
   void InstantiateClientReader(const RequestType& request) {
+    local_call_ =
+        LocalClientCall<RpcServiceMethod>::Start(channel_.get(), &request);
+    if (local_call_) {
+      return;
+    }
+    if (compressor_) {
+      compressor_->ConfigureContext(request, client_context_.get());
+    }
     client_reader_.reset(
         ::grpc::internal::ClientReaderFactory<ResponseType>::Create(
             channel_.get(), rpc_method_, client_context_.get(), request));
@@ -233,6 +301,8 @@ class Client<RpcServiceMethodConcept,
   const ::grpc::internal::RpcMethod rpc_method_;
 
   std::unique_ptr<::grpc::ClientReader<ResponseType>> client_reader_;
+  std::unique_ptr<LocalClientCall<RpcServiceMethod>> local_call_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 template <typename RpcServiceMethodConcept>
@@ -252,9 +322,17 @@ class Client<RpcServiceMethodConcept,
 
   bool StreamRead(ResponseType* response) {
     InstantiateClientReaderWriterIfNeeded();
+    if (local_call_) {
+      return local_call_->Read(response);
+    }
     return client_reader_writer_->Read(response);
   }
 
+  // See 'Client'.
+  void SetCompressor(std::shared_ptr<Compressor> compressor) {
+    compressor_ = std::move(compressor);
+  }
+
   bool Write(const RequestType& request, ::grpc::Status* status = nullptr) {
     ::grpc::Status internal_status;
     WriteImpl(request, &internal_status);
@@ -266,22 +344,43 @@ class Client<RpcServiceMethodConcept,
 
   bool StreamWritesDone() {
     InstantiateClientReaderWriterIfNeeded();
+    if (local_call_) {
+      return local_call_->WritesDone();
+    }
     return client_reader_writer_->WritesDone();
   }
 
   ::grpc::Status StreamFinish() {
     InstantiateClientReaderWriterIfNeeded();
+    if (local_call_) {
+      return local_call_->Finish();
+    }
     return client_reader_writer_->Finish();
   }
 
  private:
   bool WriteImpl(const RequestType& request, ::grpc::Status* status) {
     InstantiateClientReaderWriterIfNeeded();
-    return client_reader_writer_->Write(request);
+    if (local_call_) {
+      return local_call_->Write(request);
+    }
+    return client_reader_writer_->Write(request, GetWriteOptions(request));
+  }
+
+  ::grpc::WriteOptions GetWriteOptions(const RequestType& request) {
+    return compressor_ ? compressor_->GetWriteOptions(request)
+                       : ::grpc::WriteOptions();
   }
 
   void InstantiateClientReaderWriterIfNeeded() {
-    if (!client_reader_writer_) {
+    if (client_reader_writer_ || local_call_) {
+      return;
+    }
+    local_call_ = LocalClientCall<RpcServiceMethod>::Start(channel_.get());
+    if (!local_call_) {
+      if (compressor_) {
+        compressor_->ConfigureContext(client_context_.get());
+      }
       client_reader_writer_.reset(
           ::grpc::internal::ClientReaderWriterFactory<
               RequestType, ResponseType>::Create(channel_.get(), rpc_method_,
@@ -296,6 +395,8 @@ class Client<RpcServiceMethodConcept,
 
   std::unique_ptr<::grpc::ClientReaderWriter<RequestType, ResponseType>>
       client_reader_writer_;
+  std::unique_ptr<LocalClientCall<RpcServiceMethod>> local_call_;
+  std::shared_ptr<Compressor> compressor_;
 };
 
 }  // namespace async_grpc
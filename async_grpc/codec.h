@@ -0,0 +1,125 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_CODEC_H
+#define CPP_GRPC_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "grpc++/grpc++.h"
+#include "grpc++/impl/codegen/proto_utils.h"
+
+namespace async_grpc {
+
+// Message types are (de)serialized by their '::grpc::SerializationTraits'
+// specialization, on the server as well as in 'Client' and 'AsyncClient'.
+// gRPC provides them for protobuf messages, the default, and for
+// '::grpc::ByteBuffer'. Any other type, e.g. a FlatBuffers table or a plain
+// struct, becomes usable as request or response type by specializing
+// '::grpc::SerializationTraits' for it.
+template <typename MessageType>
+struct Codec {
+  static ::grpc::Status Serialize(const MessageType& message,
+                                  ::grpc::ByteBuffer* buffer) {
+    bool own_buffer;
+    return ::grpc::SerializationTraits<MessageType>::Serialize(message, buffer,
+                                                               &own_buffer);
+  }
+
+  // Consumes 'buffer'.
+  static ::grpc::Status Deserialize(::grpc::ByteBuffer* buffer,
+                                    MessageType* message) {
+    return ::grpc::SerializationTraits<MessageType>::Deserialize(buffer,
+                                                                 message);
+  }
+};
+
+// Protobuf messages are parsed by 'Rpc' itself, which allows using arenas and
+// slow-consumer conflation. Other message types are decoded by 'RpcHandler'.
+template <typename MessageType>
+struct IsProtobufMessage
+    : std::is_base_of<::google::protobuf::Message, MessageType> {};
+
+// Called on responses that are no protobuf messages before 'RpcHandler'
+// serializes them, with whether the client runs on the same host. Message
+// types overload it to pick an encoding, see 'SharedPayload'.
+template <typename MessageType>
+void PrepareForPeer(MessageType* message, bool peer_on_same_host) {}
+
+template <typename MessageType>
+class HasCodec {
+ private:
+  template <typename U, typename = decltype(
+                            sizeof(::grpc::SerializationTraits<U>))>
+  static std::uint8_t check(int);
+  template <typename U>
+  static std::uint16_t check(...);
+
+ public:
+  static constexpr bool value =
+      sizeof(check<MessageType>(0)) == sizeof(std::uint8_t);
+};
+
+// Sends trivially copyable structs, e.g. high-rate sensor samples, as their
+// in-memory representation. Only suitable if client and server share the
+// same architecture. Usage:
+//   namespace grpc {
+//   template <>
+//   class SerializationTraits<ImuSample>
+//       : public async_grpc::PodSerializationTraits<ImuSample> {};
+//   }  // namespace grpc
+template <typename PodType>
+class PodSerializationTraits {
+  static_assert(std::is_trivially_copyable<PodType>::value,
+                "PodSerializationTraits requires a trivially copyable type.");
+
+ public:
+  static ::grpc::Status Serialize(const PodType& message,
+                                  ::grpc::ByteBuffer* buffer,
+                                  bool* own_buffer) {
+    ::grpc::Slice slice(&message, sizeof(PodType));
+    *buffer = ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+    *own_buffer = true;
+    return ::grpc::Status::OK;
+  }
+
+  static ::grpc::Status Deserialize(::grpc::ByteBuffer* buffer,
+                                    PodType* message) {
+    if (buffer->Length() != sizeof(PodType)) {
+      buffer->Clear();
+      return ::grpc::Status(::grpc::INTERNAL, "Unexpected message size.");
+    }
+    std::vector<::grpc::Slice> slices;
+    ::grpc::Status status = buffer->Dump(&slices);
+    if (status.ok()) {
+      char* destination = reinterpret_cast<char*>(message);
+      for (const ::grpc::Slice& slice : slices) {
+        std::memcpy(destination, slice.begin(), slice.size());
+        destination += slice.size();
+      }
+    }
+    buffer->Clear();
+    return status;
+  }
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_CODEC_H
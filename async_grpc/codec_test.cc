@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/codec.h"
+
+#include "async_grpc/proto/math_service.pb.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+struct ImuSample {
+  double timestamp;
+  float linear_acceleration[3];
+  float angular_velocity[3];
+};
+
+struct NoCodec {};
+
+}  // namespace
+}  // namespace async_grpc
+
+namespace grpc {
+template <>
+class SerializationTraits<async_grpc::ImuSample>
+    : public async_grpc::PodSerializationTraits<async_grpc::ImuSample> {};
+}  // namespace grpc
+
+namespace async_grpc {
+namespace {
+
+TEST(CodecTest, HasCodec) {
+  EXPECT_TRUE(HasCodec<proto::GetSumRequest>::value);
+  EXPECT_TRUE(HasCodec<::grpc::ByteBuffer>::value);
+  EXPECT_TRUE(HasCodec<ImuSample>::value);
+  EXPECT_FALSE(HasCodec<NoCodec>::value);
+  EXPECT_TRUE(IsProtobufMessage<proto::GetSumRequest>::value);
+  EXPECT_FALSE(IsProtobufMessage<ImuSample>::value);
+}
+
+TEST(CodecTest, PodRoundTrip) {
+  const ImuSample sample{42., {1.f, 2.f, 3.f}, {4.f, 5.f, 6.f}};
+  ::grpc::ByteBuffer buffer;
+  ASSERT_TRUE(Codec<ImuSample>::Serialize(sample, &buffer).ok());
+  EXPECT_EQ(buffer.Length(), sizeof(ImuSample));
+  ImuSample decoded;
+  ASSERT_TRUE(Codec<ImuSample>::Deserialize(&buffer, &decoded).ok());
+  EXPECT_EQ(decoded.timestamp, 42.);
+  EXPECT_EQ(decoded.linear_acceleration[2], 3.f);
+  EXPECT_EQ(decoded.angular_velocity[0], 4.f);
+}
+
+TEST(CodecTest, PodRejectsWrongSize) {
+  ::grpc::Slice slice(std::string("too short"));
+  ::grpc::ByteBuffer buffer(&slice, 1 /* nslices */);
+  ImuSample decoded;
+  EXPECT_FALSE(Codec<ImuSample>::Deserialize(&buffer, &decoded).ok());
+}
+
+}  // namespace
+}  // namespace async_grpc
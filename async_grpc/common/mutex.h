@@ -50,13 +50,20 @@ namespace common {
 #define RELEASE(...) \
   THREAD_ANNOTATION_ATTRIBUTE__(release_capability(__VA_ARGS__))
 
+#define ACQUIRE_SHARED(...) \
+  THREAD_ANNOTATION_ATTRIBUTE__(acquire_shared_capability(__VA_ARGS__))
+
 #define EXCLUDES(...) THREAD_ANNOTATION_ATTRIBUTE__(locks_excluded(__VA_ARGS__))
 
 #define NO_THREAD_SAFETY_ANALYSIS \
   THREAD_ANNOTATION_ATTRIBUTE__(no_thread_safety_analysis)
 
 // Defines an annotated mutex that can only be locked through its scoped locker
-// implementation.
+// implementation. Besides exclusively through 'Locker', it can be held by any
+// number of readers at the same time through 'ReaderLocker'. Waiting
+// exclusive lockers keep new readers out, so that a steady stream of readers
+// cannot starve them. Without readers, 'Locker' costs no more than locking a
+// plain 'std::mutex'.
 class CAPABILITY("mutex") Mutex {
  public:
   // A RAII class that acquires a mutex in its constructor, and
@@ -64,7 +71,14 @@ class CAPABILITY("mutex") Mutex {
   // conditions that get checked whenever the mutex is released.
   class SCOPED_CAPABILITY Locker {
    public:
-    Locker(Mutex* mutex) ACQUIRE(mutex) : mutex_(mutex), lock_(mutex->mutex_) {}
+    Locker(Mutex* mutex) ACQUIRE(mutex) : mutex_(mutex), lock_(mutex->mutex_) {
+      if (mutex_->num_readers_ > 0) {
+        ++mutex_->num_waiting_writers_;
+        mutex_->condition_.wait(lock_,
+                                [this]() { return mutex_->num_readers_ == 0; });
+        --mutex_->num_waiting_writers_;
+      }
+    }
 
     ~Locker() RELEASE() {
       lock_.unlock();
@@ -73,13 +87,19 @@ class CAPABILITY("mutex") Mutex {
 
     template <typename Predicate>
     void Await(Predicate predicate) REQUIRES(this) {
-      mutex_->condition_.wait(lock_, predicate);
+      // Readers may enter while the mutex is released for waiting.
+      mutex_->condition_.wait(lock_, [this, &predicate]() {
+        return mutex_->num_readers_ == 0 && predicate();
+      });
     }
 
     template <typename Predicate>
     bool AwaitWithTimeout(Predicate predicate, common::Duration timeout)
         REQUIRES(this) {
-      return mutex_->condition_.wait_for(lock_, timeout, predicate);
+      return mutex_->condition_.wait_for(
+          lock_, timeout, [this, &predicate]() {
+            return mutex_->num_readers_ == 0 && predicate();
+          });
     }
 
    private:
@@ -87,9 +107,39 @@ class CAPABILITY("mutex") Mutex {
     std::unique_lock<std::mutex> lock_;
   };
 
+  // Shares the mutex with other readers. Holders must not modify what the
+  // mutex guards.
+  class SCOPED_CAPABILITY ReaderLocker {
+   public:
+    ReaderLocker(Mutex* mutex) ACQUIRE_SHARED(mutex) : mutex_(mutex) {
+      std::unique_lock<std::mutex> lock(mutex_->mutex_);
+      mutex_->condition_.wait(
+          lock, [this]() { return mutex_->num_waiting_writers_ == 0; });
+      ++mutex_->num_readers_;
+    }
+
+    ~ReaderLocker() RELEASE() {
+      bool notify;
+      {
+        std::lock_guard<std::mutex> lock(mutex_->mutex_);
+        notify =
+            --mutex_->num_readers_ == 0 && mutex_->num_waiting_writers_ > 0;
+      }
+      if (notify) {
+        mutex_->condition_.notify_all();
+      }
+    }
+
+   private:
+    Mutex* mutex_;
+  };
+
  private:
   std::condition_variable condition_;
   std::mutex mutex_;
+  // Both only change while 'mutex_' is held.
+  int num_readers_ = 0;
+  int num_waiting_writers_ = 0;
 };
 
 using MutexLocker = Mutex::Locker;
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/compression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+#include "glog/logging.h"
+#include "zlib.h"
+
+namespace async_grpc {
+namespace {
+
+int64 NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Returns the size of 'message' compressed with gzip at zlib's default
+// level, which is what gRPC uses for GRPC_COMPRESS_GZIP and, give or take the
+// header, for GRPC_COMPRESS_DEFLATE.
+size_t GzipSize(const ::grpc::ByteBuffer& message) {
+  std::vector<::grpc::Slice> slices;
+  if (!message.Dump(&slices).ok()) {
+    return message.Length();
+  }
+  z_stream stream = {};
+  CHECK_EQ(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        15 | 16 /* gzip */, 8, Z_DEFAULT_STRATEGY),
+           Z_OK);
+  unsigned char output[16 << 10];
+  for (size_t i = 0; i < slices.size(); ++i) {
+    stream.next_in = const_cast<unsigned char*>(slices[i].begin());
+    stream.avail_in = slices[i].size();
+    const int flush = i + 1 == slices.size() ? Z_FINISH : Z_NO_FLUSH;
+    do {
+      stream.next_out = output;
+      stream.avail_out = sizeof(output);
+      deflate(&stream, flush);
+    } while (stream.avail_out == 0);
+  }
+  if (slices.empty()) {
+    stream.next_out = output;
+    stream.avail_out = sizeof(output);
+    deflate(&stream, Z_FINISH);
+  }
+  const size_t size = stream.total_out;
+  deflateEnd(&stream);
+  return size;
+}
+
+}  // namespace
+
+Compressor::Compressor(const CompressionOptions& options)
+    : options_(options),
+      num_compressed_messages_(0),
+      num_uncompressed_messages_(0),
+      num_skipped_for_cpu_load_(0),
+      compressed_message_bytes_(0),
+      num_decisions_since_sample_(0),
+      sampled_bytes_(0),
+      sampled_compressed_bytes_(0),
+      sampled_compression_time_ns_(0) {
+  CHECK(!options_.algorithms.empty());
+}
+
+bool Compressor::ShouldCompress(const ::grpc::ByteBuffer& message) {
+  if (!Decide(message.Length())) {
+    return false;
+  }
+  if (ShouldSample()) {
+    Sample(message);
+  }
+  return true;
+}
+
+void Compressor::ConfigureContext(::grpc::ClientContext* context) const {
+  context->set_compression_algorithm(algorithm());
+}
+
+CompressionStats Compressor::GetStats() const {
+  CompressionStats stats;
+  stats.num_compressed_messages = num_compressed_messages_;
+  stats.num_uncompressed_messages = num_uncompressed_messages_;
+  stats.num_skipped_for_cpu_load = num_skipped_for_cpu_load_;
+  stats.compressed_message_bytes = compressed_message_bytes_;
+  const int64 sampled_bytes = sampled_bytes_;
+  if (sampled_bytes > 0) {
+    const double scale =
+        static_cast<double>(stats.compressed_message_bytes) / sampled_bytes;
+    stats.estimated_bytes_saved =
+        scale * (sampled_bytes - sampled_compressed_bytes_);
+    stats.estimated_compression_time =
+        std::chrono::duration_cast<common::Duration>(std::chrono::nanoseconds(
+            static_cast<int64>(scale * sampled_compression_time_ns_)));
+  }
+  return stats;
+}
+
+bool Compressor::Decide(size_t message_size) {
+  if (message_size < options_.min_message_size) {
+    ++num_uncompressed_messages_;
+    return false;
+  }
+  if (options_.max_cpu_load > 0. && GetCpuLoad() > options_.max_cpu_load) {
+    ++num_uncompressed_messages_;
+    ++num_skipped_for_cpu_load_;
+    return false;
+  }
+  ++num_compressed_messages_;
+  compressed_message_bytes_ += message_size;
+  return true;
+}
+
+bool Compressor::ShouldSample() {
+  if (options_.sample_interval <= 0) {
+    return false;
+  }
+  return num_decisions_since_sample_++ % options_.sample_interval == 0;
+}
+
+void Compressor::Sample(const ::grpc::ByteBuffer& message) {
+  const int64 start_ns = NowNs();
+  const size_t compressed_size = GzipSize(message);
+  sampled_compression_time_ns_ += NowNs() - start_ns;
+  sampled_bytes_ += message.Length();
+  sampled_compressed_bytes_ += compressed_size;
+}
+
+std::shared_ptr<Compressor> CreateCompressor(
+    const CompressionOptions& options) {
+  if (options.algorithms.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<Compressor>(options);
+}
+
+double GetCpuLoad() {
+  static std::atomic<int64> next_update_ns(0);
+  static std::atomic<double> cpu_load(0.);
+  const int64 now_ns = NowNs();
+  int64 update_ns = next_update_ns;
+  if (now_ns >= update_ns &&
+      next_update_ns.compare_exchange_strong(update_ns, now_ns + 1000000000)) {
+    double load_average;
+    if (getloadavg(&load_average, 1) == 1) {
+      cpu_load = load_average /
+                 std::max(1u, std::thread::hardware_concurrency());
+    }
+  }
+  return cpu_load;
+}
+
+}  // namespace async_grpc
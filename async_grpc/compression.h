@@ -0,0 +1,155 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_COMPRESSION_H
+#define CPP_GRPC_COMPRESSION_H
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "async_grpc/codec.h"
+#include "async_grpc/common/port.h"
+#include "async_grpc/common/time.h"
+#include "grpc++/grpc++.h"
+#include "grpc/compression.h"
+
+namespace async_grpc {
+
+// Per-method compression policy for responses, see 'RpcHandlerOptions', and
+// for requests, see 'Client::SetCompressor()'.
+struct CompressionOptions {
+  // Algorithms in order of preference. Empty disables compression. gRPC does
+  // not tell the server which algorithms the client accepts, so the first one
+  // is always used; gRPC sends uncompressed if the peer lacks it.
+  std::vector<grpc_compression_algorithm> algorithms;
+  // Smaller messages are sent uncompressed, compressing them costs more CPU
+  // than it saves bandwidth.
+  size_t min_message_size = 1024;
+  // If positive, messages are sent uncompressed while the load average per
+  // core exceeds this value.
+  double max_cpu_load = 0.;
+  // gRPC compresses messages internally without reporting the result. To
+  // estimate the bytes saved and the time spent, every n-th compressed
+  // message is additionally compressed with zlib on the sending thread, for
+  // servers the event thread. Zero disables the estimate.
+  int sample_interval = 0;
+};
+
+struct CompressionStats {
+  int64 num_compressed_messages = 0;
+  // Messages below 'min_message_size' or sent while the CPU was busy.
+  int64 num_uncompressed_messages = 0;
+  int64 num_skipped_for_cpu_load = 0;
+  // Size of the compressed messages before compression.
+  int64 compressed_message_bytes = 0;
+  // Extrapolated from the sampled messages.
+  int64 estimated_bytes_saved = 0;
+  common::Duration estimated_compression_time = common::Duration::zero();
+};
+
+// Decides which messages of a method are compressed and counts the results.
+// Thread-safe, shared by all calls of a method.
+class Compressor {
+ public:
+  explicit Compressor(const CompressionOptions& options);
+
+  // Returns the preferred algorithm of the policy.
+  grpc_compression_algorithm algorithm() const {
+    return options_.algorithms.front();
+  }
+
+  // Returns whether 'message' is worth compressing and records the decision.
+  bool ShouldCompress(const ::grpc::ByteBuffer& message);
+  template <typename MessageType>
+  bool ShouldCompress(const MessageType& message) {
+    return ShouldCompress(message, IsProtobufMessage<MessageType>());
+  }
+
+  // Client side. Sets up 'context' for a call without request streaming
+  // before it starts.
+  template <typename MessageType>
+  void ConfigureContext(const MessageType& request,
+                        ::grpc::ClientContext* context) {
+    if (ShouldCompress(request)) {
+      context->set_compression_algorithm(algorithm());
+    }
+  }
+  // For calls with request streaming the algorithm is chosen up front and
+  // each message is gated by 'GetWriteOptions()'.
+  void ConfigureContext(::grpc::ClientContext* context) const;
+  template <typename MessageType>
+  ::grpc::WriteOptions GetWriteOptions(const MessageType& message) {
+    ::grpc::WriteOptions write_options;
+    if (!ShouldCompress(message)) {
+      write_options.set_no_compression();
+    }
+    return write_options;
+  }
+
+  CompressionStats GetStats() const;
+
+ private:
+  template <typename MessageType>
+  bool ShouldCompress(const MessageType& message, std::true_type) {
+    if (!Decide(message.ByteSizeLong())) {
+      return false;
+    }
+    if (ShouldSample()) {
+      // Only serializes the sampled messages, gRPC serializes all others.
+      ::grpc::ByteBuffer buffer;
+      if (Codec<MessageType>::Serialize(message, &buffer).ok()) {
+        Sample(buffer);
+      }
+    }
+    return true;
+  }
+  template <typename MessageType>
+  bool ShouldCompress(const MessageType& message, std::false_type) {
+    ::grpc::ByteBuffer buffer;
+    if (!Codec<MessageType>::Serialize(message, &buffer).ok()) {
+      return false;
+    }
+    return ShouldCompress(buffer);
+  }
+
+  bool Decide(size_t message_size);
+  bool ShouldSample();
+  void Sample(const ::grpc::ByteBuffer& message);
+
+  const CompressionOptions options_;
+  std::atomic<int64> num_compressed_messages_;
+  std::atomic<int64> num_uncompressed_messages_;
+  std::atomic<int64> num_skipped_for_cpu_load_;
+  std::atomic<int64> compressed_message_bytes_;
+  std::atomic<int64> num_decisions_since_sample_;
+  std::atomic<int64> sampled_bytes_;
+  std::atomic<int64> sampled_compressed_bytes_;
+  std::atomic<int64> sampled_compression_time_ns_;
+};
+
+// Returns 'nullptr' if 'options' enable no algorithm.
+std::shared_ptr<Compressor> CreateCompressor(
+    const CompressionOptions& options);
+
+// Returns the load average of the last minute divided by the number of cores,
+// refreshed at most once per second.
+double GetCpuLoad();
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_COMPRESSION_H
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/compression.h"
+
+#include "async_grpc/proto/benchmark.pb.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+::grpc::ByteBuffer MakeBuffer(size_t size) {
+  ::grpc::Slice slice(std::string(size, 'a'));
+  return ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+}
+
+CompressionOptions MakeOptions() {
+  CompressionOptions options;
+  options.algorithms = {GRPC_COMPRESS_DEFLATE, GRPC_COMPRESS_GZIP};
+  options.min_message_size = 100;
+  options.sample_interval = 1;
+  return options;
+}
+
+TEST(CompressionTest, CreateCompressor) {
+  EXPECT_EQ(CreateCompressor(CompressionOptions()), nullptr);
+  EXPECT_NE(CreateCompressor(MakeOptions()), nullptr);
+}
+
+TEST(CompressionTest, UsesPreferredAlgorithm) {
+  Compressor compressor(MakeOptions());
+  EXPECT_EQ(compressor.algorithm(), GRPC_COMPRESS_DEFLATE);
+}
+
+TEST(CompressionTest, SamplesOnlyOnRequest) {
+  CompressionOptions options = MakeOptions();
+  options.sample_interval = CompressionOptions().sample_interval;
+  Compressor compressor(options);
+  EXPECT_TRUE(compressor.ShouldCompress(MakeBuffer(10000)));
+  EXPECT_EQ(compressor.GetStats().estimated_bytes_saved, 0);
+}
+
+TEST(CompressionTest, CompressesOnlyLargeMessages) {
+  Compressor compressor(MakeOptions());
+  EXPECT_FALSE(compressor.ShouldCompress(MakeBuffer(99)));
+  EXPECT_TRUE(compressor.ShouldCompress(MakeBuffer(100)));
+  EXPECT_TRUE(compressor.ShouldCompress(MakeBuffer(10000)));
+  const CompressionStats stats = compressor.GetStats();
+  EXPECT_EQ(stats.num_compressed_messages, 2);
+  EXPECT_EQ(stats.num_uncompressed_messages, 1);
+  EXPECT_EQ(stats.num_skipped_for_cpu_load, 0);
+  EXPECT_EQ(stats.compressed_message_bytes, 10100);
+}
+
+TEST(CompressionTest, EstimatesSavings) {
+  Compressor compressor(MakeOptions());
+  EXPECT_EQ(compressor.GetStats().estimated_bytes_saved, 0);
+  EXPECT_TRUE(compressor.ShouldCompress(MakeBuffer(10000)));
+  const CompressionStats stats = compressor.GetStats();
+  // A single repeated character compresses extremely well.
+  EXPECT_GT(stats.estimated_bytes_saved, 9000);
+  EXPECT_LT(stats.estimated_bytes_saved, 10000);
+  EXPECT_GT(stats.estimated_compression_time, common::Duration::zero());
+}
+
+TEST(CompressionTest, ProtobufMessages) {
+  Compressor compressor(MakeOptions());
+  proto::PointCloud point_cloud;
+  EXPECT_FALSE(compressor.ShouldCompress(point_cloud));
+  for (int i = 0; i < 100; ++i) {
+    point_cloud.add_intensities(1.f);
+  }
+  EXPECT_TRUE(compressor.ShouldCompress(point_cloud));
+  EXPECT_EQ(compressor.GetStats().compressed_message_bytes,
+            point_cloud.ByteSizeLong());
+  EXPECT_GT(compressor.GetStats().estimated_bytes_saved, 0);
+}
+
+TEST(CompressionTest, SkipsCompressionUnderLoad) {
+  CompressionOptions options = MakeOptions();
+  options.max_cpu_load = 1e6;
+  Compressor compressor(options);
+  EXPECT_TRUE(compressor.ShouldCompress(MakeBuffer(1000)));
+  EXPECT_GE(GetCpuLoad(), 0.);
+  EXPECT_EQ(compressor.GetStats().num_skipped_for_cpu_load, 0);
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_COROUTINE_RPC_HANDLER_H
+#define CPP_GRPC_COROUTINE_RPC_HANDLER_H
+
+// Coroutines need C++20 while the library itself builds as C++11, so this
+// header is empty unless it is included from C++20 code.
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define ASYNC_GRPC_HAS_COROUTINES 1
+#endif
+#endif
+
+#if ASYNC_GRPC_HAS_COROUTINES
+
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <utility>
+
+#include "async_grpc/async_client.h"
+#include "async_grpc/common/make_unique.h"
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/rpc_handler.h"
+#include "async_grpc/rpc_service_method_traits.h"
+#include "glog/logging.h"
+
+namespace async_grpc {
+
+// Return type of 'CoroutineRpcHandler::Run()'. The coroutine is started by the
+// handler and its frame is destroyed together with the handler.
+class RpcTask {
+ public:
+  struct promise_type {
+    RpcTask get_return_object() {
+      return RpcTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() {
+      LOG(FATAL) << "Unhandled exception in a coroutine handler.";
+    }
+  };
+
+  RpcTask() = default;
+  RpcTask(RpcTask&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  RpcTask& operator=(RpcTask&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  RpcTask(const RpcTask&) = delete;
+  RpcTask& operator=(const RpcTask&) = delete;
+  ~RpcTask() { Reset(); }
+
+  void Start() { handle_.resume(); }
+  bool done() const { return !handle_ || handle_.done(); }
+
+ private:
+  explicit RpcTask(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  void Reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Outcome of a call to another service, see 'CoroutineRpcHandler::Call()'.
+template <typename ResponseType>
+struct CallResult {
+  ::grpc::Status status;
+  // Only set if 'status' is OK.
+  ResponseType response;
+};
+
+// A handler written as a single coroutine instead of callbacks:
+//
+//   class GetSumHandler : public CoroutineRpcHandler<GetSumMethod> {
+//    public:
+//     RpcTask Run() override {
+//       int sum = 0;
+//       while (auto request = co_await NextRequest()) {
+//         sum += request->input();
+//       }
+//       auto response = common::make_unique<proto::GetSumResponse>();
+//       response->set_output(sum);
+//       co_await Write(std::move(response));
+//     }
+//   };
+//
+// Awaiting suspends the coroutine without blocking the event thread, which
+// serves other Rpcs in the meantime. The coroutine always resumes on the
+// Rpc's event thread, so it needs no more synchronization than the callbacks
+// of an 'RpcHandler'.
+template <typename RpcServiceMethodConcept>
+class CoroutineRpcHandler : public RpcHandler<RpcServiceMethodConcept> {
+  using Base = RpcHandler<RpcServiceMethodConcept>;
+
+ public:
+  using RequestType = typename Base::RequestType;
+  using ResponseType = typename Base::ResponseType;
+
+  // Started once the call arrived. Must eventually write the response or
+  // call 'Finish()', as any other handler.
+  virtual RpcTask Run() = 0;
+
+  void Initialize() override {
+    task_ = Run();
+    task_.Start();
+  }
+  void OnRequest(const RequestType& request) final {
+    // Requests may live on the Rpc's arena, which is reset once this returns.
+    requests_.push_back(common::make_unique<RequestType>(request));
+    Resume(Waiting::REQUEST);
+  }
+  void OnReadsDone() final {
+    reads_done_ = true;
+    Resume(Waiting::REQUEST);
+  }
+  void OnWritable() final { Resume(Waiting::WRITABLE); }
+  void OnCancel() override {
+    Resume(Waiting::REQUEST);
+    Resume(Waiting::WRITABLE);
+  }
+
+ protected:
+  class NextRequestAwaiter {
+   public:
+    explicit NextRequestAwaiter(CoroutineRpcHandler* handler)
+        : handler_(handler) {}
+    bool await_ready() const {
+      return !handler_->requests_.empty() || handler_->reads_done_ ||
+             handler_->IsCancelled();
+    }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+      handler_->Suspend(Waiting::REQUEST, coroutine);
+    }
+    std::unique_ptr<RequestType> await_resume() {
+      if (handler_->requests_.empty()) {
+        return nullptr;
+      }
+      std::unique_ptr<RequestType> request =
+          std::move(handler_->requests_.front());
+      handler_->requests_.pop_front();
+      return request;
+    }
+
+   private:
+    CoroutineRpcHandler* const handler_;
+  };
+
+  class WriteAwaiter {
+   public:
+    WriteAwaiter(CoroutineRpcHandler* handler,
+                 std::unique_ptr<ResponseType> response)
+        : handler_(handler), response_(std::move(response)) {}
+    bool await_ready() {
+      return handler_->IsCancelled() || handler_->TrySend(&response_);
+    }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+      handler_->Suspend(Waiting::WRITABLE, coroutine);
+    }
+    bool await_resume() {
+      if (!response_) {
+        return true;
+      }
+      if (handler_->IsCancelled()) {
+        return false;
+      }
+      // The send queue drained to its low-water mark, unless other threads
+      // wrote in the meantime.
+      if (!handler_->TrySend(&response_)) {
+        handler_->Send(std::move(response_));
+      }
+      return true;
+    }
+
+   private:
+    CoroutineRpcHandler* const handler_;
+    std::unique_ptr<ResponseType> response_;
+  };
+
+  template <typename MethodConcept>
+  class CallAwaiter {
+    using Method = RpcServiceMethodTraits<MethodConcept>;
+    using CallRequestType = typename Method::RequestType;
+    using CallResponseType = typename Method::ResponseType;
+
+    // Shared by the awaiter and the callback of 'client', so that it outlives
+    // whichever of the two finishes last. Until the call completed, the
+    // callback keeps 'client' alive as well.
+    struct State {
+      common::Mutex mutex;
+      bool done GUARDED_BY(mutex) = false;
+      // Set if the handler is gone before the call completed.
+      bool orphaned GUARDED_BY(mutex) = false;
+      std::unique_ptr<AsyncClient<MethodConcept>> client;
+      CallResult<CallResponseType> result;
+    };
+
+   public:
+    CallAwaiter(CoroutineRpcHandler* handler,
+                std::shared_ptr<::grpc::Channel> channel,
+                const CallRequestType& request)
+        : handler_(handler),
+          channel_(std::move(channel)),
+          request_(request),
+          state_(std::make_shared<State>()) {}
+    CallAwaiter(const CallAwaiter&) = delete;
+    CallAwaiter& operator=(const CallAwaiter&) = delete;
+    ~CallAwaiter() {
+      if (!state_->client) {
+        return;
+      }
+      common::MutexLocker locker(&state_->mutex);
+      state_->orphaned = !state_->done;
+    }
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+      handler_->Suspend(Waiting::CALL, coroutine);
+      const std::shared_ptr<State> state = state_;
+      const auto writer = handler_->GetWriter();
+      CoroutineRpcHandler* const handler = handler_;
+      state->client = common::make_unique<AsyncClient<MethodConcept>>(
+          channel_, [state, writer, handler](const ::grpc::Status& status,
+                                             const CallResponseType* response) {
+            // Runs on a completion queue thread.
+            state->result.status = status;
+            if (response != nullptr) {
+              state->result.response = *response;
+            }
+            bool orphaned;
+            {
+              common::MutexLocker locker(&state->mutex);
+              state->done = true;
+              orphaned = state->orphaned;
+            }
+            if (!orphaned) {
+              // The handler exists as long as the Rpc accepts callbacks.
+              writer.Post([handler]() { handler->Resume(Waiting::CALL); });
+            }
+            // The 'AsyncClient' releases this callback, and with it possibly
+            // the last reference to 'state' and itself, only after it no
+            // longer touches its members.
+          });
+      state->client->WriteAsync(request_);
+    }
+    CallResult<CallResponseType> await_resume() {
+      return std::move(state_->result);
+    }
+
+   private:
+    CoroutineRpcHandler* const handler_;
+    const std::shared_ptr<::grpc::Channel> channel_;
+    const CallRequestType request_;
+    std::shared_ptr<State> state_;
+  };
+
+  // Returns the next request, or 'nullptr' once the client finished sending
+  // requests or cancelled the call.
+  NextRequestAwaiter NextRequest() { return NextRequestAwaiter(this); }
+
+  // Sends 'response', waiting for the client to catch up if the send queue is
+  // at its high-water mark, see 'SetSendQueueWaterMarks()'. Returns false if
+  // the call was cancelled.
+  WriteAwaiter Write(std::unique_ptr<ResponseType> response) {
+    return WriteAwaiter(this, std::move(response));
+  }
+
+  // Calls 'MethodConcept' through an 'AsyncClient' on 'channel'.
+  template <typename MethodConcept>
+  CallAwaiter<MethodConcept> Call(
+      std::shared_ptr<::grpc::Channel> channel,
+      const typename RpcServiceMethodTraits<MethodConcept>::RequestType&
+          request) {
+    return CallAwaiter<MethodConcept>(this, std::move(channel), request);
+  }
+
+ private:
+  enum class Waiting { NOTHING, REQUEST, WRITABLE, CALL };
+
+  void Suspend(Waiting waiting, std::coroutine_handle<> coroutine) {
+    CHECK(waiting_ == Waiting::NOTHING);
+    waiting_ = waiting;
+    suspended_coroutine_ = coroutine;
+  }
+  void Resume(Waiting waiting) {
+    if (waiting_ != waiting) {
+      return;
+    }
+    waiting_ = Waiting::NOTHING;
+    std::exchange(suspended_coroutine_, nullptr).resume();
+  }
+
+  std::deque<std::unique_ptr<RequestType>> requests_;
+  bool reads_done_ = false;
+  Waiting waiting_ = Waiting::NOTHING;
+  std::coroutine_handle<> suspended_coroutine_;
+  // Declared last, so that the coroutine frame is destroyed first.
+  RpcTask task_;
+};
+
+}  // namespace async_grpc
+
+#endif  // ASYNC_GRPC_HAS_COROUTINES
+
+#endif  // CPP_GRPC_COROUTINE_RPC_HANDLER_H
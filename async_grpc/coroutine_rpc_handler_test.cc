@@ -0,0 +1,214 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/coroutine_rpc_handler.h"
+
+// Only built with coroutines if the compiler supports C++20, see
+// CMakeLists.txt.
+#if ASYNC_GRPC_HAS_COROUTINES
+
+#include <future>
+#include <vector>
+
+#include "async_grpc/client.h"
+#include "async_grpc/execution_context.h"
+#include "async_grpc/proto/math_service.pb.h"
+#include "async_grpc/server.h"
+#include "grpc++/grpc++.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+const std::string kServerAddress = "localhost:50052";
+
+// Lets handlers call other methods of the same server.
+class DownstreamContext : public ExecutionContext {
+ public:
+  std::shared_ptr<::grpc::Channel> channel = ::grpc::CreateChannel(
+      kServerAddress, ::grpc::InsecureChannelCredentials());
+};
+
+struct GetSumMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetSum";
+  }
+  using IncomingType = Stream<proto::GetSumRequest>;
+  using OutgoingType = proto::GetSumResponse;
+};
+
+class GetSumHandler : public CoroutineRpcHandler<GetSumMethod> {
+ public:
+  RpcTask Run() override {
+    int sum = 0;
+    while (auto request = co_await NextRequest()) {
+      sum += request->input();
+    }
+    auto response = common::make_unique<proto::GetSumResponse>();
+    response->set_output(sum);
+    co_await Write(std::move(response));
+  }
+};
+
+struct GetSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetSequence";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
+
+// Never holds more than two undelivered responses.
+class GetSequenceHandler : public CoroutineRpcHandler<GetSequenceMethod> {
+ public:
+  RpcTask Run() override {
+    SetSendQueueWaterMarks(2 /* high_water_mark */, 1 /* low_water_mark */);
+    auto request = co_await NextRequest();
+    for (int i = 0; i < request->input(); ++i) {
+      auto response = common::make_unique<proto::GetSequenceResponse>();
+      response->set_output(i);
+      if (!co_await Write(std::move(response))) {
+        co_return;
+      }
+    }
+    Finish(::grpc::Status::OK);
+  }
+};
+
+struct GetSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+class GetSquareHandler : public RpcHandler<GetSquareMethod> {
+ public:
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    auto response = common::make_unique<proto::GetSquareResponse>();
+    response->set_output(request.input() * request.input());
+    Send(std::move(response));
+  }
+};
+
+struct GetEchoMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetEcho";
+  }
+  using IncomingType = proto::GetEchoRequest;
+  using OutgoingType = proto::GetEchoResponse;
+};
+
+// Responds with the square of the input plus one, computed by two calls to
+// 'GetSquare' on the same server. With a single event thread this would
+// deadlock if the calls blocked the event thread.
+class GetEchoHandler : public CoroutineRpcHandler<GetEchoMethod> {
+ public:
+  RpcTask Run() override {
+    auto request = co_await NextRequest();
+    const auto channel = GetUnsynchronizedContext<DownstreamContext>()->channel;
+    int output = 0;
+    for (int input : {request->input(), 1}) {
+      proto::GetSquareRequest square_request;
+      square_request.set_input(input);
+      auto result = co_await Call<GetSquareMethod>(channel, square_request);
+      if (!result.status.ok()) {
+        Finish(result.status);
+        co_return;
+      }
+      output += result.response.output();
+    }
+    auto response = common::make_unique<proto::GetEchoResponse>();
+    response->set_output(output);
+    co_await Write(std::move(response));
+  }
+};
+
+class CoroutineRpcHandlerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Server::Builder server_builder;
+    server_builder.SetServerAddress(kServerAddress);
+    server_builder.SetNumGrpcThreads(1);
+    server_builder.SetNumEventThreads(1);
+    server_builder.RegisterHandler<GetSumHandler>();
+    server_builder.RegisterHandler<GetSequenceHandler>();
+    server_builder.RegisterHandler<GetSquareHandler>();
+    server_builder.RegisterHandler<GetEchoHandler>();
+    server_ = server_builder.Build();
+    server_->SetExecutionContext(common::make_unique<DownstreamContext>());
+    server_->Start();
+    client_channel_ = ::grpc::CreateChannel(
+        kServerAddress, ::grpc::InsecureChannelCredentials());
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+    CompletionQueuePool::Shutdown();
+  }
+
+  std::unique_ptr<Server> server_;
+  std::shared_ptr<::grpc::Channel> client_channel_;
+};
+
+TEST_F(CoroutineRpcHandlerTest, ReadsRequestStream) {
+  Client<GetSumMethod> client(client_channel_);
+  for (int i = 0; i < 3; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 3);
+}
+
+TEST_F(CoroutineRpcHandlerTest, WritesWithFlowControl) {
+  Client<GetSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(20);
+  EXPECT_TRUE(client.Write(request));
+  proto::GetSequenceResponse response;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), i);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(CoroutineRpcHandlerTest, AwaitsDownstreamCalls) {
+  // All calls are in flight at once on the single event thread.
+  std::vector<std::future<int>> outputs;
+  for (int i = 0; i < 10; ++i) {
+    outputs.push_back(std::async(std::launch::async, [this, i]() {
+      Client<GetEchoMethod> client(client_channel_);
+      proto::GetEchoRequest request;
+      request.set_input(i);
+      EXPECT_TRUE(client.Write(request));
+      return client.response().output();
+    }));
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(outputs[i].get(), i * i + 1);
+  }
+}
+
+}  // namespace
+}  // namespace async_grpc
+
+#endif  // ASYNC_GRPC_HAS_COROUTINES
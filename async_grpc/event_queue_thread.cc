@@ -20,13 +20,25 @@
 #include "glog/logging.h"
 
 namespace async_grpc {
+namespace {
+
+// The event thread waits for events at most until the next timer is due, so
+// timers fire within a tick of their deadline.
+const common::Duration kTimerWheelTick = common::FromMilliseconds(10);
+constexpr size_t kTimerWheelNumSlots = 1024;
+
+}  // namespace
 
 EventQueueThread::EventQueueThread() {
   event_queue_ = common::make_unique<EventQueue>();
+  timer_wheel_ =
+      common::make_unique<TimerWheel>(kTimerWheelTick, kTimerWheelNumSlots);
 }
 
 EventQueue* EventQueueThread::event_queue() { return event_queue_.get(); }
 
+TimerWheel* EventQueueThread::timer_wheel() { return timer_wheel_.get(); }
+
 void EventQueueThread::Start(EventQueueRunner runner) {
   CHECK(!thread_);
   EventQueue* event_queue = event_queue_.get();
@@ -22,6 +22,7 @@
 
 #include "async_grpc/common/blocking_queue.h"
 #include "async_grpc/rpc.h"
+#include "async_grpc/timer_wheel.h"
 
 namespace async_grpc {
 
@@ -32,12 +33,14 @@ class EventQueueThread {
   EventQueueThread();
 
   EventQueue* event_queue();
+  TimerWheel* timer_wheel();
 
   void Start(EventQueueRunner runner);
   void Shutdown();
 
  private:
   std::unique_ptr<EventQueue> event_queue_;
+  std::unique_ptr<TimerWheel> timer_wheel_;
   std::unique_ptr<std::thread> thread_;
 };
 
@@ -17,7 +17,12 @@
 #ifndef CPP_GRPC_EXECUTION_CONTEXT_H
 #define CPP_GRPC_EXECUTION_CONTEXT_H
 
+#include <atomic>
+#include <memory>
+#include <utility>
+
 #include "async_grpc/common/mutex.h"
+#include "async_grpc/common/port.h"
 #include "glog/logging.h"
 
 namespace async_grpc {
@@ -27,9 +32,13 @@ namespace async_grpc {
 // 'ExecutionContext' can be specified. This 'ExecutionContext' can be retrieved
 // by all implementations of 'RpcHandler' by calling
 // 'RpcHandler::GetContext<MyContext>()'.
+//
+// Handlers that only read can use 'RpcHandler::GetSharedContext<MyContext>()'
+// which lets readers in concurrently, or, for read-mostly state, an immutable
+// snapshot, see 'PublishSnapshot()'.
 class ExecutionContext {
  public:
-  // Automatically locks an ExecutionContext for shared use by RPC handlers.
+  // Automatically locks an ExecutionContext for exclusive use by RPC handlers.
   // This non-movable, non-copyable class is used to broker access from various
   // RPC handlers to the shared 'ExecutionContext'.
   template <typename ContextType>
@@ -47,14 +56,77 @@ class ExecutionContext {
     common::MutexLocker locker_;
     ExecutionContext* execution_context_;
   };
+  // Like 'Synchronized' but only grants const access, so that any number of
+  // readers can hold it at the same time.
+  template <typename ContextType>
+  class SharedSynchronized {
+   public:
+    const ContextType* operator->() const {
+      return static_cast<const ContextType*>(execution_context_);
+    }
+    SharedSynchronized(common::Mutex* lock,
+                       const ExecutionContext* execution_context)
+        : locker_(lock), execution_context_(execution_context) {}
+    SharedSynchronized(const SharedSynchronized&) = delete;
+    SharedSynchronized(SharedSynchronized&&) = delete;
+
+   private:
+    common::Mutex::ReaderLocker locker_;
+    const ExecutionContext* execution_context_;
+  };
   ExecutionContext() = default;
   virtual ~ExecutionContext() = default;
   ExecutionContext(const ExecutionContext&) = delete;
   ExecutionContext& operator=(const ExecutionContext&) = delete;
+  // Locking it exclusively with a 'common::MutexLocker' is equivalent to
+  // holding a 'Synchronized', see 'common::Mutex'.
   common::Mutex* lock() { return &lock_; }
 
+  // Replaces the context's snapshot, typically read-mostly state such as
+  // configuration or map metadata that writers rebuild as a whole. Readers
+  // that hold the previous snapshot keep it alive until they are done.
+  template <typename T>
+  void PublishSnapshot(T snapshot) {
+    std::shared_ptr<const SnapshotBase> holder =
+        std::make_shared<SnapshotHolder<T>>(std::move(snapshot));
+    std::atomic_store(&snapshot_, std::move(holder));
+  }
+  // Returns the last published snapshot without taking 'lock()', or
+  // 'nullptr' if none was published. 'T' must be the published type.
+  template <typename T>
+  std::shared_ptr<const T> GetSnapshot() const {
+    std::shared_ptr<const SnapshotBase> holder = std::atomic_load(&snapshot_);
+    if (!holder) {
+      return nullptr;
+    }
+    const auto* typed_holder =
+        dynamic_cast<const SnapshotHolder<T>*>(holder.get());
+    CHECK(typed_holder) << "The snapshot has a different type.";
+    return std::shared_ptr<const T>(std::move(holder), &typed_holder->value);
+  }
+
+  // Makes the response caches of all methods, see
+  // 'RpcHandlerOptions::response_cache', drop their entries. To be called
+  // after changing state that cached responses depend on.
+  void InvalidateResponseCaches() { ++response_cache_generation_; }
+  uint64 response_cache_generation() const {
+    return response_cache_generation_;
+  }
+
  private:
+  struct SnapshotBase {
+    virtual ~SnapshotBase() = default;
+  };
+  template <typename T>
+  struct SnapshotHolder : SnapshotBase {
+    explicit SnapshotHolder(T value) : value(std::move(value)) {}
+    const T value;
+  };
+
   common::Mutex lock_;
+  std::atomic<uint64> response_cache_generation_{0};
+  // Only accessed through 'std::atomic_load()' and 'std::atomic_store()'.
+  std::shared_ptr<const SnapshotBase> snapshot_;
 };
 
 }  // namespace async_grpc
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures read throughput on an 'ExecutionContext' while a writer updates it
+// now and then, comparing exclusive 'GetContext()' locking, shared
+// 'GetSharedContext()' locking and 'GetSnapshot()'.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "async_grpc/execution_context.h"
+#include "glog/logging.h"
+
+namespace async_grpc {
+namespace {
+
+constexpr int kNumReadsPerThread = 200000;
+constexpr std::chrono::milliseconds kWriteInterval(1);
+
+constexpr int kNumSubmaps = 64;
+
+// What a handler typically reads, e.g. to find the submaps near a pose.
+struct MapMetadata {
+  int version = 0;
+  std::vector<double> submap_resolutions =
+      std::vector<double>(kNumSubmaps, 0.05);
+
+  double Read() const {
+    double sum = version;
+    for (double resolution : submap_resolutions) {
+      sum += resolution;
+    }
+    return sum;
+  }
+};
+
+class MapContext : public ExecutionContext {
+ public:
+  const MapMetadata& metadata() const { return metadata_; }
+  void Update() { ++metadata_.version; }
+
+ private:
+  MapMetadata metadata_;
+};
+
+// Returns reads per second over all 'num_threads' readers.
+double MeasureReadsPerSecond(int num_threads, MapContext* context,
+                             const std::function<double()>& read) {
+  std::atomic<bool> done(false);
+  std::thread writer([context, &done]() {
+    while (!done) {
+      {
+        ExecutionContext::Synchronized<MapContext> synchronized(
+            context->lock(), context);
+        synchronized->Update();
+        context->PublishSnapshot(synchronized->metadata());
+      }
+      std::this_thread::sleep_for(kWriteInterval);
+    }
+  });
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_threads; ++i) {
+    readers.emplace_back([&read]() {
+      double sum = 0.;
+      for (int j = 0; j < kNumReadsPerThread; ++j) {
+        sum += read();
+      }
+      CHECK_GE(sum, 0.);
+    });
+  }
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  done = true;
+  writer.join();
+  return num_threads * kNumReadsPerThread / elapsed.count();
+}
+
+void Run() {
+  MapContext context;
+  context.PublishSnapshot(context.metadata());
+  const unsigned int max_threads =
+      std::max(4u, std::thread::hardware_concurrency());
+  std::printf("%8s %14s %14s %14s\n", "threads", "exclusive/s", "shared/s",
+              "snapshot/s");
+  for (unsigned int num_threads = 1; num_threads <= max_threads;
+       num_threads *= 2) {
+    const double exclusive = MeasureReadsPerSecond(
+        num_threads, &context, [&context]() {
+          ExecutionContext::Synchronized<MapContext> synchronized(
+              context.lock(), &context);
+          return synchronized->metadata().Read();
+        });
+    const double shared = MeasureReadsPerSecond(
+        num_threads, &context, [&context]() {
+          ExecutionContext::SharedSynchronized<MapContext> synchronized(
+              context.lock(), &context);
+          return synchronized->metadata().Read();
+        });
+    const double snapshot = MeasureReadsPerSecond(
+        num_threads, &context, [&context]() {
+          const std::shared_ptr<const MapMetadata> metadata =
+              context.GetSnapshot<MapMetadata>();
+          return metadata->Read();
+        });
+    std::printf("%8u %14.0f %14.0f %14.0f\n", num_threads, exclusive, shared,
+                snapshot);
+  }
+}
+
+}  // namespace
+}  // namespace async_grpc
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  async_grpc::Run();
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/execution_context.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+class CounterContext : public ExecutionContext {
+ public:
+  int value() const { return value_; }
+  void Increment() { ++value_; }
+
+ private:
+  int value_ = 0;
+};
+
+struct Config {
+  std::string map_name;
+  int version;
+};
+
+TEST(ExecutionContextTest, ReadersShareTheLock) {
+  CounterContext context;
+  ExecutionContext::SharedSynchronized<CounterContext> first_reader(
+      context.lock(), &context);
+  std::thread second_reader([&context]() {
+    // Would deadlock if readers excluded each other.
+    ExecutionContext::SharedSynchronized<CounterContext> reader(context.lock(),
+                                                                &context);
+    EXPECT_EQ(reader->value(), 0);
+  });
+  second_reader.join();
+  EXPECT_EQ(first_reader->value(), 0);
+}
+
+TEST(ExecutionContextTest, WritersExcludeReaders) {
+  CounterContext context;
+  constexpr int kNumIncrements = 10000;
+  std::atomic<bool> done(false);
+  std::thread reader([&context, &done]() {
+    int last_value = 0;
+    while (!done) {
+      ExecutionContext::SharedSynchronized<CounterContext> synchronized(
+          context.lock(), &context);
+      EXPECT_GE(synchronized->value(), last_value);
+      last_value = synchronized->value();
+    }
+  });
+  std::vector<std::thread> writers;
+  for (int i = 0; i < 2; ++i) {
+    writers.emplace_back([&context]() {
+      for (int j = 0; j < kNumIncrements; ++j) {
+        ExecutionContext::Synchronized<CounterContext> synchronized(
+            context.lock(), &context);
+        synchronized->Increment();
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(context.value(), 2 * kNumIncrements);
+}
+
+TEST(ExecutionContextTest, Snapshots) {
+  ExecutionContext context;
+  EXPECT_EQ(context.GetSnapshot<Config>(), nullptr);
+  context.PublishSnapshot(Config{"map", 1});
+  std::shared_ptr<const Config> first = context.GetSnapshot<Config>();
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(first->version, 1);
+  context.PublishSnapshot(Config{"map", 2});
+  // Earlier snapshots stay valid while they are referenced.
+  EXPECT_EQ(first->version, 1);
+  EXPECT_EQ(context.GetSnapshot<Config>()->version, 2);
+}
+
+}  // namespace
+}  // namespace async_grpc
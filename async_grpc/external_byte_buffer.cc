@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/external_byte_buffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+namespace {
+
+void CallRelease(void* user_data) {
+  auto* release = static_cast<std::function<void()>*>(user_data);
+  (*release)();
+  delete release;
+}
+
+::grpc::Status ErrnoStatus(const std::string& what,
+                           const std::string& filename) {
+  return ::grpc::Status(::grpc::INTERNAL, what + " '" + filename +
+                                              "' failed: " + strerror(errno));
+}
+
+}  // namespace
+
+::grpc::ByteBuffer MakeExternalByteBuffer(const void* data, size_t size,
+                                          std::function<void()> release) {
+  CHECK(release);
+  // The slice never modifies the memory, gRPC's API just is not const.
+  ::grpc::Slice slice(const_cast<void*>(data), size, &CallRelease,
+                      new std::function<void()>(std::move(release)));
+  return ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+}
+
+::grpc::Status MapFileRegion(const std::string& filename, size_t offset,
+                             size_t length, ::grpc::ByteBuffer* buffer) {
+  const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoStatus("Opening", filename);
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    // 'close()' may overwrite 'errno'.
+    const ::grpc::Status status = ErrnoStatus("Stating", filename);
+    close(fd);
+    return status;
+  }
+  if (offset > static_cast<size_t>(file_stat.st_size) ||
+      length > static_cast<size_t>(file_stat.st_size) - offset) {
+    close(fd);
+    return ::grpc::Status(::grpc::OUT_OF_RANGE,
+                          "Region exceeds the size of '" + filename + "'.");
+  }
+  if (length == 0) {
+    close(fd);
+    *buffer = ::grpc::ByteBuffer(nullptr /* slices */, 0 /* nslices */);
+    return ::grpc::Status::OK;
+  }
+
+  // 'mmap()' requires the offset to be a multiple of the page size.
+  static const size_t kPageSize = sysconf(_SC_PAGESIZE);
+  const size_t map_offset = offset - offset % kPageSize;
+  const size_t map_length = length + (offset - map_offset);
+  void* const map =
+      mmap(nullptr, map_length, PROT_READ, MAP_SHARED, fd, map_offset);
+  if (map == MAP_FAILED) {
+    const ::grpc::Status status = ErrnoStatus("Mapping", filename);
+    close(fd);
+    return status;
+  }
+  // The mapping stays valid after closing the file.
+  close(fd);
+  madvise(map, map_length, MADV_SEQUENTIAL);
+  *buffer = MakeExternalByteBuffer(
+      static_cast<const char*>(map) + (offset - map_offset), length,
+      [map, map_length]() { CHECK_EQ(munmap(map, map_length), 0); });
+  return ::grpc::Status::OK;
+}
+
+}  // namespace async_grpc
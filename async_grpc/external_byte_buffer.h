@@ -0,0 +1,47 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_EXTERNAL_BYTE_BUFFER_H
+#define CPP_GRPC_EXTERNAL_BYTE_BUFFER_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// Helpers to send memory that is not owned by gRPC, e.g. a memory-mapped file
+// holding a serialized response, without copying it. The returned buffers are
+// passed to 'RpcHandler::SendSerialized()' or 'Writer::WriteSerialized()'.
+
+// Wraps 'size' bytes at 'data' into a single slice. 'release' is called once
+// neither gRPC nor any copy of the returned buffer references the memory
+// anymore. It may be called on any thread.
+::grpc::ByteBuffer MakeExternalByteBuffer(const void* data, size_t size,
+                                          std::function<void()> release);
+
+// Maps 'length' bytes of 'filename' starting at 'offset' read-only into memory
+// and wraps them into 'buffer'. The region is unmapped once it has been sent.
+// The bytes travel from the page cache to the transport without being copied
+// in user space.
+::grpc::Status MapFileRegion(const std::string& filename, size_t offset,
+                             size_t length, ::grpc::ByteBuffer* buffer);
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_EXTERNAL_BYTE_BUFFER_H
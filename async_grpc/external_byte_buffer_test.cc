@@ -0,0 +1,78 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/external_byte_buffer.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+std::string ToString(const ::grpc::ByteBuffer& buffer) {
+  std::vector<::grpc::Slice> slices;
+  EXPECT_TRUE(buffer.Dump(&slices).ok());
+  std::string result;
+  for (const auto& slice : slices) {
+    result.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+  }
+  return result;
+}
+
+TEST(ExternalByteBufferTest, ReleasesMemoryAfterLastReference) {
+  const std::string data = "external";
+  bool released = false;
+  {
+    ::grpc::ByteBuffer buffer = MakeExternalByteBuffer(
+        data.data(), data.size(), [&released]() { released = true; });
+    ::grpc::ByteBuffer copy = buffer;
+    buffer.Clear();
+    EXPECT_FALSE(released);
+    std::vector<::grpc::Slice> slices;
+    ASSERT_TRUE(copy.Dump(&slices).ok());
+    ASSERT_EQ(slices.size(), 1u);
+    // No copy of the data was made.
+    EXPECT_EQ(reinterpret_cast<const char*>(slices[0].begin()), data.data());
+  }
+  EXPECT_TRUE(released);
+}
+
+TEST(ExternalByteBufferTest, MapsUnalignedFileRegion) {
+  char filename[] = "/tmp/external_byte_buffer_test_XXXXXX";
+  const int fd = mkstemp(filename);
+  ASSERT_GE(fd, 0);
+  std::string contents(10000, 'a');
+  contents.replace(5000, 6, "region");
+  ASSERT_EQ(write(fd, contents.data(), contents.size()),
+            static_cast<ssize_t>(contents.size()));
+  close(fd);
+
+  ::grpc::ByteBuffer buffer;
+  EXPECT_TRUE(MapFileRegion(filename, 5000, 6, &buffer).ok());
+  EXPECT_EQ(ToString(buffer), "region");
+  EXPECT_EQ(MapFileRegion(filename, 9999, 2, &buffer).error_code(),
+            ::grpc::OUT_OF_RANGE);
+  EXPECT_FALSE(MapFileRegion("/nonexistent", 0, 1, &buffer).ok());
+  unlink(filename);
+}
+
+}  // namespace
+}  // namespace async_grpc
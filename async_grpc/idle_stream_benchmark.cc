@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Opens many idle bidi streams to a server in the same process and reports
+// the heap bytes they occupy per stream, client side included, to catch
+// regressions of the per-Rpc footprint. Usage:
+//
+//   idle_stream_benchmark [num_streams]
+
+#include <malloc.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "async_grpc/client.h"
+#include "async_grpc/proto/benchmark.pb.h"
+#include "async_grpc/rpc_handler.h"
+#include "async_grpc/server.h"
+#include "glog/logging.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+namespace {
+
+constexpr int kDefaultNumStreams = 10000;
+
+DEFINE_HANDLER_SIGNATURE(IdleSignature, Stream<proto::PointCloud>,
+                         Stream<proto::PointCloud>,
+                         "/async_grpc.proto.Benchmark/Idle")
+
+std::atomic<int> num_open_streams(0);
+
+class IdleHandler : public RpcHandler<IdleSignature> {
+ public:
+  void OnRequest(const proto::PointCloud& request) override {
+    ++num_open_streams;
+  }
+  void OnReadsDone() override {
+    --num_open_streams;
+    Finish(::grpc::Status::OK);
+  }
+};
+
+// Heap bytes in use across all malloc arenas.
+size_t GetAllocatedBytes() {
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+void WaitForOpenStreams(int num_streams) {
+  while (num_open_streams != num_streams) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+double MeasureBytesPerStream(int num_streams, bool enable_in_process_bypass) {
+  Server::Builder server_builder;
+  server_builder.SetServerAddress("");
+  server_builder.SetNumGrpcThreads(1);
+  server_builder.SetNumEventThreads(1);
+  server_builder.RegisterHandler<IdleHandler>();
+  if (enable_in_process_bypass) {
+    server_builder.EnableInProcessBypass();
+  }
+  std::unique_ptr<Server> server = server_builder.Build();
+  server->Start();
+  std::shared_ptr<::grpc::Channel> channel = server->InProcessChannel();
+
+  using IdleClient = Client<IdleSignature>;
+  auto open_streams = [&channel](int num_streams) {
+    std::vector<std::unique_ptr<IdleClient>> clients;
+    for (int i = 0; i < num_streams; ++i) {
+      clients.push_back(common::make_unique<IdleClient>(channel));
+      CHECK(clients.back()->Write(proto::PointCloud()));
+    }
+    WaitForOpenStreams(num_streams);
+    return clients;
+  };
+  auto close_streams = [](std::vector<std::unique_ptr<IdleClient>>* clients) {
+    for (auto& client : *clients) {
+      CHECK(client->StreamWritesDone());
+      CHECK(client->StreamFinish().ok());
+    }
+    clients->clear();
+    WaitForOpenStreams(0);
+  };
+
+  // Warm up, e.g. the channel and the allocator's free lists.
+  std::vector<std::unique_ptr<IdleClient>> clients = open_streams(100);
+  close_streams(&clients);
+
+  const size_t allocated_bytes_before = GetAllocatedBytes();
+  clients = open_streams(num_streams);
+  const size_t allocated_bytes_after = GetAllocatedBytes();
+  close_streams(&clients);
+  server->Shutdown();
+  return (static_cast<double>(allocated_bytes_after) - allocated_bytes_before) /
+         num_streams;
+}
+
+void Run(int num_streams) {
+  std::printf("%d idle streams\n", num_streams);
+  std::printf("%-20s %16s\n", "transport", "bytes/stream");
+  std::printf("%-20s %16.0f\n", "in-process",
+              MeasureBytesPerStream(num_streams, false));
+  std::printf("%-20s %16.0f\n", "in-process bypass",
+              MeasureBytesPerStream(num_streams, true));
+}
+
+}  // namespace
+}  // namespace async_grpc
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  const int num_streams =
+      argc > 1 ? std::atoi(argv[1]) : async_grpc::kDefaultNumStreams;
+  CHECK_GT(num_streams, 0);
+  async_grpc::Run(num_streams);
+  return 0;
+}
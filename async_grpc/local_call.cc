@@ -0,0 +1,378 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/local_call.h"
+
+#include <algorithm>
+#include <map>
+
+namespace async_grpc {
+namespace {
+
+struct Registry {
+  common::Mutex lock;
+  std::map<const ::grpc::Channel*, LocalCallRegistry::StartCallFunction>
+      start_call_functions GUARDED_BY(lock);
+};
+
+Registry* GetRegistry() {
+  static Registry* const kInstance = new Registry();
+  return kInstance;
+}
+
+}  // namespace
+
+constexpr size_t LocalCall::kMaxBufferedResponses;
+
+void LocalCall::PendingCallbacks::Run() {
+  if (read_callback) {
+    read_callback(std::move(response));
+  }
+  if (finish_callback) {
+    finish_callback(status);
+  }
+}
+
+void LocalCall::Complete(Rpc::CompletionQueueRpcEvent* event, bool ok) {
+  event->ok = ok;
+  event->PushToEventQueue();
+}
+
+void LocalCall::SetDeadline(std::chrono::system_clock::time_point deadline) {
+  common::MutexLocker locker(&mutex_);
+  deadline_ = deadline;
+}
+
+bool LocalCall::Write(std::unique_ptr<::google::protobuf::Message> request) {
+  common::MutexLocker locker(&mutex_);
+  if (finished_ || writes_done_) {
+    return false;
+  }
+  if (read_event_) {
+    *read_target_ = std::move(request);
+    Complete(read_event_, true);
+    read_target_ = nullptr;
+    read_event_ = nullptr;
+    return true;
+  }
+  requests_.push_back(std::move(request));
+  return true;
+}
+
+void LocalCall::WritesDone() {
+  common::MutexLocker locker(&mutex_);
+  writes_done_ = true;
+  if (read_event_) {
+    Complete(read_event_, false);
+    read_target_ = nullptr;
+    read_event_ = nullptr;
+  }
+}
+
+bool LocalCall::Read(std::unique_ptr<::google::protobuf::Message>* response) {
+  PendingCallbacks callbacks;
+  bool ok = false;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (AwaitLocked(&locker,
+                    [this]() REQUIRES(mutex_) {
+                      return !responses_.empty() || finished_;
+                    },
+                    &callbacks) &&
+        !responses_.empty()) {
+      *response = PopResponseLocked();
+      ok = true;
+    }
+  }
+  callbacks.Run();
+  return ok;
+}
+
+void LocalCall::ReadAsync(ReadCallback callback) {
+  PendingCallbacks callbacks;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (responses_.empty() && !finished_) {
+      read_callback_ = std::move(callback);
+      return;
+    }
+    callbacks.read_callback = std::move(callback);
+    if (!responses_.empty()) {
+      callbacks.response = PopResponseLocked();
+    }
+  }
+  callbacks.Run();
+}
+
+::grpc::Status LocalCall::Finish() {
+  PendingCallbacks callbacks;
+  ::grpc::Status status;
+  {
+    common::MutexLocker locker(&mutex_);
+    AwaitLocked(&locker, [this]() REQUIRES(mutex_) { return finished_; },
+                &callbacks);
+    status = status_;
+  }
+  callbacks.Run();
+  return status;
+}
+
+void LocalCall::FinishAsync(FinishCallback callback) {
+  ::grpc::Status status;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (!finished_) {
+      finish_callback_ = std::move(callback);
+      return;
+    }
+    status = status_;
+  }
+  callback(status);
+}
+
+void LocalCall::Cancel(const ::grpc::Status& status) {
+  PendingCallbacks callbacks;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (finished_) {
+      return;
+    }
+    cancelled_ = true;
+    responses_.clear();
+    FinishLocked(status, &callbacks);
+  }
+  callbacks.Run();
+}
+
+void LocalCall::ClearCallbacks() {
+  common::MutexLocker locker(&mutex_);
+  read_callback_ = nullptr;
+  finish_callback_ = nullptr;
+}
+
+void LocalCall::AttachServer(Rpc::CompletionQueueRpcEvent* done_event) {
+  common::MutexLocker locker(&mutex_);
+  if (finished_) {
+    Complete(done_event, true);
+    return;
+  }
+  done_event_ = done_event;
+}
+
+void LocalCall::DetachServer() {
+  PendingCallbacks callbacks;
+  {
+    common::MutexLocker locker(&mutex_);
+    done_event_ = nullptr;
+    read_target_ = nullptr;
+    read_event_ = nullptr;
+    write_event_ = nullptr;
+    if (!finished_) {
+      FinishLocked(::grpc::Status(::grpc::UNAVAILABLE, "Server shut down."),
+                   &callbacks);
+    }
+  }
+  callbacks.Run();
+}
+
+bool LocalCall::TakeRequest(
+    std::unique_ptr<::google::protobuf::Message>* request) {
+  common::MutexLocker locker(&mutex_);
+  if (requests_.empty()) {
+    return false;
+  }
+  *request = std::move(requests_.front());
+  requests_.pop_front();
+  return true;
+}
+
+void LocalCall::RequestRead(
+    std::unique_ptr<::google::protobuf::Message>* request,
+    Rpc::CompletionQueueRpcEvent* read_event) {
+  common::MutexLocker locker(&mutex_);
+  CHECK(!read_event_) << "Only one read may be outstanding.";
+  if (!requests_.empty()) {
+    *request = std::move(requests_.front());
+    requests_.pop_front();
+    Complete(read_event, true);
+    return;
+  }
+  if (writes_done_ || finished_) {
+    Complete(read_event, false);
+    return;
+  }
+  read_target_ = request;
+  read_event_ = read_event;
+}
+
+void LocalCall::DeliverResponse(
+    std::unique_ptr<::google::protobuf::Message> response,
+    Rpc::CompletionQueueRpcEvent* write_event) {
+  PendingCallbacks callbacks;
+  {
+    common::MutexLocker locker(&mutex_);
+    CHECK(!write_event_) << "Only one write may be outstanding.";
+    if (finished_) {
+      Complete(write_event, false);
+      return;
+    }
+    if (read_callback_) {
+      callbacks.read_callback = std::move(read_callback_);
+      read_callback_ = nullptr;
+      callbacks.response = std::move(response);
+      Complete(write_event, true);
+    } else {
+      responses_.push_back(std::move(response));
+      if (responses_.size() > kMaxBufferedResponses) {
+        // Completed once the client caught up, see 'PopResponseLocked()'.
+        write_event_ = write_event;
+      } else {
+        Complete(write_event, true);
+      }
+    }
+  }
+  callbacks.Run();
+}
+
+void LocalCall::DeliverFinish(
+    const ::grpc::Status& status,
+    std::unique_ptr<::google::protobuf::Message> response) {
+  PendingCallbacks callbacks;
+  {
+    common::MutexLocker locker(&mutex_);
+    if (finished_) {
+      return;
+    }
+    if (response && status.ok()) {
+      responses_.push_back(std::move(response));
+    }
+    FinishLocked(status, &callbacks);
+  }
+  callbacks.Run();
+}
+
+bool LocalCall::IsCancelled() {
+  common::MutexLocker locker(&mutex_);
+  return cancelled_;
+}
+
+template <typename Predicate>
+bool LocalCall::AwaitLocked(common::MutexLocker* locker, Predicate predicate,
+                            PendingCallbacks* callbacks) {
+  if (deadline_ == std::chrono::system_clock::time_point::max()) {
+    locker->Await(predicate);
+    return true;
+  }
+  const auto timeout = deadline_ - std::chrono::system_clock::now();
+  if (locker->AwaitWithTimeout(
+          predicate,
+          std::chrono::duration_cast<common::Duration>(
+              std::max(timeout, std::chrono::system_clock::duration::zero())))) {
+    return true;
+  }
+  if (!finished_) {
+    cancelled_ = true;
+    responses_.clear();
+    FinishLocked(
+        ::grpc::Status(::grpc::DEADLINE_EXCEEDED, "Deadline Exceeded"),
+        callbacks);
+  }
+  return false;
+}
+
+void LocalCall::FinishLocked(const ::grpc::Status& status,
+                             PendingCallbacks* callbacks) {
+  finished_ = true;
+  status_ = status;
+  if (read_callback_) {
+    callbacks->read_callback = std::move(read_callback_);
+    read_callback_ = nullptr;
+    if (!responses_.empty()) {
+      callbacks->response = PopResponseLocked();
+    }
+  }
+  if (finish_callback_) {
+    callbacks->finish_callback = std::move(finish_callback_);
+    finish_callback_ = nullptr;
+    callbacks->status = status;
+  }
+  // Like gRPC, fail outstanding operations of the server and report the end
+  // of the call.
+  if (read_event_) {
+    Complete(read_event_, false);
+    read_target_ = nullptr;
+    read_event_ = nullptr;
+  }
+  if (write_event_) {
+    Complete(write_event_, false);
+    write_event_ = nullptr;
+  }
+  if (done_event_) {
+    Complete(done_event_, true);
+    done_event_ = nullptr;
+  }
+}
+
+std::unique_ptr<::google::protobuf::Message> LocalCall::PopResponseLocked() {
+  std::unique_ptr<::google::protobuf::Message> response =
+      std::move(responses_.front());
+  responses_.pop_front();
+  if (write_event_ && responses_.size() <= kMaxBufferedResponses) {
+    Complete(write_event_, true);
+    write_event_ = nullptr;
+  }
+  return response;
+}
+
+void LocalCallRegistry::Register(const ::grpc::Channel* channel,
+                                 StartCallFunction start_call) {
+  Registry* registry = GetRegistry();
+  common::MutexLocker locker(&registry->lock);
+  CHECK(registry->start_call_functions.emplace(channel, std::move(start_call))
+            .second)
+      << "Channel already registered.";
+}
+
+void LocalCallRegistry::Unregister(const ::grpc::Channel* channel) {
+  Registry* registry = GetRegistry();
+  common::MutexLocker locker(&registry->lock);
+  registry->start_call_functions.erase(channel);
+}
+
+bool LocalCallRegistry::IsRegistered(const ::grpc::Channel* channel) {
+  Registry* registry = GetRegistry();
+  common::MutexLocker locker(&registry->lock);
+  return registry->start_call_functions.count(channel) > 0;
+}
+
+bool LocalCallRegistry::StartCall(
+    const ::grpc::Channel* channel, const std::string& method_full_name,
+    const google::protobuf::Descriptor* request_descriptor,
+    const google::protobuf::Descriptor* response_descriptor,
+    std::shared_ptr<LocalCall> local_call) {
+  Registry* registry = GetRegistry();
+  // Holding the lock keeps the server from shutting down while the call is
+  // being started, see 'Server::Shutdown()'.
+  common::MutexLocker locker(&registry->lock);
+  auto it = registry->start_call_functions.find(channel);
+  if (it == registry->start_call_functions.end()) {
+    return false;
+  }
+  return it->second(method_full_name, request_descriptor, response_descriptor,
+                    std::move(local_call));
+}
+
+}  // namespace async_grpc
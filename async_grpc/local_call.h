@@ -0,0 +1,292 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_LOCAL_CALL_H
+#define CPP_GRPC_LOCAL_CALL_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "async_grpc/common/make_unique.h"
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/rpc.h"
+#include "async_grpc/rpc_service_method_traits.h"
+#include "glog/logging.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// A call between a 'Client' or 'AsyncClient' and an 'Rpc' of a 'Server' in the
+// same process which bypasses gRPC: requests and responses are handed over as
+// message pointers instead of being serialized. The server side still
+// completes the events of the 'Rpc' through its event queue, so handlers
+// cannot tell local calls from remote ones. All member functions are
+// thread-safe.
+class LocalCall {
+ public:
+  using ReadCallback =
+      std::function<void(std::unique_ptr<::google::protobuf::Message>)>;
+  using FinishCallback = std::function<void(const ::grpc::Status&)>;
+
+  // Number of responses the client may fall behind before writes on the
+  // server stop completing, mirroring gRPC's flow control.
+  static constexpr size_t kMaxBufferedResponses = 8;
+
+  LocalCall() = default;
+  LocalCall(const LocalCall&) = delete;
+  LocalCall& operator=(const LocalCall&) = delete;
+
+  // Client side.
+
+  // Applies to all blocking calls below. Once it expires the call is
+  // cancelled with DEADLINE_EXCEEDED.
+  void SetDeadline(std::chrono::system_clock::time_point deadline);
+  // Returns false if the call already finished.
+  bool Write(std::unique_ptr<::google::protobuf::Message> request);
+  void WritesDone();
+  // Blocks until the next response arrives. Returns false once the call
+  // finished and all responses were read.
+  bool Read(std::unique_ptr<::google::protobuf::Message>* response);
+  // Like 'Read()' but invokes 'callback' with the next response or 'nullptr'
+  // once all responses were read. The callback runs on the calling thread or
+  // on the server thread delivering the response.
+  void ReadAsync(ReadCallback callback);
+  // Blocks until the server finished the call.
+  ::grpc::Status Finish();
+  // Like 'Finish()' but invokes 'callback' with the final status.
+  void FinishAsync(FinishCallback callback);
+  // Finishes the call with 'status' unless it already finished.
+  void Cancel(const ::grpc::Status& status);
+  // Drops pending 'ReadAsync()' and 'FinishAsync()' callbacks.
+  void ClearCallbacks();
+
+  // Server side, called by 'Rpc' on its event thread. Events passed in are
+  // completed by pushing them to the event queue of their 'Rpc'.
+
+  void AttachServer(Rpc::CompletionQueueRpcEvent* done_event);
+  // Releases all events of the 'Rpc' and fails the call with UNAVAILABLE if
+  // the server did not finish it.
+  void DetachServer();
+  // Takes the request of a call without request streaming.
+  bool TakeRequest(std::unique_ptr<::google::protobuf::Message>* request);
+  // Completes 'read_event' once the client wrote the next request into
+  // '*request', or with ok=false after 'WritesDone()' or cancellation.
+  void RequestRead(std::unique_ptr<::google::protobuf::Message>* request,
+                   Rpc::CompletionQueueRpcEvent* read_event);
+  void DeliverResponse(std::unique_ptr<::google::protobuf::Message> response,
+                       Rpc::CompletionQueueRpcEvent* write_event);
+  // 'response' may be 'nullptr' for streaming responses or errors.
+  void DeliverFinish(const ::grpc::Status& status,
+                     std::unique_ptr<::google::protobuf::Message> response);
+  bool IsCancelled();
+
+ private:
+  // Callbacks collected under 'mutex_' and run after releasing it.
+  struct PendingCallbacks {
+    void Run();
+
+    ReadCallback read_callback;
+    std::unique_ptr<::google::protobuf::Message> response;
+    FinishCallback finish_callback;
+    ::grpc::Status status;
+  };
+
+  static void Complete(Rpc::CompletionQueueRpcEvent* event, bool ok);
+  // Waits for 'predicate' until the deadline. Cancels the call and returns
+  // false if the deadline expired.
+  template <typename Predicate>
+  bool AwaitLocked(common::MutexLocker* locker, Predicate predicate,
+                   PendingCallbacks* callbacks) REQUIRES(mutex_);
+  void FinishLocked(const ::grpc::Status& status, PendingCallbacks* callbacks)
+      REQUIRES(mutex_);
+  std::unique_ptr<::google::protobuf::Message> PopResponseLocked()
+      REQUIRES(mutex_);
+
+  common::Mutex mutex_;
+  std::chrono::system_clock::time_point deadline_ GUARDED_BY(mutex_) =
+      std::chrono::system_clock::time_point::max();
+  std::deque<std::unique_ptr<::google::protobuf::Message>> requests_
+      GUARDED_BY(mutex_);
+  bool writes_done_ GUARDED_BY(mutex_) = false;
+  std::deque<std::unique_ptr<::google::protobuf::Message>> responses_
+      GUARDED_BY(mutex_);
+  bool finished_ GUARDED_BY(mutex_) = false;
+  bool cancelled_ GUARDED_BY(mutex_) = false;
+  ::grpc::Status status_ GUARDED_BY(mutex_);
+
+  ReadCallback read_callback_ GUARDED_BY(mutex_);
+  FinishCallback finish_callback_ GUARDED_BY(mutex_);
+
+  // Events of the 'Rpc' handed over by the server side.
+  Rpc::CompletionQueueRpcEvent* done_event_ GUARDED_BY(mutex_) = nullptr;
+  std::unique_ptr<::google::protobuf::Message>* read_target_
+      GUARDED_BY(mutex_) = nullptr;
+  Rpc::CompletionQueueRpcEvent* read_event_ GUARDED_BY(mutex_) = nullptr;
+  Rpc::CompletionQueueRpcEvent* write_event_ GUARDED_BY(mutex_) = nullptr;
+};
+
+// Maps in-process channels to the servers behind them, see
+// 'Server::Builder::EnableInProcessBypass()'.
+class LocalCallRegistry {
+ public:
+  // Starts 'local_call' on the server. Returns false if the server does not
+  // serve the method with these message types, in which case the call should
+  // go through gRPC.
+  using StartCallFunction = std::function<bool(
+      const std::string& method_full_name,
+      const google::protobuf::Descriptor* request_descriptor,
+      const google::protobuf::Descriptor* response_descriptor,
+      std::shared_ptr<LocalCall> local_call)>;
+
+  static void Register(const ::grpc::Channel* channel,
+                       StartCallFunction start_call);
+  static void Unregister(const ::grpc::Channel* channel);
+  static bool IsRegistered(const ::grpc::Channel* channel);
+  static bool StartCall(const ::grpc::Channel* channel,
+                        const std::string& method_full_name,
+                        const google::protobuf::Descriptor* request_descriptor,
+                        const google::protobuf::Descriptor* response_descriptor,
+                        std::shared_ptr<LocalCall> local_call);
+};
+
+// The client end of a 'LocalCall' for 'RpcServiceMethod'. Destroying it before
+// the call finished cancels the call, like destroying a gRPC call object.
+template <typename RpcServiceMethod>
+class LocalClientCall {
+  using RequestType = typename RpcServiceMethod::RequestType;
+  using ResponseType = typename RpcServiceMethod::ResponseType;
+  using IsProtobuf = std::integral_constant<bool, RpcServiceMethod::IsProtobuf>;
+
+ public:
+  // Returns 'nullptr' unless 'channel' is an in-process channel of a server
+  // with bypass enabled that serves the method. Methods with other codecs
+  // always go through gRPC. Calls without request streaming pass their only
+  // 'request' here.
+  static std::unique_ptr<LocalClientCall> Start(
+      ::grpc::Channel* channel, const RequestType* request = nullptr,
+      std::chrono::system_clock::time_point deadline =
+          std::chrono::system_clock::time_point::max()) {
+    if (!IsProtobuf::value || !LocalCallRegistry::IsRegistered(channel)) {
+      return nullptr;
+    }
+    auto local_call = std::make_shared<LocalCall>();
+    local_call->SetDeadline(deadline);
+    if (request) {
+      local_call->Write(ToMessage(*request, IsProtobuf()));
+      local_call->WritesDone();
+    }
+    if (!LocalCallRegistry::StartCall(
+            channel, RpcServiceMethod::MethodName(),
+            MessageDescriptor<RequestType>::Get(),
+            MessageDescriptor<ResponseType>::Get(), local_call)) {
+      return nullptr;
+    }
+    return std::unique_ptr<LocalClientCall>(
+        new LocalClientCall(std::move(local_call)));
+  }
+
+  ~LocalClientCall() {
+    local_call_->ClearCallbacks();
+    local_call_->Cancel(::grpc::Status::CANCELLED);
+  }
+
+  bool Write(const RequestType& request) {
+    return local_call_->Write(ToMessage(request, IsProtobuf()));
+  }
+
+  bool WritesDone() {
+    local_call_->WritesDone();
+    return true;
+  }
+
+  bool Read(ResponseType* response) {
+    std::unique_ptr<::google::protobuf::Message> message;
+    if (!local_call_->Read(&message)) {
+      return false;
+    }
+    FromMessage(std::move(message), response, IsProtobuf());
+    return true;
+  }
+
+  // Invokes 'callback' with true once the next response was stored in
+  // '*response' or with false at the end of the stream.
+  void ReadAsync(ResponseType* response, std::function<void(bool)> callback) {
+    local_call_->ReadAsync(
+        [response,
+         callback](std::unique_ptr<::google::protobuf::Message> message) {
+          const bool ok = message != nullptr;
+          if (ok) {
+            FromMessage(std::move(message), response, IsProtobuf());
+          }
+          callback(ok);
+        });
+  }
+
+  ::grpc::Status Finish() { return local_call_->Finish(); }
+
+  void FinishAsync(LocalCall::FinishCallback callback) {
+    local_call_->FinishAsync(std::move(callback));
+  }
+
+  // Finishes a call without response streaming, storing the response in
+  // '*response' on success.
+  ::grpc::Status FinishUnary(ResponseType* response) {
+    const ::grpc::Status status = local_call_->Finish();
+    if (!status.ok()) {
+      return status;
+    }
+    if (!Read(response)) {
+      return ::grpc::Status(::grpc::INTERNAL,
+                            "No message returned for unary request");
+    }
+    return status;
+  }
+
+ private:
+  explicit LocalClientCall(std::shared_ptr<LocalCall> local_call)
+      : local_call_(std::move(local_call)) {}
+
+  static std::unique_ptr<::google::protobuf::Message> ToMessage(
+      const RequestType& request, std::true_type) {
+    return common::make_unique<RequestType>(request);
+  }
+  static std::unique_ptr<::google::protobuf::Message> ToMessage(
+      const RequestType& request, std::false_type) {
+    LOG(FATAL) << "Only protobuf messages bypass gRPC.";
+    return nullptr;
+  }
+  static void FromMessage(std::unique_ptr<::google::protobuf::Message> message,
+                          ResponseType* response, std::true_type) {
+    // The server checked that the message types match.
+    response->Swap(static_cast<ResponseType*>(message.get()));
+  }
+  static void FromMessage(std::unique_ptr<::google::protobuf::Message> message,
+                          ResponseType* response, std::false_type) {
+    LOG(FATAL) << "Only protobuf messages bypass gRPC.";
+  }
+
+  const std::shared_ptr<LocalCall> local_call_;
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_LOCAL_CALL_H
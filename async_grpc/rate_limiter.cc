@@ -0,0 +1,182 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/rate_limiter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iterator>
+
+#include "async_grpc/common/make_unique.h"
+#include "glog/logging.h"
+
+namespace async_grpc {
+namespace {
+
+std::unique_ptr<TokenBucket> CreateTokenBucketIfLimited(
+    const RateLimit& rate_limit) {
+  if (rate_limit.tokens_per_second <= 0.) {
+    return nullptr;
+  }
+  return common::make_unique<TokenBucket>(rate_limit.tokens_per_second,
+                                          rate_limit.burst);
+}
+
+// Peers look like 'ipv4:127.0.0.1:41234'. Strip the port so that all
+// connections from the same host share a bucket.
+std::string StripPort(const std::string& peer) {
+  const size_t port_separator = peer.rfind(':');
+  if (port_separator == std::string::npos ||
+      peer.find(':') == port_separator) {
+    return peer;
+  }
+  return peer.substr(0, port_separator);
+}
+
+}  // namespace
+
+TokenBucket::TokenBucket(const double tokens_per_second, const double burst)
+    : emission_interval_ns_(static_cast<int64>(1e9 / tokens_per_second)),
+      tolerance_ns_(static_cast<int64>(burst * 1e9 / tokens_per_second)),
+      theoretical_arrival_time_ns_(0) {
+  CHECK_GT(tokens_per_second, 0.);
+  CHECK_GE(burst, 1.);
+}
+
+bool TokenBucket::TryAcquire() {
+  const int64 now = Now();
+  int64 theoretical_arrival_time = theoretical_arrival_time_ns_.load();
+  int64 next_theoretical_arrival_time;
+  do {
+    next_theoretical_arrival_time =
+        std::max(theoretical_arrival_time, now) + emission_interval_ns_;
+    if (next_theoretical_arrival_time - now > tolerance_ns_) {
+      return false;
+    }
+  } while (!theoretical_arrival_time_ns_.compare_exchange_weak(
+      theoretical_arrival_time, next_theoretical_arrival_time));
+  return true;
+}
+
+common::Duration TokenBucket::Acquire() {
+  const int64 now = Now();
+  int64 theoretical_arrival_time = theoretical_arrival_time_ns_.load();
+  int64 next_theoretical_arrival_time;
+  do {
+    next_theoretical_arrival_time =
+        std::max(theoretical_arrival_time, now) + emission_interval_ns_;
+  } while (!theoretical_arrival_time_ns_.compare_exchange_weak(
+      theoretical_arrival_time, next_theoretical_arrival_time));
+  const int64 wait_ns =
+      std::max<int64>(0, next_theoretical_arrival_time - now - tolerance_ns_);
+  return std::chrono::duration_cast<common::Duration>(
+      std::chrono::nanoseconds(wait_ns));
+}
+
+int64 TokenBucket::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+RateLimiter::Buckets::Buckets(const RateLimitOptions& options)
+    : calls(CreateTokenBucketIfLimited(options.calls)),
+      messages(CreateTokenBucketIfLimited(options.messages)) {}
+
+RateLimiter::RateLimiter(const RateLimitOptions& options)
+    : options_(options),
+      max_keys_per_shard_(std::max<size_t>(1, options.max_keys / kNumShards)) {
+  CHECK(options_.key != RateLimitOptions::Key::METADATA ||
+        !options_.metadata_key.empty())
+      << "Rate limiting by metadata requires a 'metadata_key'.";
+}
+
+std::shared_ptr<RateLimiter::Buckets> RateLimiter::GetBuckets(
+    const ::grpc::ServerContext& server_context) {
+  return GetBuckets(GetKey(server_context));
+}
+
+std::shared_ptr<RateLimiter::Buckets> RateLimiter::GetBuckets(
+    const std::string& key) {
+  Shard& shard = shards_[std::hash<std::string>()(key) % kNumShards];
+  common::MutexLocker locker(&shard.lock);
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.entries.splice(shard.entries.end(), shard.entries, it->second);
+    return it->second->second;
+  }
+  if (shard.entries.size() >= max_keys_per_shard_) {
+    EvictLocked(&shard);
+  }
+  auto buckets = std::make_shared<Buckets>(options_);
+  shard.entries.emplace_back(key, buckets);
+  shard.index.emplace(key, std::prev(shard.entries.end()));
+  return buckets;
+}
+
+size_t RateLimiter::num_keys() {
+  size_t num_keys = 0;
+  for (Shard& shard : shards_) {
+    common::MutexLocker locker(&shard.lock);
+    num_keys += shard.entries.size();
+  }
+  return num_keys;
+}
+
+void RateLimiter::EvictLocked(Shard* shard) {
+  // Evicts down to three quarters of the limit, so that the scan is amortized
+  // over the following insertions. Buckets still held by an Rpc are kept, or
+  // its key would get a second bucket.
+  const size_t target_size = max_keys_per_shard_ - max_keys_per_shard_ / 4;
+  for (auto it = shard->entries.begin();
+       it != shard->entries.end() && shard->entries.size() >= target_size;) {
+    if (it->second.use_count() == 1) {
+      shard->index.erase(it->first);
+      it = shard->entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::string RateLimiter::GetKey(
+    const ::grpc::ServerContext& server_context) const {
+  switch (options_.key) {
+    case RateLimitOptions::Key::PEER:
+      return StripPort(server_context.peer());
+    case RateLimitOptions::Key::METADATA: {
+      const auto& client_metadata = server_context.client_metadata();
+      auto it = client_metadata.find(options_.metadata_key);
+      if (it == client_metadata.end()) {
+        // Clients without the metadata share a single bucket.
+        return "";
+      }
+      return std::string(it->second.data(), it->second.size());
+    }
+  }
+  LOG(FATAL) << "Never reached.";
+}
+
+std::shared_ptr<RateLimiter> CreateRateLimiter(const RateLimitOptions& options) {
+  if (options.calls.tokens_per_second <= 0. &&
+      options.messages.tokens_per_second <= 0.) {
+    return nullptr;
+  }
+  return std::make_shared<RateLimiter>(options);
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_RATE_LIMITER_H
+#define CPP_GRPC_RATE_LIMITER_H
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/common/port.h"
+#include "async_grpc/common/time.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// A token bucket implemented as a generic cell rate algorithm (GCRA). Its whole
+// state is the theoretical arrival time of the next token which is updated
+// with a single compare-and-swap, so acquiring tokens is lock-free.
+class TokenBucket {
+ public:
+  // 'burst' tokens can be taken back-to-back from a full bucket.
+  TokenBucket(double tokens_per_second, double burst);
+
+  // Takes a token if one is available and returns false otherwise.
+  bool TryAcquire();
+
+  // Reserves a token and returns how long the caller has to wait until the
+  // token becomes available; zero if it is available immediately.
+  common::Duration Acquire();
+
+ private:
+  static int64 Now();
+
+  const int64 emission_interval_ns_;
+  const int64 tolerance_ns_;
+  std::atomic<int64> theoretical_arrival_time_ns_;
+};
+
+// Limits the number of tokens per second and the burst of a 'TokenBucket'.
+// A rate of zero disables the limit.
+struct RateLimit {
+  double tokens_per_second = 0.;
+  double burst = 1.;
+};
+
+struct RateLimitOptions {
+  enum class Key {
+    // All calls from the same host share their buckets.
+    PEER = 0,
+    // All calls with the same value for the client metadata 'metadata_key'
+    // share their buckets.
+    METADATA
+  };
+
+  // Limits the number of calls accepted by the server.
+  RateLimit calls;
+  // Limits the number of messages read from request streams.
+  RateLimit messages;
+  Key key = Key::PEER;
+  std::string metadata_key;
+  // Bounds the number of keys with buckets, since clients choose the keys
+  // under 'Key::METADATA'. Beyond it, the least recently used buckets that no
+  // call holds are dropped; their keys start over with full buckets.
+  size_t max_keys = 10000;
+};
+
+// Rate limits calls and streamed messages of a single method. Buckets are
+// created on demand per key and kept in a sharded least recently used cache
+// bounded by 'RateLimitOptions::max_keys', so that lookups for different keys
+// rarely contend. Rpcs look up their buckets once and then only touch the
+// lock-free 'TokenBucket'.
+class RateLimiter {
+ public:
+  struct Buckets {
+    Buckets(const RateLimitOptions& options);
+
+    // 'nullptr' if the respective rate is not limited.
+    std::unique_ptr<TokenBucket> calls;
+    std::unique_ptr<TokenBucket> messages;
+  };
+
+  explicit RateLimiter(const RateLimitOptions& options);
+
+  // Returns the buckets for the call associated with 'server_context'.
+  std::shared_ptr<Buckets> GetBuckets(
+      const ::grpc::ServerContext& server_context);
+  // Returns the buckets for calls with the rate limiting key 'key', e.g. for
+  // calls that do not go through gRPC.
+  std::shared_ptr<Buckets> GetBuckets(const std::string& key);
+
+  // Number of keys with buckets.
+  size_t num_keys();
+
+ private:
+  static constexpr size_t kNumShards = 16;
+
+  struct Shard {
+    using Entry = std::pair<std::string, std::shared_ptr<Buckets>>;
+
+    common::Mutex lock;
+    // Least recently used first.
+    std::list<Entry> entries GUARDED_BY(lock);
+    std::unordered_map<std::string, std::list<Entry>::iterator> index
+        GUARDED_BY(lock);
+  };
+
+  std::string GetKey(const ::grpc::ServerContext& server_context) const;
+  // Drops unused buckets of 'shard' to make room for a new key.
+  void EvictLocked(Shard* shard) REQUIRES(shard->lock);
+
+  const RateLimitOptions options_;
+  const size_t max_keys_per_shard_;
+  std::array<Shard, kNumShards> shards_;
+};
+
+// Returns 'nullptr' if 'options' neither limit calls nor messages.
+std::shared_ptr<RateLimiter> CreateRateLimiter(const RateLimitOptions& options);
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_RATE_LIMITER_H
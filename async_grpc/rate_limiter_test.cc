@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/rate_limiter.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+TEST(TokenBucketTest, AllowsBurstThenRejects) {
+  TokenBucket token_bucket(1. /* tokens_per_second */, 3. /* burst */);
+  EXPECT_TRUE(token_bucket.TryAcquire());
+  EXPECT_TRUE(token_bucket.TryAcquire());
+  EXPECT_TRUE(token_bucket.TryAcquire());
+  EXPECT_FALSE(token_bucket.TryAcquire());
+}
+
+TEST(TokenBucketTest, AcquireReturnsWaitTime) {
+  TokenBucket token_bucket(10. /* tokens_per_second */, 1. /* burst */);
+  EXPECT_EQ(token_bucket.Acquire(), common::Duration::zero());
+  const common::Duration first_wait = token_bucket.Acquire();
+  EXPECT_GT(first_wait, common::Duration::zero());
+  EXPECT_LE(first_wait, common::FromMilliseconds(100));
+  // Reserved tokens queue up behind each other.
+  EXPECT_GT(token_bucket.Acquire(), first_wait);
+}
+
+TEST(RateLimiterTest, NoLimiterWithoutLimits) {
+  EXPECT_EQ(CreateRateLimiter(RateLimitOptions()), nullptr);
+  RateLimitOptions options;
+  options.messages.tokens_per_second = 5.;
+  EXPECT_NE(CreateRateLimiter(options), nullptr);
+}
+
+TEST(RateLimiterTest, BoundsNumberOfKeys) {
+  RateLimitOptions options;
+  options.calls.tokens_per_second = 1.;
+  options.max_keys = 32;
+  RateLimiter rate_limiter(options);
+  for (int i = 0; i < 1000; ++i) {
+    rate_limiter.GetBuckets("key" + std::to_string(i));
+  }
+  EXPECT_LE(rate_limiter.num_keys(), options.max_keys);
+  EXPECT_GT(rate_limiter.num_keys(), 0u);
+}
+
+TEST(RateLimiterTest, KeepsBucketsInUse) {
+  RateLimitOptions options;
+  options.calls.tokens_per_second = 1.;
+  options.max_keys = 16;
+  RateLimiter rate_limiter(options);
+  const auto buckets = rate_limiter.GetBuckets("held");
+  for (int i = 0; i < 1000; ++i) {
+    rate_limiter.GetBuckets("key" + std::to_string(i));
+  }
+  EXPECT_EQ(rate_limiter.GetBuckets("held"), buckets);
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_RAW_RPC_HANDLER_H
+#define CPP_GRPC_RAW_RPC_HANDLER_H
+
+#include <memory>
+#include <utility>
+
+#include "async_grpc/rpc.h"
+#include "async_grpc/rpc_handler_base.h"
+#include "async_grpc/rpc_service_method_traits.h"
+#include "glog/logging.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// Like 'RpcHandler' but requests and responses are passed as serialized
+// '::grpc::ByteBuffer's, so no protobuf parsing or serialization happens on
+// the server. Useful for proxies and handlers that store or forward payloads
+// unchanged. The method concept uses '::grpc::ByteBuffer' as message type,
+// e.g.
+//   DEFINE_HANDLER_SIGNATURE(ForwardSignature,
+//                            async_grpc::Stream<::grpc::ByteBuffer>,
+//                            async_grpc::Stream<::grpc::ByteBuffer>,
+//                            "/some.package.Service/Forward")
+// The method does not need to be known to the proto descriptor pool.
+template <typename RpcServiceMethodConcept>
+class RawRpcHandler : public RpcHandlerBase<RpcServiceMethodConcept> {
+  using Base = RpcHandlerBase<RpcServiceMethodConcept>;
+
+ public:
+  using RpcServiceMethod = RpcServiceMethodTraits<RpcServiceMethodConcept>;
+  static_assert(RpcServiceMethod::IsRaw,
+                "RawRpcHandler requires ::grpc::ByteBuffer messages.");
+
+  class Writer : public Base::Writer {
+   public:
+    explicit Writer(std::weak_ptr<Rpc> rpc) : Base::Writer(std::move(rpc)) {}
+    bool Write(::grpc::ByteBuffer message) const {
+      if (auto rpc = this->rpc_.lock()) {
+        rpc->WriteSerialized(std::move(message));
+        return true;
+      }
+      return false;
+    }
+  };
+
+  void OnRequestInternal(const ::google::protobuf::Message* request) override {
+    LOG(FATAL) << "Raw handlers only receive serialized requests.";
+  }
+  void OnRawRequestInternal(const ::grpc::ByteBuffer& request) override {
+    OnRequest(request);
+  }
+  // 'request' is only valid for the duration of the call; copying the
+  // 'ByteBuffer' is cheap as it only references the underlying slices.
+  virtual void OnRequest(const ::grpc::ByteBuffer& request) = 0;
+  void Send(::grpc::ByteBuffer response) {
+    this->rpc()->WriteSerialized(std::move(response));
+  }
+  // Takes 'response' unless the send queue is full, see
+  // 'SetSendQueueWaterMarks()', in which case 'OnWritable()' is called once
+  // the client caught up.
+  bool TrySend(::grpc::ByteBuffer* response) {
+    return this->rpc()->TryWriteSerialized(response);
+  }
+  Writer GetWriter() { return Writer(this->rpc()->GetWeakPtr()); }
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_RAW_RPC_HANDLER_H
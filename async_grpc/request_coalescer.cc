@@ -0,0 +1,97 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/request_coalescer.h"
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+
+std::string FlattenByteBuffer(const ::grpc::ByteBuffer& buffer) {
+  std::string bytes;
+  std::vector<::grpc::Slice> slices;
+  if (!buffer.Valid() || !buffer.Dump(&slices).ok()) {
+    return bytes;
+  }
+  bytes.reserve(buffer.Length());
+  for (const ::grpc::Slice& slice : slices) {
+    bytes.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+  }
+  return bytes;
+}
+
+bool RequestCoalescer::Join(const std::string& key,
+                            FollowerCallback follower_callback,
+                            PromotionCallback promotion_callback) {
+  common::MutexLocker locker(&mutex_);
+  auto it = in_flight_.find(key);
+  if (it == in_flight_.end()) {
+    in_flight_.emplace(key, std::deque<Follower>());
+    return true;
+  }
+  it->second.push_back(
+      Follower{std::move(follower_callback), std::move(promotion_callback)});
+  ++num_coalesced_calls_;
+  return false;
+}
+
+void RequestCoalescer::Complete(const std::string& key,
+                                const ::grpc::Status& status,
+                                const ::grpc::ByteBuffer* response) {
+  std::deque<Follower> followers;
+  {
+    common::MutexLocker locker(&mutex_);
+    auto it = in_flight_.find(key);
+    CHECK(it != in_flight_.end());
+    followers.swap(it->second);
+    in_flight_.erase(it);
+  }
+  for (const Follower& follower : followers) {
+    follower.follower_callback(status, response);
+  }
+}
+
+void RequestCoalescer::Abandon(const std::string& key) {
+  while (true) {
+    PromotionCallback promotion_callback;
+    {
+      common::MutexLocker locker(&mutex_);
+      auto it = in_flight_.find(key);
+      CHECK(it != in_flight_.end());
+      if (it->second.empty()) {
+        in_flight_.erase(it);
+        return;
+      }
+      promotion_callback = std::move(it->second.front().promotion_callback);
+      it->second.pop_front();
+    }
+    // Calls joining meanwhile queue up behind the promoted follower.
+    if (promotion_callback()) {
+      --num_coalesced_calls_;
+      return;
+    }
+  }
+}
+
+std::shared_ptr<RequestCoalescer> CreateRequestCoalescer(
+    bool coalesce_identical_requests) {
+  if (!coalesce_identical_requests) {
+    return nullptr;
+  }
+  return std::make_shared<RequestCoalescer>();
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_REQUEST_COALESCER_H
+#define CPP_GRPC_REQUEST_COALESCER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/common/port.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+// Returns the bytes of 'buffer' in one string, e.g. to key calls by their
+// serialized request.
+std::string FlattenByteBuffer(const ::grpc::ByteBuffer& buffer);
+
+// Lets unary calls of a single method that carry identical serialized
+// requests share one handler invocation while it is in flight: the first call
+// runs the handler, later ones attach to it and get its outcome. If the first
+// call gives up, e.g. because its client cancelled it, a follower takes over
+// and runs the handler instead. Only safe for methods whose response depends
+// on nothing but the request.
+class RequestCoalescer {
+ public:
+  // Receives the outcome of the call a follower attached to. 'response' is
+  // 'nullptr' if that call failed with 'status'. It is serialized only once;
+  // copies of the 'ByteBuffer' share its slices.
+  using FollowerCallback = std::function<void(
+      const ::grpc::Status& status, const ::grpc::ByteBuffer* response)>;
+  // Makes a follower the leader of its call. Returns false if the follower
+  // cannot run the handler anymore, e.g. because it is gone or cancelled.
+  using PromotionCallback = std::function<bool()>;
+
+  // Returns true if no call with 'key' is in flight, in which case the caller
+  // becomes its leader and must eventually call 'Complete()' or 'Abandon()'.
+  // Otherwise the follower is queued and either 'follower_callback' is run by
+  // the leader's 'Complete()' or 'promotion_callback' by its 'Abandon()'.
+  bool Join(const std::string& key, FollowerCallback follower_callback,
+            PromotionCallback promotion_callback);
+  // Runs the callbacks of all calls that attached to 'key' and forgets it.
+  void Complete(const std::string& key, const ::grpc::Status& status,
+                const ::grpc::ByteBuffer* response);
+  // Hands 'key' to the first follower whose promotion succeeds, which is
+  // then its leader. Forgets 'key' if there is none.
+  void Abandon(const std::string& key);
+
+  // Number of calls which did not run the handler themselves.
+  int64 num_coalesced_calls() const { return num_coalesced_calls_; }
+
+ private:
+  struct Follower {
+    FollowerCallback follower_callback;
+    PromotionCallback promotion_callback;
+  };
+
+  common::Mutex mutex_;
+  std::unordered_map<std::string, std::deque<Follower>> in_flight_
+      GUARDED_BY(mutex_);
+  std::atomic<int64> num_coalesced_calls_{0};
+};
+
+// Returns 'nullptr' unless 'coalesce_identical_requests' is set.
+std::shared_ptr<RequestCoalescer> CreateRequestCoalescer(
+    bool coalesce_identical_requests);
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_REQUEST_COALESCER_H
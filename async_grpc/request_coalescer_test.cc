@@ -0,0 +1,113 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/request_coalescer.h"
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+::grpc::ByteBuffer MakeByteBuffer(const std::string& bytes) {
+  ::grpc::Slice slice(bytes);
+  return ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+}
+
+TEST(RequestCoalescerTest, FlattenByteBuffer) {
+  ::grpc::Slice slices[] = {::grpc::Slice(std::string("ab")),
+                            ::grpc::Slice(std::string("cde"))};
+  EXPECT_EQ(FlattenByteBuffer(::grpc::ByteBuffer(slices, 2)), "abcde");
+  EXPECT_EQ(FlattenByteBuffer(::grpc::ByteBuffer()), "");
+}
+
+TEST(RequestCoalescerTest, FollowersGetLeadersResponse) {
+  RequestCoalescer coalescer;
+  std::vector<std::string> responses;
+  const auto follower_callback = [&responses](
+                                     const ::grpc::Status& status,
+                                     const ::grpc::ByteBuffer* response) {
+    EXPECT_TRUE(status.ok());
+    ASSERT_NE(response, nullptr);
+    responses.push_back(FlattenByteBuffer(*response));
+  };
+  EXPECT_TRUE(coalescer.Join("request", follower_callback, nullptr));
+  EXPECT_FALSE(coalescer.Join("request", follower_callback, nullptr));
+  EXPECT_FALSE(coalescer.Join("request", follower_callback, nullptr));
+  EXPECT_TRUE(coalescer.Join("other request", follower_callback, nullptr));
+  const ::grpc::ByteBuffer response = MakeByteBuffer("response");
+  coalescer.Complete("request", ::grpc::Status::OK, &response);
+  EXPECT_EQ(responses, std::vector<std::string>({"response", "response"}));
+  EXPECT_EQ(coalescer.num_coalesced_calls(), 2);
+
+  // Calls after completion lead again.
+  EXPECT_TRUE(coalescer.Join("request", follower_callback, nullptr));
+}
+
+TEST(RequestCoalescerTest, FollowersGetLeadersError) {
+  RequestCoalescer coalescer;
+  ::grpc::Status follower_status;
+  EXPECT_TRUE(coalescer.Join("request", nullptr, nullptr));
+  EXPECT_FALSE(coalescer.Join(
+      "request", [&follower_status](const ::grpc::Status& status,
+                                    const ::grpc::ByteBuffer* response) {
+        EXPECT_EQ(response, nullptr);
+        follower_status = status;
+      },
+      nullptr));
+  coalescer.Complete("request", ::grpc::Status(::grpc::NOT_FOUND, "missing"),
+                     nullptr /* response */);
+  EXPECT_EQ(follower_status.error_code(), ::grpc::NOT_FOUND);
+}
+
+TEST(RequestCoalescerTest, AbandonPromotesFollower) {
+  RequestCoalescer coalescer;
+  std::vector<int> promoted;
+  const auto promotion_callback = [&promoted](int follower, bool accept) {
+    return [&promoted, follower, accept]() {
+      promoted.push_back(follower);
+      return accept;
+    };
+  };
+  int num_responses = 0;
+  const auto follower_callback = [&num_responses](
+                                     const ::grpc::Status& status,
+                                     const ::grpc::ByteBuffer* response) {
+    ++num_responses;
+  };
+  EXPECT_TRUE(coalescer.Join("request", nullptr, nullptr));
+  EXPECT_FALSE(coalescer.Join("request", follower_callback,
+                              promotion_callback(1, false /* accept */)));
+  EXPECT_FALSE(coalescer.Join("request", follower_callback,
+                              promotion_callback(2, true /* accept */)));
+  EXPECT_FALSE(coalescer.Join("request", follower_callback,
+                              promotion_callback(3, true /* accept */)));
+  // The first follower is gone, so the second one takes over.
+  coalescer.Abandon("request");
+  EXPECT_EQ(promoted, std::vector<int>({1, 2}));
+  EXPECT_EQ(coalescer.num_coalesced_calls(), 2);
+  EXPECT_FALSE(coalescer.Join("request", follower_callback, nullptr));
+  const ::grpc::ByteBuffer response = MakeByteBuffer("response");
+  coalescer.Complete("request", ::grpc::Status::OK, &response);
+  EXPECT_EQ(num_responses, 2);
+
+  // Without followers, the key is forgotten.
+  EXPECT_TRUE(coalescer.Join("request", nullptr, nullptr));
+  coalescer.Abandon("request");
+  EXPECT_TRUE(coalescer.Join("request", nullptr, nullptr));
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/response_cache.h"
+
+#include <iterator>
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+namespace {
+
+// Rough bookkeeping cost of an entry besides its request and response.
+constexpr size_t kEntryOverheadBytes = 128;
+
+}  // namespace
+
+ResponseCache::ResponseCache(const ResponseCacheOptions& options)
+    : options_(options) {
+  CHECK_GT(options_.max_bytes, 0);
+}
+
+bool ResponseCache::Lookup(const std::string& request, uint64 generation,
+                           ::grpc::ByteBuffer* response) {
+  common::MutexLocker locker(&mutex_);
+  auto it = index_.find(request);
+  if (it == index_.end()) {
+    ++stats_.num_misses;
+    return false;
+  }
+  const EntryList::iterator entry = it->second;
+  if (entry->generation != generation ||
+      (options_.ttl > common::Duration::zero() &&
+       Clock::now() - entry->insertion_time > options_.ttl)) {
+    EraseLocked(entry);
+    ++stats_.num_misses;
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, entry);
+  *response = entry->response;
+  ++stats_.num_hits;
+  return true;
+}
+
+void ResponseCache::Insert(const std::string& request, uint64 generation,
+                           const ::grpc::ByteBuffer& response) {
+  const size_t num_bytes =
+      request.size() + response.Length() + kEntryOverheadBytes;
+  if (num_bytes > options_.max_bytes) {
+    return;
+  }
+  common::MutexLocker locker(&mutex_);
+  auto it = index_.find(request);
+  if (it != index_.end()) {
+    // A call that missed at the same time already filled the entry.
+    EraseLocked(it->second);
+  }
+  while (stats_.num_bytes + num_bytes > options_.max_bytes) {
+    EraseLocked(std::prev(entries_.end()));
+    ++stats_.num_evictions;
+  }
+  it = index_.emplace(request, EntryList::iterator()).first;
+  entries_.push_front(
+      Entry{&it->first, response, generation, Clock::now(), num_bytes});
+  it->second = entries_.begin();
+  ++stats_.num_entries;
+  stats_.num_bytes += num_bytes;
+}
+
+void ResponseCache::Clear() {
+  common::MutexLocker locker(&mutex_);
+  entries_.clear();
+  index_.clear();
+  stats_.num_entries = 0;
+  stats_.num_bytes = 0;
+}
+
+ResponseCacheStats ResponseCache::GetStats() {
+  common::MutexLocker locker(&mutex_);
+  return stats_;
+}
+
+void ResponseCache::EraseLocked(EntryList::iterator it) {
+  --stats_.num_entries;
+  stats_.num_bytes -= it->num_bytes;
+  // 'it->request' points into the node being erased.
+  index_.erase(index_.find(*it->request));
+  entries_.erase(it);
+}
+
+std::shared_ptr<ResponseCache> CreateResponseCache(
+    const ResponseCacheOptions& options) {
+  if (options.max_bytes == 0) {
+    return nullptr;
+  }
+  return std::make_shared<ResponseCache>(options);
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_RESPONSE_CACHE_H
+#define CPP_GRPC_RESPONSE_CACHE_H
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "async_grpc/common/mutex.h"
+#include "async_grpc/common/port.h"
+#include "async_grpc/common/time.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+struct ResponseCacheOptions {
+  // Bounds the size of the cached requests and responses. Zero disables the
+  // cache.
+  size_t max_bytes = 0;
+  // Entries older than this are not served anymore. Zero keeps them until
+  // they are evicted or invalidated.
+  common::Duration ttl = common::Duration::zero();
+};
+
+struct ResponseCacheStats {
+  int64 num_hits = 0;
+  int64 num_misses = 0;
+  // Entries dropped to stay below 'max_bytes'.
+  int64 num_evictions = 0;
+  int64 num_entries = 0;
+  int64 num_bytes = 0;
+
+  double hit_rate() const {
+    return num_hits + num_misses == 0
+               ? 0.
+               : static_cast<double>(num_hits) / (num_hits + num_misses);
+  }
+};
+
+// A least recently used cache from serialized requests to serialized
+// responses of a single unary method. Hits hand out copies of the cached
+// 'ByteBuffer', which share its slices, so neither the handler nor the
+// serialization run. Thread-safe, shared by all calls of a method.
+//
+// Entries are tagged with a generation, see
+// 'ExecutionContext::InvalidateResponseCaches()'; entries of older
+// generations are treated as misses and dropped.
+class ResponseCache {
+ public:
+  explicit ResponseCache(const ResponseCacheOptions& options);
+
+  // Returns true and sets 'response' if 'request' was answered at
+  // 'generation' no longer than 'ttl' ago.
+  bool Lookup(const std::string& request, uint64 generation,
+              ::grpc::ByteBuffer* response);
+  // Caches 'response', evicting the least recently used entries as needed.
+  // Responses which alone exceed 'max_bytes' are not cached.
+  void Insert(const std::string& request, uint64 generation,
+              const ::grpc::ByteBuffer& response);
+  void Clear();
+
+  ResponseCacheStats GetStats();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    // Points to the key in 'index_', so that the request is stored once.
+    const std::string* request;
+    ::grpc::ByteBuffer response;
+    uint64 generation;
+    Clock::time_point insertion_time;
+    size_t num_bytes;
+  };
+  using EntryList = std::list<Entry>;
+
+  void EraseLocked(EntryList::iterator it) REQUIRES(mutex_);
+
+  const ResponseCacheOptions options_;
+  common::Mutex mutex_;
+  // Most recently used first.
+  EntryList entries_ GUARDED_BY(mutex_);
+  std::unordered_map<std::string, EntryList::iterator> index_
+      GUARDED_BY(mutex_);
+  ResponseCacheStats stats_ GUARDED_BY(mutex_);
+};
+
+// Returns 'nullptr' if 'options' disable the cache.
+std::shared_ptr<ResponseCache> CreateResponseCache(
+    const ResponseCacheOptions& options);
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_RESPONSE_CACHE_H
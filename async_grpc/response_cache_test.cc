@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/response_cache.h"
+
+#include <thread>
+
+#include "async_grpc/request_coalescer.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+::grpc::ByteBuffer MakeByteBuffer(const std::string& bytes) {
+  ::grpc::Slice slice(bytes);
+  return ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+}
+
+ResponseCacheOptions MakeOptions(size_t max_bytes) {
+  ResponseCacheOptions options;
+  options.max_bytes = max_bytes;
+  return options;
+}
+
+TEST(ResponseCacheTest, NoCacheWithoutMemory) {
+  EXPECT_EQ(CreateResponseCache(ResponseCacheOptions()), nullptr);
+  EXPECT_NE(CreateResponseCache(MakeOptions(1024)), nullptr);
+}
+
+TEST(ResponseCacheTest, HitsAndMisses) {
+  ResponseCache cache(MakeOptions(1 << 20));
+  ::grpc::ByteBuffer response;
+  EXPECT_FALSE(cache.Lookup("request", 0 /* generation */, &response));
+  cache.Insert("request", 0 /* generation */, MakeByteBuffer("response"));
+  EXPECT_TRUE(cache.Lookup("request", 0 /* generation */, &response));
+  EXPECT_EQ(FlattenByteBuffer(response), "response");
+  const ResponseCacheStats stats = cache.GetStats();
+  EXPECT_EQ(stats.num_hits, 1);
+  EXPECT_EQ(stats.num_misses, 1);
+  EXPECT_EQ(stats.num_entries, 1);
+  EXPECT_DOUBLE_EQ(stats.hit_rate(), 0.5);
+}
+
+TEST(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+  // Room for two small entries.
+  ResponseCache cache(MakeOptions(2 * 150));
+  ::grpc::ByteBuffer response;
+  cache.Insert("a", 0 /* generation */, MakeByteBuffer("response a"));
+  cache.Insert("b", 0 /* generation */, MakeByteBuffer("response b"));
+  EXPECT_TRUE(cache.Lookup("a", 0 /* generation */, &response));
+  cache.Insert("c", 0 /* generation */, MakeByteBuffer("response c"));
+  EXPECT_TRUE(cache.Lookup("a", 0 /* generation */, &response));
+  EXPECT_FALSE(cache.Lookup("b", 0 /* generation */, &response));
+  EXPECT_TRUE(cache.Lookup("c", 0 /* generation */, &response));
+  EXPECT_EQ(cache.GetStats().num_evictions, 1);
+  EXPECT_EQ(cache.GetStats().num_entries, 2);
+}
+
+TEST(ResponseCacheTest, SkipsResponsesLargerThanCache) {
+  ResponseCache cache(MakeOptions(150));
+  cache.Insert("request", 0 /* generation */,
+               MakeByteBuffer(std::string(1000, 'x')));
+  EXPECT_EQ(cache.GetStats().num_entries, 0);
+}
+
+TEST(ResponseCacheTest, ExpiresEntries) {
+  ResponseCacheOptions options = MakeOptions(1 << 20);
+  options.ttl = common::FromMilliseconds(20);
+  ResponseCache cache(options);
+  ::grpc::ByteBuffer response;
+  cache.Insert("request", 0 /* generation */, MakeByteBuffer("response"));
+  EXPECT_TRUE(cache.Lookup("request", 0 /* generation */, &response));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(cache.Lookup("request", 0 /* generation */, &response));
+  EXPECT_EQ(cache.GetStats().num_entries, 0);
+}
+
+TEST(ResponseCacheTest, DropsEntriesOfOtherGenerations) {
+  ResponseCache cache(MakeOptions(1 << 20));
+  ::grpc::ByteBuffer response;
+  cache.Insert("request", 0 /* generation */, MakeByteBuffer("response"));
+  EXPECT_FALSE(cache.Lookup("request", 1 /* generation */, &response));
+  EXPECT_EQ(cache.GetStats().num_entries, 0);
+}
+
+}  // namespace
+}  // namespace async_grpc
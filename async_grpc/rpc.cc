@@ -17,19 +17,26 @@
 #include "async_grpc/rpc.h"
 #include "async_grpc/service.h"
 
+#include <type_traits>
+
 #include "async_grpc/common/make_unique.h"
+#include "async_grpc/local_call.h"
+#include "async_grpc/request_coalescer.h"
+#include "async_grpc/shared_memory.h"
 #include "glog/logging.h"
 
 namespace async_grpc {
 namespace {
 
+// Rate limiters key all calls from the same process by this peer.
+const char kLocalPeer[] = "local";
+
 // Finishes the gRPC for non-streaming response RPCs, i.e. NORMAL_RPC and
 // CLIENT_STREAMING. If no 'msg' is passed, we signal an error to the client as
 // the server is not honoring the gRPC call signature.
 template <typename ReaderWriter>
 void SendUnaryFinish(ReaderWriter* reader_writer, ::grpc::Status status,
-                     const google::protobuf::Message* msg,
-                     Rpc::EventBase* rpc_event) {
+                     const ::grpc::ByteBuffer* msg, Rpc::EventBase* rpc_event) {
   if (msg) {
     reader_writer->Finish(*msg, status, rpc_event);
   } else {
@@ -37,6 +44,95 @@ void SendUnaryFinish(ReaderWriter* reader_writer, ::grpc::Status status,
   }
 }
 
+// The gRPC stream object serving calls of each stream type and the
+// directions in which it streams.
+template <::grpc::internal::RpcMethod::RpcType kRpcType>
+struct GrpcStream;
+template <>
+struct GrpcStream<::grpc::internal::RpcMethod::BIDI_STREAMING> {
+  using type =
+      ::grpc::ServerAsyncReaderWriter<::grpc::ByteBuffer, ::grpc::ByteBuffer>;
+  static constexpr bool kStreamsRequests = true;
+  static constexpr bool kStreamsResponses = true;
+};
+template <>
+struct GrpcStream<::grpc::internal::RpcMethod::CLIENT_STREAMING> {
+  using type =
+      ::grpc::ServerAsyncReader<::grpc::ByteBuffer, ::grpc::ByteBuffer>;
+  static constexpr bool kStreamsRequests = true;
+  static constexpr bool kStreamsResponses = false;
+};
+template <>
+struct GrpcStream<::grpc::internal::RpcMethod::NORMAL_RPC> {
+  using type = ::grpc::ServerAsyncResponseWriter<::grpc::ByteBuffer>;
+  static constexpr bool kStreamsRequests = false;
+  static constexpr bool kStreamsResponses = false;
+};
+template <>
+struct GrpcStream<::grpc::internal::RpcMethod::SERVER_STREAMING> {
+  using type = ::grpc::ServerAsyncWriter<::grpc::ByteBuffer>;
+  static constexpr bool kStreamsRequests = false;
+  static constexpr bool kStreamsResponses = true;
+};
+
+template <typename Interface, typename Stream>
+Interface* AsInterface(Stream* stream, std::true_type) {
+  return stream;
+}
+
+template <typename Interface, typename Stream>
+Interface* AsInterface(Stream* stream, std::false_type) {
+  LOG(FATAL) << "The stream type of this method has no such interface.";
+  return nullptr;
+}
+
+// An 'Rpc' whose stream type is known at compile time. It keeps the one gRPC
+// stream object it needs inline instead of in a separate allocation, and
+// 'RequestCall()', 'FinishCall()', the reader and writer and the stream
+// directions are resolved by overloading and traits rather than by switching
+// on 'RpcHandlerInfo::rpc_type'.
+template <::grpc::internal::RpcMethod::RpcType kRpcType>
+class TypedRpc : public Rpc {
+ public:
+  TypedRpc(int method_index,
+           ::grpc::ServerCompletionQueue* server_completion_queue,
+           EventQueue* event_queue, ExecutionContext* execution_context,
+           const RpcHandlerInfo& rpc_handler_info, Service* service,
+           WeakPtrFactory weak_ptr_factory)
+      : Rpc(method_index, server_completion_queue, event_queue,
+            execution_context, rpc_handler_info, service, weak_ptr_factory),
+        stream_(server_context()) {}
+
+ private:
+  using Stream = typename GrpcStream<kRpcType>::type;
+  using ReaderInterface =
+      ::grpc::internal::AsyncReaderInterface<::grpc::ByteBuffer>;
+  using WriterInterface =
+      ::grpc::internal::AsyncWriterInterface<::grpc::ByteBuffer>;
+
+  bool streams_requests() const override {
+    return GrpcStream<kRpcType>::kStreamsRequests;
+  }
+  bool streams_responses() const override {
+    return GrpcStream<kRpcType>::kStreamsResponses;
+  }
+  void RequestCall() override { RequestCallOn(&stream_); }
+  void FinishCall(const ::grpc::Status& status,
+                  const ::grpc::ByteBuffer* response) override {
+    FinishCallOn(&stream_, status, response);
+  }
+  ReaderInterface* async_reader_interface() override {
+    return AsInterface<ReaderInterface>(
+        &stream_, std::is_base_of<ReaderInterface, Stream>());
+  }
+  WriterInterface* async_writer_interface() override {
+    return AsInterface<WriterInterface>(
+        &stream_, std::is_base_of<WriterInterface, Stream>());
+  }
+
+  Stream stream_;
+};
+
 }  // namespace
 
 void Rpc::CompletionQueueRpcEvent::Handle() {
@@ -52,6 +148,42 @@ void Rpc::InternalRpcEvent::Handle() {
   }
 }
 
+void Rpc::CallbackEvent::Handle() {
+  if (auto rpc_shared = rpc.lock()) {
+    callback();
+  }
+}
+
+std::unique_ptr<Rpc> Rpc::Create(
+    int method_index, ::grpc::ServerCompletionQueue* server_completion_queue,
+    EventQueue* event_queue, ExecutionContext* execution_context,
+    const RpcHandlerInfo& rpc_handler_info, Service* service,
+    WeakPtrFactory weak_ptr_factory) {
+  switch (rpc_handler_info.rpc_type) {
+    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
+      return common::make_unique<
+          TypedRpc<::grpc::internal::RpcMethod::BIDI_STREAMING>>(
+          method_index, server_completion_queue, event_queue,
+          execution_context, rpc_handler_info, service, weak_ptr_factory);
+    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
+      return common::make_unique<
+          TypedRpc<::grpc::internal::RpcMethod::CLIENT_STREAMING>>(
+          method_index, server_completion_queue, event_queue,
+          execution_context, rpc_handler_info, service, weak_ptr_factory);
+    case ::grpc::internal::RpcMethod::NORMAL_RPC:
+      return common::make_unique<
+          TypedRpc<::grpc::internal::RpcMethod::NORMAL_RPC>>(
+          method_index, server_completion_queue, event_queue,
+          execution_context, rpc_handler_info, service, weak_ptr_factory);
+    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
+      return common::make_unique<
+          TypedRpc<::grpc::internal::RpcMethod::SERVER_STREAMING>>(
+          method_index, server_completion_queue, event_queue,
+          execution_context, rpc_handler_info, service, weak_ptr_factory);
+  }
+  LOG(FATAL) << "Never reached.";
+}
+
 Rpc::Rpc(int method_index,
          ::grpc::ServerCompletionQueue* server_completion_queue,
          EventQueue* event_queue, ExecutionContext* execution_context,
@@ -64,43 +196,302 @@ Rpc::Rpc(int method_index,
       rpc_handler_info_(rpc_handler_info),
       service_(service),
       weak_ptr_factory_(weak_ptr_factory),
+      cancelled_(false),
+      timers_cancelled_(false),
+      peer_on_same_host_(-1),
       new_connection_event_(Event::NEW_CONNECTION, this),
       read_event_(Event::READ, this),
+      resume_read_event_(Event::RESUME_READ, this),
       write_event_(Event::WRITE, this),
       finish_event_(Event::FINISH, this),
       done_event_(Event::DONE, this) {
-  InitializeReadersAndWriters(rpc_handler_info_.rpc_type);
+  // Initialize the prototypical request message. Raw methods have no request
+  // descriptor and pass the serialized request to the handler.
+  request_prototype_ =
+      rpc_handler_info_.request_descriptor
+          ? ::google::protobuf::MessageFactory::generated_factory()
+                ->GetPrototype(rpc_handler_info_.request_descriptor)
+          : nullptr;
+}
 
-  // Initialize the prototypical request and response messages.
-  request_.reset(::google::protobuf::MessageFactory::generated_factory()
-                     ->GetPrototype(rpc_handler_info_.request_descriptor)
-                     ->New());
-  response_.reset(::google::protobuf::MessageFactory::generated_factory()
-                      ->GetPrototype(rpc_handler_info_.response_descriptor)
-                      ->New());
+Rpc::~Rpc() {
+  if (local_call_) {
+    local_call_->DetachServer();
+  }
+  AbandonCoalescedCalls();
 }
 
 std::unique_ptr<Rpc> Rpc::Clone() {
-  return common::make_unique<Rpc>(
+  return Create(
       method_index_, server_completion_queue_, event_queue_, execution_context_,
       rpc_handler_info_, service_, weak_ptr_factory_);
 }
 
 void Rpc::OnConnection() {
-  if (!handler_) {
-    // Instantiate the handler.
-    handler_ = rpc_handler_info_.rpc_handler_factory(this, execution_context_);
+  // Calls answered from the response cache or by an identical call in flight
+  // never see their handler, so it is only instantiated for their request.
+  if (!may_skip_handler()) {
+    InstantiateHandler();
+  }
+
+  if (rpc_handler_info_.idle_timeout > common::Duration::zero()) {
+    RecordActivity();
+    ScheduleIdleCheck(last_activity_ + rpc_handler_info_.idle_timeout);
   }
 
   // For request-streaming RPCs ask the client to start sending requests.
   RequestStreamingReadIfNeeded();
 }
 
-void Rpc::OnRequest() { handler_->OnRequestInternal(request_.get()); }
+void Rpc::OnRequest() {
+  if (AnswerFromResponseCache() || JoinCoalescedCall()) {
+    return;
+  }
+  HandleRequest();
+}
+
+void Rpc::HandleRequest() {
+  InstantiateHandler();
+  if (batches_requests()) {
+    AddRequestToBatch();
+    return;
+  }
+  if (local_call_) {
+    handler_->OnRequestInternal(local_request_.get());
+    local_request_.reset();
+    return;
+  }
+  if (!request_prototype_) {
+    handler_->OnRawRequestInternal(request_buffer_);
+    return;
+  }
+  ::google::protobuf::Message* request;
+  if (arena()) {
+    request = request_prototype_->New(arena());
+  } else {
+    if (!request_) {
+      request_.reset(request_prototype_->New());
+    }
+    request = request_.get();
+  }
+  const ::grpc::Status status =
+      ::grpc::SerializationTraits<::google::protobuf::Message>::Deserialize(
+          &request_buffer_, request);
+  if (!status.ok()) {
+    LOG(WARNING) << "Failed to parse request to "
+                 << rpc_handler_info_.fully_qualified_name << ": "
+                 << status.error_message();
+    Finish(::grpc::Status(::grpc::INTERNAL, "Failed to parse request."));
+  } else {
+    handler_->OnRequestInternal(request);
+  }
+  ResetArena();
+}
+
+void Rpc::InstantiateHandler() {
+  if (!handler_) {
+    handler_ = rpc_handler_info_.rpc_handler_factory(this, execution_context_);
+  }
+}
+
+bool Rpc::may_skip_handler() const {
+  return (rpc_handler_info_.response_cache ||
+          rpc_handler_info_.request_coalescer) &&
+         !local_call_ && !streams_requests() && !streams_responses();
+}
+
+bool Rpc::batches_requests() const {
+  // Unary and server streaming calls have a single request, which a
+  // 'BatchingRpcHandler' may batch across Rpcs instead.
+  return rpc_handler_info_.max_request_batch_size > 0 &&
+         request_prototype_ != nullptr && streams_requests();
+}
+
+void Rpc::AddRequestToBatch() {
+  ::google::protobuf::Message* request;
+  if (local_call_) {
+    request = local_request_.get();
+    local_request_batch_.push_back(std::move(local_request_));
+  } else {
+    if (arena()) {
+      request = request_prototype_->New(arena());
+    } else {
+      if (num_pooled_requests_in_use_ == request_pool_.size()) {
+        request_pool_.emplace_back(request_prototype_->New());
+      }
+      request = request_pool_[num_pooled_requests_in_use_++].get();
+    }
+    const ::grpc::Status status =
+        ::grpc::SerializationTraits<::google::protobuf::Message>::Deserialize(
+            &request_buffer_, request);
+    if (!status.ok()) {
+      LOG(WARNING) << "Failed to parse request to "
+                   << rpc_handler_info_.fully_qualified_name << ": "
+                   << status.error_message();
+      Finish(::grpc::Status(::grpc::INTERNAL, "Failed to parse request."));
+      return;
+    }
+  }
+  request_batch_.push_back(request);
+  if (request_batch_.size() >= rpc_handler_info_.max_request_batch_size) {
+    DispatchRequestBatch();
+  } else if (request_batch_.size() == 1) {
+    const int64 request_batch_id = request_batch_id_;
+    ScheduleAfter(rpc_handler_info_.request_batch_window,
+                  [this, request_batch_id]() {
+                    if (request_batch_id == request_batch_id_) {
+                      DispatchRequestBatch();
+                    }
+                  });
+  }
+}
+
+void Rpc::DispatchRequestBatch() {
+  if (request_batch_.empty()) {
+    return;
+  }
+  ++request_batch_id_;
+  handler_->OnRequestBatchInternal(request_batch_);
+  request_batch_.clear();
+  num_pooled_requests_in_use_ = 0;
+  local_request_batch_.clear();
+  ResetArena();
+}
+
+const std::string& Rpc::serialized_request() {
+  if (!has_serialized_request_) {
+    serialized_request_ = FlattenByteBuffer(request_buffer_);
+    has_serialized_request_ = true;
+  }
+  return serialized_request_;
+}
+
+bool Rpc::AnswerFromResponseCache() {
+  if (!rpc_handler_info_.response_cache || local_call_ || streams_requests() ||
+      streams_responses()) {
+    return false;
+  }
+  // Taken before the handler runs, so that a response computed from state
+  // that is invalidated meanwhile is never served.
+  response_cache_generation_ =
+      execution_context_ ? execution_context_->response_cache_generation() : 0;
+  ::grpc::ByteBuffer response;
+  if (rpc_handler_info_.response_cache->Lookup(
+          serialized_request(), response_cache_generation_, &response)) {
+    WriteSerialized(std::move(response));
+    return true;
+  }
+  caches_response_ = true;
+  return false;
+}
+
+bool Rpc::JoinCoalescedCall() {
+  if (!rpc_handler_info_.request_coalescer || local_call_ ||
+      streams_requests() || streams_responses()) {
+    return false;
+  }
+  std::weak_ptr<Rpc> weak_rpc = GetWeakPtr();
+  if (!rpc_handler_info_.request_coalescer->Join(
+          serialized_request(),
+          [weak_rpc](const ::grpc::Status& status,
+                     const ::grpc::ByteBuffer* response) {
+            if (auto rpc = weak_rpc.lock()) {
+              if (response) {
+                rpc->WriteSerialized(*response);
+              } else {
+                rpc->Finish(status);
+              }
+            }
+          },
+          [weak_rpc]() {
+            auto rpc = weak_rpc.lock();
+            if (!rpc || rpc->IsCancelled()) {
+              return false;
+            }
+            // Set right away, so that the call hands on its lead should it
+            // be destroyed before the posted callback ran.
+            rpc->leads_coalesced_calls_ = true;
+            Rpc* const promoted_rpc = rpc.get();
+            rpc->Post([promoted_rpc]() { promoted_rpc->RunPromotedCall(); });
+            return true;
+          })) {
+    // The call being joined fills the cache.
+    caches_response_ = false;
+    return true;
+  }
+  leads_coalesced_calls_ = true;
+  return false;
+}
+
+void Rpc::RunPromotedCall() {
+  HandleRequest();
+  OnReadsDone();
+}
+
+void Rpc::CompleteCoalescedCalls(const ::grpc::Status& status,
+                                 const ::grpc::ByteBuffer* response) {
+  if (!leads_coalesced_calls_.exchange(false)) {
+    return;
+  }
+  rpc_handler_info_.request_coalescer->Complete(serialized_request_, status,
+                                                response);
+}
 
-void Rpc::OnReadsDone() { handler_->OnReadsDone(); }
+void Rpc::AbandonCoalescedCalls() {
+  if (!leads_coalesced_calls_.exchange(false)) {
+    return;
+  }
+  rpc_handler_info_.request_coalescer->Abandon(serialized_request_);
+}
 
-void Rpc::OnFinish() { handler_->OnFinish(); }
+void Rpc::OnReadsDone() {
+  // Requests are delivered before the end of the stream.
+  DispatchRequestBatch();
+  // Calls answered without running the handler have none.
+  if (handler_) {
+    handler_->OnReadsDone();
+    ResetArena();
+  }
+}
+
+::google::protobuf::Arena* Rpc::arena() {
+  if (!arena_ && request_prototype_ && rpc_handler_info_.use_arena) {
+    arena_ = common::make_unique<::google::protobuf::Arena>();
+  }
+  return arena_.get();
+}
+
+void Rpc::ResetArena() {
+  // Frees the request and everything the handler allocated while handling it
+  // at once. Arena messages must not outlive the callback, see
+  // 'RpcHandler::GetArena()'.
+  if (arena_) {
+    arena_->Reset();
+  }
+}
+
+void Rpc::OnFinish() {
+  // Rpcs rejected by the rate limiter are finished without a handler.
+  if (handler_) {
+    handler_->OnFinish();
+  }
+}
+
+void Rpc::OnDone() {
+  // 'ServerContext::IsCancelled()' may only be called once the DONE event has
+  // been delivered, which is why we cache the result for other threads.
+  if (local_call_ ? !local_call_->IsCancelled()
+                  : !server_context_.IsCancelled()) {
+    return;
+  }
+  cancelled_ = true;
+  timers_cancelled_ = true;
+  // The followers' clients still wait for a response.
+  AbandonCoalescedCalls();
+  if (handler_) {
+    handler_->OnCancel();
+  }
+}
 
 void Rpc::RequestNextMethodInvocation() {
   // Ask gRPC to notify us when the connection terminates.
@@ -112,51 +503,144 @@ void Rpc::RequestNextMethodInvocation() {
   // Make sure after terminating the connection, gRPC notifies us with this
   // event.
   SetRpcEventState(Event::NEW_CONNECTION, true);
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      service_->RequestAsyncBidiStreaming(
-          method_index_, &server_context_, streaming_interface(),
-          server_completion_queue_, server_completion_queue_,
-          GetRpcEvent(Event::NEW_CONNECTION));
-      break;
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      service_->RequestAsyncClientStreaming(
-          method_index_, &server_context_, streaming_interface(),
-          server_completion_queue_, server_completion_queue_,
-          GetRpcEvent(Event::NEW_CONNECTION));
-      break;
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      service_->RequestAsyncUnary(
-          method_index_, &server_context_, request_.get(),
-          streaming_interface(), server_completion_queue_,
-          server_completion_queue_, GetRpcEvent(Event::NEW_CONNECTION));
-      break;
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      service_->RequestAsyncServerStreaming(
-          method_index_, &server_context_, request_.get(),
-          streaming_interface(), server_completion_queue_,
-          server_completion_queue_, GetRpcEvent(Event::NEW_CONNECTION));
-      break;
+  RequestCall();
+}
+
+void Rpc::StartLocalCall(std::shared_ptr<LocalCall> local_call) {
+  local_call_ = std::move(local_call);
+  if (!streams_requests()) {
+    CHECK(local_call_->TakeRequest(&local_request_))
+        << "Local calls without request streaming start with their request.";
   }
+  SetRpcEventState(Event::DONE, true);
+  local_call_->AttachServer(GetRpcEvent(Event::DONE));
+  SetRpcEventState(Event::NEW_CONNECTION, true);
+  new_connection_event_.ok = true;
+  new_connection_event_.PushToEventQueue();
 }
 
 void Rpc::RequestStreamingReadIfNeeded() {
+  if (!streams_requests()) {
+    // For NORMAL_RPC and SERVER_STREAMING we don't need to queue an event,
+    // since gRPC automatically issues a READ request and places the request
+    // into the 'ByteBuffer' we provided to 'RequestAsyncUnary' above.
+    OnRequest();
+    OnReadsDone();
+    return;
+  }
   // For request-streaming RPCs ask the client to start sending requests.
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      SetRpcEventState(Event::READ, true);
-      async_reader_interface()->Read(request_.get(), GetRpcEvent(Event::READ));
-      break;
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      // For NORMAL_RPC and SERVER_STREAMING we don't need to queue an event,
-      // since gRPC automatically issues a READ request and places the request
-      // into the 'Message' we provided to 'RequestAsyncUnary' above.
-      OnRequest();
-      OnReadsDone();
-      break;
+  SetRpcEventState(Event::READ, true);
+  if (local_call_) {
+    local_call_->RequestRead(&local_request_, GetRpcEvent(Event::READ));
+    return;
+  }
+  async_reader_interface()->Read(&request_buffer_, GetRpcEvent(Event::READ));
+}
+
+void Rpc::RequestStreamingReadAfter(common::Duration delay) {
+  SetRpcEventState(Event::RESUME_READ, true);
+  if (!resume_read_alarm_) {
+    resume_read_alarm_ = common::make_unique<::grpc::Alarm>();
   }
+  resume_read_alarm_->Set(
+      server_completion_queue_,
+      std::chrono::system_clock::now() +
+          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              delay),
+      GetRpcEvent(Event::RESUME_READ));
+}
+
+bool Rpc::TryAcquireCallToken() {
+  if (!rpc_handler_info_.rate_limiter) {
+    return true;
+  }
+  rate_limit_buckets_ =
+      local_call_ ? rpc_handler_info_.rate_limiter->GetBuckets(kLocalPeer)
+                  : rpc_handler_info_.rate_limiter->GetBuckets(server_context_);
+  return !rate_limit_buckets_->calls ||
+         rate_limit_buckets_->calls->TryAcquire();
+}
+
+void Rpc::RecordActivity() {
+  if (rpc_handler_info_.idle_timeout > common::Duration::zero()) {
+    last_activity_ = TimerWheel::Clock::now();
+  }
+}
+
+void Rpc::ScheduleIdleCheck(TimerWheel::Clock::time_point deadline) {
+  // All events of this Rpc including the timer wheel callbacks are processed
+  // on the same event thread, so 'last_activity_' needs no synchronization.
+  std::weak_ptr<Rpc> weak_rpc = GetWeakPtr();
+  service_->GetTimerWheel(event_queue_)->Schedule(deadline, [weak_rpc]() {
+    if (auto rpc = weak_rpc.lock()) {
+      rpc->CancelIfIdle();
+    }
+  });
+}
+
+void Rpc::ScheduleAfter(common::Duration delay,
+                        std::function<void()> callback) {
+  std::weak_ptr<Rpc> weak_rpc = GetWeakPtr();
+  service_->GetTimerWheel(event_queue_)
+      ->Schedule(TimerWheel::Clock::now() + delay, [weak_rpc, callback]() {
+        auto rpc = weak_rpc.lock();
+        if (rpc && !rpc->timers_cancelled_) {
+          callback();
+        }
+      });
+}
+
+void Rpc::CancelIfIdle() {
+  if (IsCancelled()) {
+    return;
+  }
+  const TimerWheel::Clock::time_point idle_deadline =
+      last_activity_ + rpc_handler_info_.idle_timeout;
+  if (TimerWheel::Clock::now() < idle_deadline) {
+    ScheduleIdleCheck(idle_deadline);
+    return;
+  }
+  LOG(WARNING) << "Cancelling idle call to "
+               << rpc_handler_info_.fully_qualified_name << " from "
+               << peer() << ".";
+  ++service_->num_reaped_idle_rpcs_;
+  {
+    common::MutexLocker locker(&send_queue_lock_);
+    send_queue_.clear();
+    conflated_send_items_.clear();
+    discard_writes_ = true;
+  }
+  // Fails all pending operations, which releases the Rpc through the regular
+  // event handling once gRPC delivers the DONE event.
+  TryCancel();
+}
+
+std::string Rpc::peer() const {
+  return local_call_ ? kLocalPeer : server_context_.peer();
+}
+
+bool Rpc::IsPeerOnSameHost() {
+  int peer_on_same_host = peer_on_same_host_.load();
+  if (peer_on_same_host < 0) {
+    peer_on_same_host = local_call_ || IsLocalPeer(server_context_.peer());
+    peer_on_same_host_.store(peer_on_same_host);
+  }
+  return peer_on_same_host;
+}
+
+void Rpc::TryCancel() {
+  if (local_call_) {
+    local_call_->Cancel(::grpc::Status::CANCELLED);
+    return;
+  }
+  server_context_.TryCancel();
+}
+
+common::Duration Rpc::AcquireMessageToken() {
+  if (!rate_limit_buckets_ || !rate_limit_buckets_->messages) {
+    return common::Duration::zero();
+  }
+  return rate_limit_buckets_->messages->Acquire();
 }
 
 void Rpc::Write(std::unique_ptr<::google::protobuf::Message> message) {
@@ -165,7 +649,83 @@ void Rpc::Write(std::unique_ptr<::google::protobuf::Message> message) {
       new InternalRpcEvent(Event::WRITE_NEEDED, weak_ptr_factory_(this))));
 }
 
+bool Rpc::TryWrite(std::unique_ptr<::google::protobuf::Message>* message) {
+  SendItem send_item;
+  send_item.msg = std::move(*message);
+  if (TryEnqueueMessage(&send_item)) {
+    return true;
+  }
+  *message = std::move(send_item.msg);
+  return false;
+}
+
+bool Rpc::TryWriteSerialized(::grpc::ByteBuffer* buffer) {
+  SendItem send_item;
+  send_item.buffer.Swap(buffer);
+  if (TryEnqueueMessage(&send_item)) {
+    return true;
+  }
+  buffer->Swap(&send_item.buffer);
+  return false;
+}
+
+bool Rpc::TryEnqueueMessage(SendItem* send_item) {
+  {
+    common::MutexLocker locker(&send_queue_lock_);
+    if (send_queue_high_water_mark_ != kUnboundedSendQueue &&
+        send_queue_.size() >= send_queue_high_water_mark_) {
+      writable_notification_pending_ = true;
+      return false;
+    }
+    EnqueueMessageLocked(std::move(*send_item));
+  }
+  event_queue_->Push(UniqueEventPtr(
+      new InternalRpcEvent(Event::WRITE_NEEDED, weak_ptr_factory_(this))));
+  return true;
+}
+
+void Rpc::WriteSerialized(::grpc::ByteBuffer buffer) {
+  if (!buffer.Valid()) {
+    buffer = ::grpc::ByteBuffer(nullptr /* slices */, 0 /* nslices */);
+  }
+  SendItem send_item;
+  send_item.buffer = std::move(buffer);
+  EnqueueMessage(std::move(send_item));
+  event_queue_->Push(UniqueEventPtr(
+      new InternalRpcEvent(Event::WRITE_NEEDED, weak_ptr_factory_(this))));
+}
+
+void Rpc::SetSendQueueWaterMarks(size_t high_water_mark,
+                                 size_t low_water_mark) {
+  CHECK(high_water_mark == kUnboundedSendQueue ||
+        low_water_mark < high_water_mark)
+      << "The low-water mark must be below the high-water mark.";
+  common::MutexLocker locker(&send_queue_lock_);
+  send_queue_high_water_mark_ = high_water_mark;
+  send_queue_low_water_mark_ = low_water_mark;
+}
+
+void Rpc::SetSlowConsumerPolicy(const SlowConsumerPolicy& slow_consumer_policy) {
+  switch (slow_consumer_policy.type) {
+    case SlowConsumerPolicy::Type::BUFFER:
+      break;
+    case SlowConsumerPolicy::Type::CONFLATE:
+      CHECK(slow_consumer_policy.conflation_key)
+          << "Conflation requires a 'conflation_key' function.";
+      break;
+    case SlowConsumerPolicy::Type::DROP_OLDEST:
+    case SlowConsumerPolicy::Type::DISCONNECT:
+      CHECK_GT(slow_consumer_policy.max_queued_messages, 0u);
+      break;
+  }
+  common::MutexLocker locker(&send_queue_lock_);
+  CHECK(send_queue_.empty())
+      << "The slow consumer policy must be set before the first write.";
+  slow_consumer_policy_ = slow_consumer_policy;
+}
+
 void Rpc::Finish(::grpc::Status status) {
+  timers_cancelled_ = true;
   EnqueueMessage(SendItem{nullptr /* message */, status});
   event_queue_->Push(UniqueEventPtr(
       new InternalRpcEvent(Event::WRITE_NEEDED, weak_ptr_factory_(this))));
@@ -173,6 +733,7 @@ void Rpc::Finish(::grpc::Status status) {
 
 void Rpc::HandleSendQueue() {
   SendItem send_item;
+  bool notify_writable = false;
   {
     common::MutexLocker locker(&send_queue_lock_);
     if (send_queue_.empty() || IsRpcEventPending(Event::WRITE) ||
@@ -180,63 +741,21 @@ void Rpc::HandleSendQueue() {
       return;
     }
 
-    send_item = std::move(send_queue_.front());
-    send_queue_.pop();
+    send_item = PopMessageLocked();
+    if (writable_notification_pending_ &&
+        send_queue_.size() <= send_queue_low_water_mark_) {
+      writable_notification_pending_ = false;
+      notify_writable = true;
+    }
   }
-  if (!send_item.msg ||
-      rpc_handler_info_.rpc_type == ::grpc::internal::RpcMethod::NORMAL_RPC ||
-      rpc_handler_info_.rpc_type ==
-          ::grpc::internal::RpcMethod::CLIENT_STREAMING) {
-    PerformFinish(std::move(send_item.msg), send_item.status);
+  if (!send_item.has_payload() || !streams_responses()) {
+    PerformFinish(std::move(send_item));
     return;
   }
-  PerformWrite(std::move(send_item.msg), send_item.status);
-}
-
-::grpc::internal::ServerAsyncStreamingInterface* Rpc::streaming_interface() {
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      return server_async_reader_writer_.get();
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      return server_async_reader_.get();
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      return server_async_response_writer_.get();
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      return server_async_writer_.get();
-  }
-  LOG(FATAL) << "Never reached.";
-}
-
-::grpc::internal::AsyncReaderInterface<::google::protobuf::Message>*
-Rpc::async_reader_interface() {
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      return server_async_reader_writer_.get();
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      return server_async_reader_.get();
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      LOG(FATAL) << "For NORMAL_RPC no streaming reader interface exists.";
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      LOG(FATAL)
-          << "For SERVER_STREAMING no streaming reader interface exists.";
+  PerformWrite(std::move(send_item));
+  if (notify_writable) {
+    handler_->OnWritable();
   }
-  LOG(FATAL) << "Never reached.";
-}
-
-::grpc::internal::AsyncWriterInterface<::google::protobuf::Message>*
-Rpc::async_writer_interface() {
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      return server_async_reader_writer_.get();
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      LOG(FATAL) << "For NORMAL_RPC and CLIENT_STREAMING no streaming writer "
-                    "interface exists.";
-      break;
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      return server_async_writer_.get();
-  }
-  LOG(FATAL) << "Never reached.";
 }
 
 Rpc::CompletionQueueRpcEvent* Rpc::GetRpcEvent(Event event) {
@@ -245,9 +764,14 @@ Rpc::CompletionQueueRpcEvent* Rpc::GetRpcEvent(Event event) {
       return &new_connection_event_;
     case Event::READ:
       return &read_event_;
+    case Event::RESUME_READ:
+      return &resume_read_event_;
     case Event::WRITE_NEEDED:
       LOG(FATAL) << "Rpc does not store Event::WRITE_NEEDED.";
       break;
+    case Event::CALLBACK:
+      LOG(FATAL) << "Rpc does not store Event::CALLBACK.";
+      break;
     case Event::WRITE:
       return &write_event_;
     case Event::FINISH:
@@ -264,43 +788,196 @@ bool* Rpc::GetRpcEventState(Event event) {
 
 void Rpc::EnqueueMessage(SendItem&& send_item) {
   common::MutexLocker locker(&send_queue_lock_);
-  send_queue_.emplace(std::move(send_item));
+  EnqueueMessageLocked(std::move(send_item));
 }
 
-void Rpc::PerformFinish(std::unique_ptr<::google::protobuf::Message> message,
-                        ::grpc::Status status) {
-  SetRpcEventState(Event::FINISH, true);
-  switch (rpc_handler_info_.rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      CHECK(!message);
-      server_async_reader_writer_->Finish(status, GetRpcEvent(Event::FINISH));
+void Rpc::EnqueueMessageLocked(SendItem&& send_item) {
+  if (discard_writes_) {
+    // The call has already been failed, drop everything written afterwards.
+    return;
+  }
+  if (!send_item.has_payload()) {
+    send_queue_.emplace_back(std::move(send_item));
+    return;
+  }
+  switch (slow_consumer_policy_.type) {
+    case SlowConsumerPolicy::Type::BUFFER:
       break;
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      response_ = std::move(message);
-      SendUnaryFinish(server_async_reader_.get(), status, response_.get(),
-                      GetRpcEvent(Event::FINISH));
+    case SlowConsumerPolicy::Type::CONFLATE: {
+      if (!send_item.msg) {
+        // Serialized responses carry no key and are never conflated.
+        break;
+      }
+      send_item.conflation_key =
+          slow_consumer_policy_.conflation_key(*send_item.msg);
+      auto it = conflated_send_items_.find(send_item.conflation_key);
+      if (it != conflated_send_items_.end()) {
+        // Keep the position of the queued response but send the newest value.
+        it->second->msg = std::move(send_item.msg);
+        return;
+      }
+      send_queue_.emplace_back(std::move(send_item));
+      conflated_send_items_.emplace(send_queue_.back().conflation_key,
+                                    &send_queue_.back());
+      return;
+    }
+    case SlowConsumerPolicy::Type::DROP_OLDEST:
+      while (NumQueuedMessagesLocked() >=
+                 slow_consumer_policy_.max_queued_messages &&
+             send_queue_.front().has_payload()) {
+        PopMessageLocked();
+      }
       break;
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      response_ = std::move(message);
-      SendUnaryFinish(server_async_response_writer_.get(), status,
-                      response_.get(), GetRpcEvent(Event::FINISH));
-      break;
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      CHECK(!message);
-      server_async_writer_->Finish(status, GetRpcEvent(Event::FINISH));
+    case SlowConsumerPolicy::Type::DISCONNECT:
+      if (NumQueuedMessagesLocked() >=
+          slow_consumer_policy_.max_queued_messages) {
+        LOG(WARNING) << "Client of " << rpc_handler_info_.fully_qualified_name
+                     << " fell behind by " << NumQueuedMessagesLocked()
+                     << " messages, failing the call.";
+        send_queue_.clear();
+        send_queue_.emplace_back(SendItem{
+            nullptr /* message */,
+            ::grpc::Status(::grpc::RESOURCE_EXHAUSTED,
+                           "Client is too slow to consume responses.")});
+        discard_writes_ = true;
+        return;
+      }
       break;
   }
+  send_queue_.emplace_back(std::move(send_item));
+}
+
+Rpc::SendItem Rpc::PopMessageLocked() {
+  SendItem send_item = std::move(send_queue_.front());
+  send_queue_.pop_front();
+  if (slow_consumer_policy_.type == SlowConsumerPolicy::Type::CONFLATE &&
+      send_item.msg) {
+    conflated_send_items_.erase(send_item.conflation_key);
+  }
+  return send_item;
+}
+
+size_t Rpc::NumQueuedMessagesLocked() {
+  // Only counts responses, not a queued 'Finish()'.
+  if (!send_queue_.empty() && !send_queue_.back().has_payload()) {
+    return send_queue_.size() - 1;
+  }
+  return send_queue_.size();
+}
+
+void Rpc::SerializeResponse(SendItem* send_item) {
+  if (send_item->msg) {
+    bool own_buffer;
+    const ::grpc::Status status =
+        ::grpc::SerializationTraits<::google::protobuf::Message>::Serialize(
+            *send_item->msg, &response_buffer_, &own_buffer);
+    CHECK(status.ok()) << "Failed to serialize response of "
+                       << rpc_handler_info_.fully_qualified_name << ": "
+                       << status.error_message();
+    send_item->msg.reset();
+    return;
+  }
+  response_buffer_.Swap(&send_item->buffer);
+}
+
+std::unique_ptr<google::protobuf::Message> Rpc::TakeResponseMessage(
+    SendItem* send_item) {
+  if (send_item->msg) {
+    return std::move(send_item->msg);
+  }
+  std::unique_ptr<google::protobuf::Message> message(
+      ::google::protobuf::MessageFactory::generated_factory()
+          ->GetPrototype(rpc_handler_info_.response_descriptor)
+          ->New());
+  const ::grpc::Status status =
+      ::grpc::SerializationTraits<::google::protobuf::Message>::Deserialize(
+          &send_item->buffer, message.get());
+  CHECK(status.ok()) << "Failed to parse serialized response of "
+                     << rpc_handler_info_.fully_qualified_name << ": "
+                     << status.error_message();
+  return message;
 }
 
-void Rpc::PerformWrite(std::unique_ptr<::google::protobuf::Message> message,
-                       ::grpc::Status status) {
-  CHECK(message) << "PerformWrite must be called with a non-null message";
-  CHECK_NE(rpc_handler_info_.rpc_type, ::grpc::internal::RpcMethod::NORMAL_RPC);
-  CHECK_NE(rpc_handler_info_.rpc_type,
-           ::grpc::internal::RpcMethod::CLIENT_STREAMING);
+void Rpc::PerformFinish(SendItem send_item) {
+  if (local_call_) {
+    std::unique_ptr<google::protobuf::Message> response;
+    if (send_item.has_payload()) {
+      response = TakeResponseMessage(&send_item);
+    }
+    local_call_->DeliverFinish(send_item.status, std::move(response));
+    SetRpcEventState(Event::FINISH, true);
+    finish_event_.ok = true;
+    finish_event_.PushToEventQueue();
+    return;
+  }
+  const ::grpc::ByteBuffer* response = nullptr;
+  if (send_item.has_payload()) {
+    SerializeResponse(&send_item);
+    response = &response_buffer_;
+    CompressUnaryResponseIfWorthIt();
+  }
+  if (caches_response_ && response && send_item.status.ok()) {
+    rpc_handler_info_.response_cache->Insert(
+        serialized_request_, response_cache_generation_, *response);
+  }
+  CompleteCoalescedCalls(send_item.status, response);
+  SetRpcEventState(Event::FINISH, true);
+  FinishCall(send_item.status, response);
+}
+
+void Rpc::PerformWrite(SendItem send_item) {
+  CHECK(send_item.has_payload())
+      << "PerformWrite must be called with a non-null message";
+  CHECK(streams_responses());
   SetRpcEventState(Event::WRITE, true);
-  response_ = std::move(message);
-  async_writer_interface()->Write(*response_, GetRpcEvent(Event::WRITE));
+  if (local_call_) {
+    local_call_->DeliverResponse(TakeResponseMessage(&send_item),
+                                 GetRpcEvent(Event::WRITE));
+    return;
+  }
+  SerializeResponse(&send_item);
+  async_writer_interface()->Write(response_buffer_, GetStreamingWriteOptions(),
+                                  GetRpcEvent(Event::WRITE));
+}
+
+void Rpc::ChooseCompressionAlgorithm() {
+  compression_algorithm_chosen_ = true;
+  // The transport consumes the client's 'grpc-accept-encoding' header, so
+  // the preferred algorithm is always used. gRPC itself sends uncompressed
+  // if the client does not accept it.
+  compression_algorithm_ = rpc_handler_info_.compressor->algorithm();
+}
+
+void Rpc::CompressUnaryResponseIfWorthIt() {
+  if (!rpc_handler_info_.compressor) {
+    return;
+  }
+  ChooseCompressionAlgorithm();
+  // The algorithm goes out with the initial metadata, i.e. the response.
+  if (compression_algorithm_ != GRPC_COMPRESS_NONE &&
+      rpc_handler_info_.compressor->ShouldCompress(response_buffer_)) {
+    server_context_.set_compression_algorithm(compression_algorithm_);
+  }
+}
+
+::grpc::WriteOptions Rpc::GetStreamingWriteOptions() {
+  ::grpc::WriteOptions write_options;
+  if (!rpc_handler_info_.compressor) {
+    return write_options;
+  }
+  if (!compression_algorithm_chosen_) {
+    // Must be announced before the first response, which sends the initial
+    // metadata. Small responses then opt out one by one.
+    ChooseCompressionAlgorithm();
+    if (compression_algorithm_ != GRPC_COMPRESS_NONE) {
+      server_context_.set_compression_algorithm(compression_algorithm_);
+    }
+  }
+  if (compression_algorithm_ == GRPC_COMPRESS_NONE ||
+      !rpc_handler_info_.compressor->ShouldCompress(response_buffer_)) {
+    write_options.set_no_compression();
+  }
+  return write_options;
 }
 
 void Rpc::SetRpcEventState(Event event, bool pending) {
@@ -314,41 +991,75 @@ bool Rpc::IsRpcEventPending(Event event) { return *GetRpcEventState(event); }
 bool Rpc::IsAnyEventPending() {
   return IsRpcEventPending(Rpc::Event::DONE) ||
          IsRpcEventPending(Rpc::Event::READ) ||
+         IsRpcEventPending(Rpc::Event::RESUME_READ) ||
          IsRpcEventPending(Rpc::Event::WRITE) ||
          IsRpcEventPending(Rpc::Event::FINISH);
 }
 
 std::weak_ptr<Rpc> Rpc::GetWeakPtr() { return weak_ptr_factory_(this); }
 
-ActiveRpcs::ActiveRpcs() : lock_() {}
+void Rpc::Post(std::function<void()> callback) {
+  event_queue_->Push(UniqueEventPtr(
+      new CallbackEvent(weak_ptr_factory_(this), std::move(callback))));
+}
 
-void Rpc::InitializeReadersAndWriters(
-    ::grpc::internal::RpcMethod::RpcType rpc_type) {
-  switch (rpc_type) {
-    case ::grpc::internal::RpcMethod::BIDI_STREAMING:
-      server_async_reader_writer_ =
-          common::make_unique<::grpc::ServerAsyncReaderWriter<
-              google::protobuf::Message, google::protobuf::Message>>(
-              &server_context_);
-      break;
-    case ::grpc::internal::RpcMethod::CLIENT_STREAMING:
-      server_async_reader_ = common::make_unique<::grpc::ServerAsyncReader<
-          google::protobuf::Message, google::protobuf::Message>>(
-          &server_context_);
-      break;
-    case ::grpc::internal::RpcMethod::NORMAL_RPC:
-      server_async_response_writer_ = common::make_unique<
-          ::grpc::ServerAsyncResponseWriter<google::protobuf::Message>>(
-          &server_context_);
-      break;
-    case ::grpc::internal::RpcMethod::SERVER_STREAMING:
-      server_async_writer_ = common::make_unique<
-          ::grpc::ServerAsyncWriter<google::protobuf::Message>>(
-          &server_context_);
-      break;
-  }
+WorkerPool* Rpc::worker_pool() { return service_->worker_pool(); }
+
+void Rpc::RequestCallOn(ServerAsyncReaderWriter* stream) {
+  service_->RequestAsyncBidiStreaming(
+      method_index_, &server_context_, stream, server_completion_queue_,
+      server_completion_queue_, GetRpcEvent(Event::NEW_CONNECTION));
+}
+
+void Rpc::RequestCallOn(ServerAsyncReader* stream) {
+  service_->RequestAsyncClientStreaming(
+      method_index_, &server_context_, stream, server_completion_queue_,
+      server_completion_queue_, GetRpcEvent(Event::NEW_CONNECTION));
 }
 
+void Rpc::RequestCallOn(ServerAsyncResponseWriter* stream) {
+  service_->RequestAsyncUnary(method_index_, &server_context_,
+                              &request_buffer_, stream,
+                              server_completion_queue_,
+                              server_completion_queue_,
+                              GetRpcEvent(Event::NEW_CONNECTION));
+}
+
+void Rpc::RequestCallOn(ServerAsyncWriter* stream) {
+  service_->RequestAsyncServerStreaming(
+      method_index_, &server_context_, &request_buffer_, stream,
+      server_completion_queue_, server_completion_queue_,
+      GetRpcEvent(Event::NEW_CONNECTION));
+}
+
+void Rpc::FinishCallOn(ServerAsyncReaderWriter* stream,
+                       const ::grpc::Status& status,
+                       const ::grpc::ByteBuffer* response) {
+  CHECK(!response);
+  stream->Finish(status, GetRpcEvent(Event::FINISH));
+}
+
+void Rpc::FinishCallOn(ServerAsyncReader* stream,
+                       const ::grpc::Status& status,
+                       const ::grpc::ByteBuffer* response) {
+  SendUnaryFinish(stream, status, response, GetRpcEvent(Event::FINISH));
+}
+
+void Rpc::FinishCallOn(ServerAsyncResponseWriter* stream,
+                       const ::grpc::Status& status,
+                       const ::grpc::ByteBuffer* response) {
+  SendUnaryFinish(stream, status, response, GetRpcEvent(Event::FINISH));
+}
+
+void Rpc::FinishCallOn(ServerAsyncWriter* stream,
+                       const ::grpc::Status& status,
+                       const ::grpc::ByteBuffer* response) {
+  CHECK(!response);
+  stream->Finish(status, GetRpcEvent(Event::FINISH));
+}
+
+ActiveRpcs::ActiveRpcs() : lock_() {}
+
 ActiveRpcs::~ActiveRpcs() {
   common::MutexLocker locker(&lock_);
   if (!rpcs_.empty()) {
@@ -17,15 +17,25 @@
 #ifndef CPP_GRPC_RPC_H
 #define CPP_GRPC_RPC_H
 
+#include <atomic>
+#include <list>
 #include <memory>
-#include <queue>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "async_grpc/common/blocking_queue.h"
 #include "async_grpc/common/mutex.h"
+#include "async_grpc/common/time.h"
 #include "async_grpc/execution_context.h"
+#include "async_grpc/rate_limiter.h"
 #include "async_grpc/rpc_handler_interface.h"
+#include "async_grpc/timer_wheel.h"
+#include "async_grpc/worker_pool.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message.h"
+#include "grpc++/alarm.h"
 #include "grpc++/grpc++.h"
 #include "grpc++/impl/codegen/async_stream.h"
 #include "grpc++/impl/codegen/async_unary_call.h"
@@ -34,18 +44,49 @@
 
 namespace async_grpc {
 
+class LocalCall;
 class Service;
 // TODO(cschuet): Add a unittest that tests the logic of this class.
 class Rpc {
  public:
   using WeakPtrFactory = std::function<std::weak_ptr<Rpc>(Rpc*)>;
+  // A send queue high-water mark of 'kUnboundedSendQueue' means that
+  // 'TryWrite()' never rejects a message.
+  static constexpr size_t kUnboundedSendQueue = 0;
+
+  // Decides what happens to responses that are written faster than the client
+  // consumes them.
+  struct SlowConsumerPolicy {
+    enum class Type {
+      // Queues every response until it has been sent.
+      BUFFER = 0,
+      // Replaces a queued response by a newer one with the same
+      // 'conflation_key'.
+      CONFLATE,
+      // Discards the oldest queued responses to keep at most
+      // 'max_queued_messages' in the queue.
+      DROP_OLDEST,
+      // Fails the call with RESOURCE_EXHAUSTED once 'max_queued_messages'
+      // responses are waiting to be sent.
+      DISCONNECT
+    };
+    using ConflationKeyFunction =
+        std::function<std::string(const ::google::protobuf::Message&)>;
+
+    Type type = Type::BUFFER;
+    size_t max_queued_messages = 0;
+    ConflationKeyFunction conflation_key;
+  };
+
   enum class Event {
     NEW_CONNECTION = 0,
     READ,
+    RESUME_READ,
     WRITE_NEEDED,
     WRITE,
     FINISH,
-    DONE
+    DONE,
+    CALLBACK
   };
 
   struct EventBase {
@@ -102,87 +143,289 @@ class Rpc {
     std::weak_ptr<Rpc> rpc;
   };
 
-  Rpc(int method_index, ::grpc::ServerCompletionQueue* server_completion_queue,
+  // Runs a callback posted with 'Post()' if the Rpc still exists.
+  struct CallbackEvent : public EventBase {
+    CallbackEvent(std::weak_ptr<Rpc> rpc, std::function<void()> callback)
+        : EventBase(Event::CALLBACK),
+          rpc(std::move(rpc)),
+          callback(std::move(callback)) {}
+    void Handle() override;
+
+    std::weak_ptr<Rpc> rpc;
+    std::function<void()> callback;
+  };
+
+  // Returns a 'TypedRpc' for the stream type of 'rpc_handler_info'.
+  static std::unique_ptr<Rpc> Create(
+      int method_index, ::grpc::ServerCompletionQueue* server_completion_queue,
       EventQueue* event_queue, ExecutionContext* execution_context,
       const RpcHandlerInfo& rpc_handler_info, Service* service,
       WeakPtrFactory weak_ptr_factory);
+  virtual ~Rpc();
   std::unique_ptr<Rpc> Clone();
   void OnConnection();
   void OnRequest();
   void OnReadsDone();
   void OnFinish();
+  void OnDone();
   void RequestNextMethodInvocation();
+  // Serves 'local_call' instead of waiting for a call from gRPC, see
+  // 'local_call.h'.
+  void StartLocalCall(std::shared_ptr<LocalCall> local_call);
+  bool is_local() const { return local_call_ != nullptr; }
   void RequestStreamingReadIfNeeded();
+  // Like 'RequestStreamingReadIfNeeded()' but only asks the client for the
+  // next request after 'delay' has passed.
+  void RequestStreamingReadAfter(common::Duration delay);
+  // Returns false if the method's call rate limit for this client is
+  // exhausted.
+  bool TryAcquireCallToken();
+  // Notes that a read or write completed, postponing the idle timeout.
+  void RecordActivity();
+  // Returns how long to wait before reading the next streamed request to stay
+  // within the method's message rate limit for this client.
+  common::Duration AcquireMessageToken();
   void HandleSendQueue();
   void Write(std::unique_ptr<::google::protobuf::Message> message);
+  // Like 'Write()', but only takes ownership of 'message' if the send queue
+  // holds fewer messages than the high-water mark. Returns false otherwise,
+  // in which case 'OnWritable()' is invoked on the handler once the send queue
+  // has drained to the low-water mark.
+  bool TryWrite(std::unique_ptr<::google::protobuf::Message>* message);
+  // Sends an already serialized response. An invalid (default constructed)
+  // 'buffer' is sent as an empty message.
+  void WriteSerialized(::grpc::ByteBuffer buffer);
+  // Like 'TryWrite()' for serialized responses.
+  bool TryWriteSerialized(::grpc::ByteBuffer* buffer);
+  void SetSendQueueWaterMarks(size_t high_water_mark, size_t low_water_mark);
+  void SetSlowConsumerPolicy(const SlowConsumerPolicy& slow_consumer_policy);
   void Finish(::grpc::Status status);
+  // Runs 'callback' on the event thread of this Rpc once 'delay' has passed,
+  // unless the Rpc has been finished or cancelled by then. Must be called on
+  // the event thread.
+  void ScheduleAfter(common::Duration delay, std::function<void()> callback);
+  // Runs 'callback' on the event thread of this Rpc, ordered with the
+  // handler's other callbacks. Dropped if the Rpc is gone by then. Can be
+  // called from any thread.
+  void Post(std::function<void()> callback);
   Service* service() { return service_; }
+  // Returns 'nullptr' unless the server has worker threads.
+  WorkerPool* worker_pool();
   bool IsRpcEventPending(Event event);
   bool IsAnyEventPending();
   void SetEventQueue(EventQueue* event_queue) { event_queue_ = event_queue; }
   EventQueue* event_queue() { return event_queue_; }
   std::weak_ptr<Rpc> GetWeakPtr();
   RpcHandlerInterface* handler() { return handler_.get(); }
+  // 'nullptr' unless the method was registered with
+  // 'RpcHandlerOptions::use_arena'. Created on first use.
+  ::google::protobuf::Arena* arena();
+  // True once gRPC reported that the client cancelled the call or its
+  // deadline expired. Can be called from any thread.
+  bool IsCancelled() const { return cancelled_.load(); }
+  // True for local calls and clients connected through a Unix domain socket
+  // or the loopback interface. Can be called from any thread.
+  bool IsPeerOnSameHost();
+
+ protected:
+  using ServerAsyncReaderWriter =
+      ::grpc::ServerAsyncReaderWriter<::grpc::ByteBuffer, ::grpc::ByteBuffer>;
+  using ServerAsyncReader =
+      ::grpc::ServerAsyncReader<::grpc::ByteBuffer, ::grpc::ByteBuffer>;
+  using ServerAsyncResponseWriter =
+      ::grpc::ServerAsyncResponseWriter<::grpc::ByteBuffer>;
+  using ServerAsyncWriter = ::grpc::ServerAsyncWriter<::grpc::ByteBuffer>;
+
+  Rpc(int method_index, ::grpc::ServerCompletionQueue* server_completion_queue,
+      EventQueue* event_queue, ExecutionContext* execution_context,
+      const RpcHandlerInfo& rpc_handler_info, Service* service,
+      WeakPtrFactory weak_ptr_factory);
+  ::grpc::ServerContext* server_context() { return &server_context_; }
+  // Ask gRPC for the next call of the method and finish a call through the
+  // stream object of its stream type.
+  void RequestCallOn(ServerAsyncReaderWriter* stream);
+  void RequestCallOn(ServerAsyncReader* stream);
+  void RequestCallOn(ServerAsyncResponseWriter* stream);
+  void RequestCallOn(ServerAsyncWriter* stream);
+  void FinishCallOn(ServerAsyncReaderWriter* stream,
+                    const ::grpc::Status& status,
+                    const ::grpc::ByteBuffer* response);
+  void FinishCallOn(ServerAsyncReader* stream, const ::grpc::Status& status,
+                    const ::grpc::ByteBuffer* response);
+  void FinishCallOn(ServerAsyncResponseWriter* stream,
+                    const ::grpc::Status& status,
+                    const ::grpc::ByteBuffer* response);
+  void FinishCallOn(ServerAsyncWriter* stream, const ::grpc::Status& status,
+                    const ::grpc::ByteBuffer* response);
 
  private:
   struct SendItem {
+    // Items without a payload finish the call with 'status'.
+    bool has_payload() const { return msg || buffer.Valid(); }
+
     std::unique_ptr<google::protobuf::Message> msg;
     ::grpc::Status status;
+    std::string conflation_key;
+    // Serialized payload; used instead of 'msg' for pre-serialized responses.
+    ::grpc::ByteBuffer buffer;
   };
 
   Rpc(const Rpc&) = delete;
   Rpc& operator=(const Rpc&) = delete;
-  void InitializeReadersAndWriters(
-      ::grpc::internal::RpcMethod::RpcType rpc_type);
   CompletionQueueRpcEvent* GetRpcEvent(Event event);
   bool* GetRpcEventState(Event event);
   void SetRpcEventState(Event event, bool pending);
+  void ScheduleIdleCheck(TimerWheel::Clock::time_point deadline);
+  void CancelIfIdle();
+  std::string peer() const;
+  void TryCancel();
+  void ResetArena();
+  // Passes the request to the handler, see 'OnRequest()'.
+  void HandleRequest();
+  void InstantiateHandler();
+  // True for calls which may be answered without running the handler, see
+  // 'AnswerFromResponseCache()' and 'JoinCoalescedCall()'.
+  bool may_skip_handler() const;
+  // See 'RpcHandlerOptions::max_request_batch_size'.
+  bool batches_requests() const;
+  void AddRequestToBatch();
+  void DispatchRequestBatch();
+  // Returns the request as key for the response cache and the coalescer.
+  const std::string& serialized_request();
+  // See 'RpcHandlerOptions::response_cache'. Returns true if the call was
+  // answered from the cache.
+  bool AnswerFromResponseCache();
+  // See 'RpcHandlerOptions::coalesce_identical_requests'. Returns true if the
+  // call attached to an identical call in flight and must not run the
+  // handler.
+  bool JoinCoalescedCall();
+  // Runs the handler of a follower that took over from a leader which gave
+  // up.
+  void RunPromotedCall();
+  // Hands the outcome of a call that led coalesced calls to its followers.
+  void CompleteCoalescedCalls(const ::grpc::Status& status,
+                              const ::grpc::ByteBuffer* response);
+  // Hands the lead to a follower if this call ends without an outcome.
+  void AbandonCoalescedCalls();
+  // Takes 'send_item' only if the send queue is below its high-water mark.
+  bool TryEnqueueMessage(SendItem* send_item);
   void EnqueueMessage(SendItem&& send_item);
-  void PerformFinish(std::unique_ptr<::google::protobuf::Message> message,
-                     ::grpc::Status status);
-  void PerformWrite(std::unique_ptr<::google::protobuf::Message> message,
-                    ::grpc::Status status);
-
-  ::grpc::internal::AsyncReaderInterface<::google::protobuf::Message>*
-  async_reader_interface();
-  ::grpc::internal::AsyncWriterInterface<::google::protobuf::Message>*
-  async_writer_interface();
-
-  ::grpc::internal::ServerAsyncStreamingInterface* streaming_interface();
+  void EnqueueMessageLocked(SendItem&& send_item) REQUIRES(send_queue_lock_);
+  SendItem PopMessageLocked() REQUIRES(send_queue_lock_);
+  size_t NumQueuedMessagesLocked() REQUIRES(send_queue_lock_);
+  // Moves the serialized payload of 'send_item' into 'response_buffer_'.
+  void SerializeResponse(SendItem* send_item);
+  // Returns the response of 'send_item' as message for a 'LocalCall',
+  // parsing serialized responses.
+  std::unique_ptr<google::protobuf::Message> TakeResponseMessage(
+      SendItem* send_item);
+  void PerformFinish(SendItem send_item);
+  void PerformWrite(SendItem send_item);
+  // Apply the method's 'Compressor', if any, to 'response_buffer_'.
+  void ChooseCompressionAlgorithm();
+  void CompressUnaryResponseIfWorthIt();
+  ::grpc::WriteOptions GetStreamingWriteOptions();
+
+  // Implemented by 'TypedRpc', which owns the gRPC stream object of the
+  // method's stream type, see 'rpc.cc'.
+  virtual bool streams_requests() const = 0;
+  virtual bool streams_responses() const = 0;
+  virtual void RequestCall() = 0;
+  // 'response' must be 'nullptr' for methods with streaming responses.
+  virtual void FinishCall(const ::grpc::Status& status,
+                          const ::grpc::ByteBuffer* response) = 0;
+  // Only valid for methods with streaming requests or responses,
+  // respectively.
+  virtual ::grpc::internal::AsyncReaderInterface<::grpc::ByteBuffer>*
+  async_reader_interface() = 0;
+  virtual ::grpc::internal::AsyncWriterInterface<::grpc::ByteBuffer>*
+  async_writer_interface() = 0;
 
   int method_index_;
   ::grpc::ServerCompletionQueue* server_completion_queue_;
   EventQueue* event_queue_;
   ExecutionContext* execution_context_;
-  RpcHandlerInfo rpc_handler_info_;
+  // Owned by the 'Service', which outlives its Rpcs.
+  const RpcHandlerInfo& rpc_handler_info_;
   Service* service_;
   WeakPtrFactory weak_ptr_factory_;
   ::grpc::ServerContext server_context_;
+  std::atomic<bool> cancelled_;
+  // Set once 'Finish()' was called or the call was cancelled. Pending
+  // 'ScheduleAfter()' callbacks are dropped from then on.
+  std::atomic<bool> timers_cancelled_;
+  // -1 until 'IsPeerOnSameHost()' looked at the peer address.
+  std::atomic<int> peer_on_same_host_;
 
   CompletionQueueRpcEvent new_connection_event_;
   CompletionQueueRpcEvent read_event_;
+  CompletionQueueRpcEvent resume_read_event_;
   CompletionQueueRpcEvent write_event_;
   CompletionQueueRpcEvent finish_event_;
   CompletionQueueRpcEvent done_event_;
 
+  // All methods are served with raw 'ByteBuffer' streams; requests are parsed
+  // into 'request_' or, if enabled, a fresh message on 'arena_'. Methods
+  // handled by a 'RawRpcHandler' have no 'request_prototype_'. 'request_' and
+  // 'arena_' are only created once the first request arrives, so that Rpcs
+  // waiting for a call or idle streams stay small.
+  ::grpc::ByteBuffer request_buffer_;
+  ::grpc::ByteBuffer response_buffer_;
+  const google::protobuf::Message* request_prototype_;
   std::unique_ptr<google::protobuf::Message> request_;
-  std::unique_ptr<google::protobuf::Message> response_;
+  // Reset after every handler callback that may have allocated on it.
+  std::unique_ptr<google::protobuf::Arena> arena_;
+
+  // Set for calls from a client in the same process, which bypass gRPC and
+  // hand over messages in 'local_request_' and 'TakeResponseMessage()'.
+  std::shared_ptr<LocalCall> local_call_;
+  bool compression_algorithm_chosen_ = false;
+  grpc_compression_algorithm compression_algorithm_ = GRPC_COMPRESS_NONE;
+  std::unique_ptr<google::protobuf::Message> local_request_;
+
+  // Requests read since the last 'OnRequestBatchInternal()' call. Parsed into
+  // 'request_pool_', which is reused for the next batch, on 'arena_', or
+  // handed over by a local call into 'local_request_batch_'.
+  std::vector<const google::protobuf::Message*> request_batch_;
+  std::vector<std::unique_ptr<google::protobuf::Message>> request_pool_;
+  size_t num_pooled_requests_in_use_ = 0;
+  std::vector<std::unique_ptr<google::protobuf::Message>> local_request_batch_;
+  // Identifies the current batch for its window timer.
+  int64 request_batch_id_ = 0;
+
+  // Flattened 'request_buffer_' of unary calls to methods with a response
+  // cache or coalescing.
+  std::string serialized_request_;
+  bool has_serialized_request_ = false;
+  // Set if the call missed the response cache and caches its response.
+  bool caches_response_ = false;
+  uint64 response_cache_generation_ = 0;
+  // Set if this call runs the handler for identical calls. Followers are
+  // promoted from the event thread of their leader.
+  std::atomic<bool> leads_coalesced_calls_{false};
 
   std::unique_ptr<RpcHandlerInterface> handler_;
 
-  std::unique_ptr<::grpc::ServerAsyncResponseWriter<google::protobuf::Message>>
-      server_async_response_writer_;
-  std::unique_ptr<::grpc::ServerAsyncReader<google::protobuf::Message,
-                                            google::protobuf::Message>>
-      server_async_reader_;
-  std::unique_ptr<::grpc::ServerAsyncReaderWriter<google::protobuf::Message,
-                                                  google::protobuf::Message>>
-      server_async_reader_writer_;
-  std::unique_ptr<::grpc::ServerAsyncWriter<google::protobuf::Message>>
-      server_async_writer_;
+  std::shared_ptr<RateLimiter::Buckets> rate_limit_buckets_;
+  TimerWheel::Clock::time_point last_activity_;
+  // Only created for rate limited streams, see 'RequestStreamingReadAfter()'.
+  std::unique_ptr<::grpc::Alarm> resume_read_alarm_;
 
   common::Mutex send_queue_lock_;
-  std::queue<SendItem> send_queue_;
+  // A 'std::list' since, unlike a 'std::deque', it does not allocate while
+  // empty, which is the common case for idle streams.
+  std::list<SendItem> send_queue_ GUARDED_BY(send_queue_lock_);
+  size_t send_queue_high_water_mark_ GUARDED_BY(send_queue_lock_) =
+      kUnboundedSendQueue;
+  size_t send_queue_low_water_mark_ GUARDED_BY(send_queue_lock_) = 0;
+  bool writable_notification_pending_ GUARDED_BY(send_queue_lock_) = false;
+  SlowConsumerPolicy slow_consumer_policy_ GUARDED_BY(send_queue_lock_);
+  // Queued items by conflation key. Pointers into a 'std::list' stay valid
+  // until the item is popped.
+  std::unordered_map<std::string, SendItem*> conflated_send_items_
+      GUARDED_BY(send_queue_lock_);
+  // Set once the call has been failed by the server; later writes are dropped.
+  bool discard_writes_ GUARDED_BY(send_queue_lock_) = false;
 };
 
 using EventQueue = Rpc::EventQueue;
@@ -17,100 +17,223 @@
 #ifndef CPP_GRPC_RPC_HANDLER_H
 #define CPP_GRPC_RPC_HANDLER_H
 
-#include "async_grpc/execution_context.h"
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "async_grpc/codec.h"
 #include "async_grpc/rpc.h"
-#include "async_grpc/rpc_handler_interface.h"
+#include "async_grpc/rpc_handler_base.h"
 #include "async_grpc/rpc_service_method_traits.h"
-#include "async_grpc/span.h"
+#include "async_grpc/shared_memory.h"
 #include "glog/logging.h"
 #include "google/protobuf/message.h"
 #include "grpc++/grpc++.h"
-#if BUILD_TRACING
-#include "async_grpc/opencensus_span.h"
-#endif
 
 namespace async_grpc {
 
 template <typename RpcServiceMethodConcept>
-class RpcHandler : public RpcHandlerInterface {
+class RpcHandler : public RpcHandlerBase<RpcServiceMethodConcept> {
+  using Base = RpcHandlerBase<RpcServiceMethodConcept>;
+
  public:
   using RpcServiceMethod = RpcServiceMethodTraits<RpcServiceMethodConcept>;
   using RequestType = typename RpcServiceMethod::RequestType;
   using ResponseType = typename RpcServiceMethod::ResponseType;
 
-  class Writer {
+  class Writer : public Base::Writer {
    public:
-    explicit Writer(std::weak_ptr<Rpc> rpc) : rpc_(std::move(rpc)) {}
+    explicit Writer(std::weak_ptr<Rpc> rpc) : Base::Writer(std::move(rpc)) {}
     bool Write(std::unique_ptr<ResponseType> message) const {
-      if (auto rpc = rpc_.lock()) {
-        rpc->Write(std::move(message));
+      if (auto rpc = this->rpc_.lock()) {
+        WriteToRpc(rpc.get(), std::move(message), IsProtobufResponse());
         return true;
       }
       return false;
     }
-    bool WritesDone() const {
-      if (auto rpc = rpc_.lock()) {
-        rpc->Finish(::grpc::Status::OK);
+    // Writes a response produced by 'SerializeResponse()'.
+    bool WriteSerialized(::grpc::ByteBuffer message) const {
+      if (auto rpc = this->rpc_.lock()) {
+        rpc->WriteSerialized(std::move(message));
         return true;
       }
       return false;
     }
-    bool Finish(const ::grpc::Status& status) const {
-      if (auto rpc = rpc_.lock()) {
-        rpc->Finish(status);
-        auto* span = rpc->handler()->trace_span();
-        if (span) {
-          span->SetStatus(status);
-        }
-        return true;
+    // Returns false and leaves 'message' untouched if the Rpc is gone or its
+    // send queue is at the high-water mark. In the latter case the handler's
+    // 'OnWritable()' is called once the client caught up.
+    bool TryWrite(std::unique_ptr<ResponseType>* message) const {
+      if (auto rpc = this->rpc_.lock()) {
+        return TryWriteToRpc(rpc.get(), message, IsProtobufResponse());
       }
       return false;
     }
-
-   private:
-    const std::weak_ptr<Rpc> rpc_;
   };
 
-#if BUILD_TRACING
-  RpcHandler()
-      : span_(
-            OpencensusSpan::StartSpan(RpcServiceMethodConcept::MethodName())) {}
-  virtual ~RpcHandler() { span_->End(); }
-#endif
-
-  Span* trace_span() override { return span_.get(); }
-  void SetExecutionContext(ExecutionContext* execution_context) override {
-    execution_context_ = execution_context;
-  }
-  void SetRpc(Rpc* rpc) override { rpc_ = rpc; }
   void OnRequestInternal(const ::google::protobuf::Message* request) override {
-    DCHECK(dynamic_cast<const RequestType*>(request));
-    OnRequest(static_cast<const RequestType&>(*request));
+    OnProtobufRequest(request, IsProtobufMessage<RequestType>());
+  }
+  // Requests that are no protobuf messages are decoded here instead of 'Rpc'.
+  void OnRawRequestInternal(const ::grpc::ByteBuffer& request) override {
+    ::grpc::ByteBuffer buffer = request;
+    RequestType decoded_request;
+    ::grpc::Status status;
+    {
+      SharedMemoryTransport::PeerScope peer_scope(
+          this->rpc()->IsPeerOnSameHost());
+      status = Codec<RequestType>::Deserialize(&buffer, &decoded_request);
+    }
+    if (!status.ok()) {
+      LOG(WARNING) << "Failed to decode request to "
+                   << RpcServiceMethod::MethodName() << ": "
+                   << status.error_message();
+      this->Finish(
+          ::grpc::Status(::grpc::INTERNAL, "Failed to parse request."));
+      return;
+    }
+    OnRequest(decoded_request);
   }
   virtual void OnRequest(const RequestType& request) = 0;
-  void Finish(::grpc::Status status) {
-    rpc_->Finish(status);
-#if BUILD_TRACING
-    span_->SetStatus(status);
-#endif
+  void OnRequestBatchInternal(
+      const std::vector<const ::google::protobuf::Message*>& requests)
+      override {
+    OnProtobufRequestBatch(requests, IsProtobufMessage<RequestType>());
+  }
+  // Receives the requests that were read since the previous call if the
+  // method was registered with 'RpcHandlerOptions::max_request_batch_size'.
+  // Like in 'OnRequest()' they are only valid until this returns. By default,
+  // calls 'OnRequest()' for each of them.
+  virtual void OnRequestBatch(const std::vector<const RequestType*>& requests) {
+    for (const RequestType* request : requests) {
+      OnRequest(*request);
+    }
   }
   void Send(std::unique_ptr<ResponseType> response) {
-    rpc_->Write(std::move(response));
+    WriteToRpc(this->rpc(), std::move(response), IsProtobufResponse());
+  }
+  // Serializes 'response' right away, so it can live on 'GetArena()' or be
+  // reused once this returns.
+  void Send(const ResponseType& response) {
+    SendSerialized(SerializeResponse(response));
+  }
+  // Sends a response produced by 'SerializeResponse()' or wrapping external
+  // memory, see 'external_byte_buffer.h'. The slices are shared, not copied,
+  // so the same buffer can be sent to many Rpcs.
+  void SendSerialized(::grpc::ByteBuffer response) {
+    this->rpc()->WriteSerialized(std::move(response));
+  }
+  static ::grpc::ByteBuffer SerializeResponse(const ResponseType& response) {
+    ::grpc::ByteBuffer buffer;
+    const ::grpc::Status status =
+        Codec<ResponseType>::Serialize(response, &buffer);
+    CHECK(status.ok()) << status.error_message();
+    return buffer;
+  }
+  bool TrySend(std::unique_ptr<ResponseType>* response) {
+    return TryWriteToRpc(this->rpc(), response, IsProtobufResponse());
   }
-  template <typename T>
-  ExecutionContext::Synchronized<T> GetContext() {
-    return {execution_context_->lock(), execution_context_};
+  // Slow-consumer policies for streaming responses, see
+  // 'Rpc::SlowConsumerPolicy'. Must be called before the first response is
+  // sent, typically from 'Initialize()'.
+  void ConflateResponses(
+      std::function<std::string(const ResponseType&)> conflation_key) {
+    static_assert(IsProtobufResponse::value,
+                  "Only protobuf responses can be conflated.");
+    Rpc::SlowConsumerPolicy policy;
+    policy.type = Rpc::SlowConsumerPolicy::Type::CONFLATE;
+    policy.conflation_key =
+        [conflation_key](const ::google::protobuf::Message& message) {
+          return conflation_key(static_cast<const ResponseType&>(message));
+        };
+    this->rpc()->SetSlowConsumerPolicy(policy);
   }
-  template <typename T>
-  T* GetUnsynchronizedContext() {
-    return dynamic_cast<T*>(execution_context_);
+  void DropOldestResponses(size_t max_queued_responses) {
+    Rpc::SlowConsumerPolicy policy;
+    policy.type = Rpc::SlowConsumerPolicy::Type::DROP_OLDEST;
+    policy.max_queued_messages = max_queued_responses;
+    this->rpc()->SetSlowConsumerPolicy(policy);
   }
-  Writer GetWriter() { return Writer(rpc_->GetWeakPtr()); }
+  void DisconnectSlowConsumer(size_t max_queued_responses) {
+    Rpc::SlowConsumerPolicy policy;
+    policy.type = Rpc::SlowConsumerPolicy::Type::DISCONNECT;
+    policy.max_queued_messages = max_queued_responses;
+    this->rpc()->SetSlowConsumerPolicy(policy);
+  }
+  // Returns the Rpc's arena if the method was registered with
+  // 'RpcHandlerOptions::use_arena' and 'nullptr' otherwise. Requests are
+  // allocated on it. Messages created with
+  // 'google::protobuf::Arena::CreateMessage<T>(GetArena())' stay valid until
+  // the current 'OnRequest()' or 'OnReadsDone()' returns; send them with
+  // 'Send(const ResponseType&)'. Must not be used from other threads.
+  ::google::protobuf::Arena* GetArena() { return this->rpc()->arena(); }
+  Writer GetWriter() { return Writer(this->rpc()->GetWeakPtr()); }
 
  private:
-  Rpc* rpc_;
-  ExecutionContext* execution_context_;
-  std::unique_ptr<Span> span_;
+  using IsProtobufResponse = IsProtobufMessage<ResponseType>;
+
+  void OnProtobufRequest(const ::google::protobuf::Message* request,
+                         std::true_type) {
+    DCHECK(dynamic_cast<const RequestType*>(request));
+    OnRequest(static_cast<const RequestType&>(*request));
+  }
+  void OnProtobufRequest(const ::google::protobuf::Message* request,
+                         std::false_type) {
+    LOG(FATAL) << "Requests to " << RpcServiceMethod::MethodName()
+               << " are not protobuf messages.";
+  }
+  void OnProtobufRequestBatch(
+      const std::vector<const ::google::protobuf::Message*>& requests,
+      std::true_type) {
+    request_batch_.clear();
+    for (const ::google::protobuf::Message* request : requests) {
+      DCHECK(dynamic_cast<const RequestType*>(request));
+      request_batch_.push_back(static_cast<const RequestType*>(request));
+    }
+    OnRequestBatch(request_batch_);
+    request_batch_.clear();
+  }
+  void OnProtobufRequestBatch(
+      const std::vector<const ::google::protobuf::Message*>& requests,
+      std::false_type) {
+    LOG(FATAL) << "Requests to " << RpcServiceMethod::MethodName()
+               << " are not protobuf messages.";
+  }
+
+  // Protobuf responses are serialized by 'Rpc' when they are sent, others
+  // right away.
+  static void WriteToRpc(Rpc* rpc, std::unique_ptr<ResponseType> message,
+                         std::true_type) {
+    rpc->Write(std::move(message));
+  }
+  static void WriteToRpc(Rpc* rpc, std::unique_ptr<ResponseType> message,
+                         std::false_type) {
+    PrepareForPeer(message.get(), rpc->IsPeerOnSameHost());
+    rpc->WriteSerialized(SerializeResponse(*message));
+  }
+  static bool TryWriteToRpc(Rpc* rpc, std::unique_ptr<ResponseType>* message,
+                            std::true_type) {
+    std::unique_ptr<::google::protobuf::Message> generic_message(
+        message->release());
+    if (rpc->TryWrite(&generic_message)) {
+      return true;
+    }
+    message->reset(static_cast<ResponseType*>(generic_message.release()));
+    return false;
+  }
+  static bool TryWriteToRpc(Rpc* rpc, std::unique_ptr<ResponseType>* message,
+                            std::false_type) {
+    PrepareForPeer(message->get(), rpc->IsPeerOnSameHost());
+    ::grpc::ByteBuffer buffer = SerializeResponse(**message);
+    if (rpc->TryWriteSerialized(&buffer)) {
+      message->reset();
+      return true;
+    }
+    return false;
+  }
+
+  // Reused by 'OnProtobufRequestBatch()'.
+  std::vector<const RequestType*> request_batch_;
 };
 
 }  // namespace async_grpc
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_RPC_HANDLER_BASE_H
+#define CPP_GRPC_RPC_HANDLER_BASE_H
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "async_grpc/common/time.h"
+#include "async_grpc/execution_context.h"
+#include "async_grpc/rpc.h"
+#include "async_grpc/rpc_handler_interface.h"
+#include "async_grpc/rpc_service_method_traits.h"
+#include "async_grpc/span.h"
+#include "async_grpc/worker_pool.h"
+#include "glog/logging.h"
+#include "grpc++/grpc++.h"
+#if BUILD_TRACING
+#include "async_grpc/opencensus_span.h"
+#endif
+
+namespace async_grpc {
+
+// The part of 'RpcHandler' and 'RawRpcHandler' that does not depend on how
+// requests and responses are represented. Handlers derive from either of
+// those, which add the typed 'OnRequest()', 'Send()' and 'Writer::Write()'.
+template <typename RpcServiceMethodConcept>
+class RpcHandlerBase : public RpcHandlerInterface {
+ public:
+  using RpcServiceMethod = RpcServiceMethodTraits<RpcServiceMethodConcept>;
+
+  // Reaches the call from other threads and after the handler's callbacks
+  // returned. All methods return false once the Rpc is gone.
+  class Writer {
+   public:
+    explicit Writer(std::weak_ptr<Rpc> rpc) : rpc_(std::move(rpc)) {}
+    // Cheap enough to be polled by background producers: returns true if the
+    // client cancelled the call, its deadline expired or the Rpc is gone.
+    bool IsCancelled() const {
+      if (auto rpc = rpc_.lock()) {
+        return rpc->IsCancelled();
+      }
+      return true;
+    }
+    // Runs 'callback' on the handler's event thread, e.g. to continue with the
+    // result of a call to another service.
+    bool Post(std::function<void()> callback) const {
+      if (auto rpc = rpc_.lock()) {
+        rpc->Post(std::move(callback));
+        return true;
+      }
+      return false;
+    }
+    bool WritesDone() const {
+      if (auto rpc = rpc_.lock()) {
+        rpc->Finish(::grpc::Status::OK);
+        return true;
+      }
+      return false;
+    }
+    bool Finish(const ::grpc::Status& status) const {
+      if (auto rpc = rpc_.lock()) {
+        rpc->Finish(status);
+        auto* span = rpc->handler()->trace_span();
+        if (span) {
+          span->SetStatus(status);
+        }
+        return true;
+      }
+      return false;
+    }
+
+   protected:
+    const std::weak_ptr<Rpc> rpc_;
+  };
+
+#if BUILD_TRACING
+  RpcHandlerBase()
+      : span_(
+            OpencensusSpan::StartSpan(RpcServiceMethodConcept::MethodName())) {}
+  virtual ~RpcHandlerBase() { span_->End(); }
+#endif
+
+  Span* trace_span() override { return span_.get(); }
+  void SetExecutionContext(ExecutionContext* execution_context) override {
+    execution_context_ = execution_context;
+  }
+  void SetRpc(Rpc* rpc) override { rpc_ = rpc; }
+  void Finish(::grpc::Status status) {
+    rpc_->Finish(status);
+#if BUILD_TRACING
+    span_->SetStatus(status);
+#endif
+  }
+  // Bounds the number of responses 'TrySend()' and 'Writer::TryWrite()'
+  // accept before the client has consumed them. Typically called from
+  // 'Initialize()'.
+  void SetSendQueueWaterMarks(size_t high_water_mark, size_t low_water_mark) {
+    rpc_->SetSendQueueWaterMarks(high_water_mark, low_water_mark);
+  }
+  template <typename T>
+  ExecutionContext::Synchronized<T> GetContext() {
+    return {execution_context_->lock(), execution_context_};
+  }
+  // For handlers that only read the context, see 'ExecutionContext'.
+  template <typename T>
+  ExecutionContext::SharedSynchronized<T> GetSharedContext() {
+    return {execution_context_->lock(), execution_context_};
+  }
+  template <typename T>
+  std::shared_ptr<const T> GetSnapshot() {
+    return execution_context_->GetSnapshot<T>();
+  }
+  template <typename T>
+  T* GetUnsynchronizedContext() {
+    return dynamic_cast<T*>(execution_context_);
+  }
+  bool IsCancelled() const { return rpc_->IsCancelled(); }
+  // Runs 'callback' on the event thread, like the handler's other callbacks,
+  // once 'delay' has passed. Timers are rounded up to the event thread's
+  // 10 ms tick and dropped once the call is finished or cancelled.
+  void ScheduleAfter(common::Duration delay, std::function<void()> callback) {
+    rpc_->ScheduleAfter(delay, std::move(callback));
+  }
+  // Runs 'task(i)' for every 'i' in [0, 'num_tasks') on the server's worker
+  // threads, see 'Server::Builder::SetNumWorkerThreads()', and then
+  // 'done(results)' with the results ordered by 'i' on the event thread, like
+  // the handler's other callbacks. Returns right away. 'task' runs
+  // concurrently with the handler and must not use it. Once the call is
+  // cancelled the remaining tasks are skipped and 'done' is dropped without
+  // being called, so it must not be relied on to release resources.
+  template <typename Task, typename Done>
+  void ParallelFor(size_t num_tasks, Task task, Done done) {
+    using Result = decltype(std::declval<Task&>()(size_t()));
+    WorkerPool* const worker_pool = rpc_->worker_pool();
+    CHECK(worker_pool) << RpcServiceMethod::MethodName()
+                       << " needs 'Server::Builder::SetNumWorkerThreads()'.";
+    const Writer writer(rpc_->GetWeakPtr());
+    auto shared_done = std::make_shared<Done>(std::move(done));
+    async_grpc::ParallelFor(
+        worker_pool, num_tasks, std::move(task),
+        [writer]() { return !writer.IsCancelled(); },
+        [writer, shared_done](std::vector<Result> results) {
+          auto shared_results =
+              std::make_shared<std::vector<Result>>(std::move(results));
+          writer.Post([shared_done, shared_results]() {
+            (*shared_done)(std::move(*shared_results));
+          });
+        });
+  }
+
+ protected:
+  Rpc* rpc() const { return rpc_; }
+
+ private:
+  Rpc* rpc_;
+  ExecutionContext* execution_context_;
+  std::unique_ptr<Span> span_;
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_RPC_HANDLER_BASE_H
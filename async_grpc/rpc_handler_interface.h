@@ -17,9 +17,17 @@
 #ifndef CPP_GRPC_RPC_HANDLER_INTERFACE_H_
 #define CPP_GRPC_RPC_HANDLER_INTERFACE_H_
 
+#include <vector>
+
 #include "async_grpc/common/make_unique.h"
+#include "async_grpc/compression.h"
+#include "async_grpc/common/time.h"
 #include "async_grpc/execution_context.h"
+#include "async_grpc/rate_limiter.h"
+#include "async_grpc/request_coalescer.h"
+#include "async_grpc/response_cache.h"
 #include "async_grpc/span.h"
+#include "glog/logging.h"
 #include "google/protobuf/message.h"
 #include "grpc++/grpc++.h"
 
@@ -34,8 +42,25 @@ class RpcHandlerInterface {
   virtual void Initialize(){};
   virtual void OnRequestInternal(
       const ::google::protobuf::Message* request) = 0;
+  // Only called for methods handled by a 'RawRpcHandler'.
+  virtual void OnRawRequestInternal(const ::grpc::ByteBuffer& request) {
+    LOG(FATAL) << "Received a serialized request for a non-raw handler.";
+  }
+  // Only called for methods registered with
+  // 'RpcHandlerOptions::max_request_batch_size'.
+  virtual void OnRequestBatchInternal(
+      const std::vector<const ::google::protobuf::Message*>& requests) {
+    LOG(FATAL) << "Received a request batch for a handler without batching.";
+  }
   virtual void OnReadsDone(){};
   virtual void OnFinish(){};
+  // Called once the send queue drained to its low-water mark after a
+  // 'TryWrite()' was rejected because the queue was full.
+  virtual void OnWritable(){};
+  // Called if the client cancelled the call or its deadline expired. Any
+  // further responses are discarded by gRPC, so handlers should stop working
+  // on them.
+  virtual void OnCancel(){};
   virtual Span* trace_span() = 0;
   template <class RpcHandlerType>
   static std::unique_ptr<RpcHandlerType> Instantiate() {
@@ -46,12 +71,55 @@ class RpcHandlerInterface {
 using RpcHandlerFactory = std::function<std::unique_ptr<RpcHandlerInterface>(
     Rpc*, ExecutionContext*)>;
 
+// Per-method options which can be passed to
+// 'Server::Builder::RegisterHandler()'.
+struct RpcHandlerOptions {
+  RateLimitOptions rate_limit;
+  // Calls that neither complete a read nor a write for this long are
+  // cancelled by the server. Zero disables the timeout.
+  common::Duration idle_timeout = common::Duration::zero();
+  // Parses requests into a per-Rpc 'google::protobuf::Arena' which handlers can
+  // also use to build responses, see 'RpcHandler::GetArena()'. Saves many
+  // small allocations for deeply nested messages.
+  bool use_arena = false;
+  // Compresses large responses, see 'Server::GetCompressionStats()'.
+  CompressionOptions compression;
+  // If positive, streamed protobuf requests are collected and handed to
+  // 'RpcHandler::OnRequestBatch()' once a batch holds this many requests,
+  // 'request_batch_window' after its first request or when the client
+  // finished sending. Saves per-request overhead for high-rate streams of
+  // small messages. Also bounds the batches of a 'BatchingRpcHandler'.
+  size_t max_request_batch_size = 0;
+  // Rounded up to the event thread's 10 ms timer tick.
+  common::Duration request_batch_window = common::FromMilliseconds(10);
+  // Unary calls whose serialized request equals that of a call in flight
+  // attach to it instead of running the handler, see 'RequestCoalescer'.
+  bool coalesce_identical_requests = false;
+  // Answers unary calls from a cache keyed by the serialized request, see
+  // 'Server::GetResponseCacheStats()'. Only for methods whose response
+  // depends on nothing but the request and the 'ExecutionContext'.
+  ResponseCacheOptions response_cache;
+};
+
 struct RpcHandlerInfo {
+  // 'nullptr' for methods handled by a 'RawRpcHandler'.
   const google::protobuf::Descriptor* request_descriptor;
   const google::protobuf::Descriptor* response_descriptor;
   const RpcHandlerFactory rpc_handler_factory;
   const ::grpc::internal::RpcMethod::RpcType rpc_type;
   const std::string fully_qualified_name;
+  // Shared by all Rpcs of the method; 'nullptr' if it is not rate limited.
+  const std::shared_ptr<RateLimiter> rate_limiter;
+  const common::Duration idle_timeout;
+  const bool use_arena;
+  // 'nullptr' if responses are not compressed.
+  const std::shared_ptr<Compressor> compressor;
+  const size_t max_request_batch_size;
+  const common::Duration request_batch_window;
+  // 'nullptr' unless identical requests are coalesced.
+  const std::shared_ptr<RequestCoalescer> request_coalescer;
+  // 'nullptr' unless responses are cached.
+  const std::shared_ptr<ResponseCache> response_cache;
 };
 
 }  // namespace async_grpc
@@ -1,8 +1,11 @@
 #ifndef CPP_GRPC_RPC_SERVICE_METHOD_TRAITS_H
 #define CPP_GRPC_RPC_SERVICE_METHOD_TRAITS_H
 
+#include "async_grpc/codec.h"
 #include "async_grpc/type_traits.h"
+#include "google/protobuf/descriptor.h"
 #include "google/protobuf/message.h"
+#include "grpc++/support/byte_buffer.h"
 
 namespace async_grpc {
 
@@ -12,6 +15,22 @@ DEFINE_HAS_SIGNATURE(has_service_method_name, T::MethodName,
 DEFINE_HAS_MEMBER_TYPE(has_incoming_type, IncomingType);
 DEFINE_HAS_MEMBER_TYPE(has_outgoing_type, OutgoingType);
 
+// Returns the descriptor of a proto message type or 'nullptr' for other
+// message types, e.g. serialized '::grpc::ByteBuffer' payloads.
+template <typename MessageType, typename Enable = void>
+struct MessageDescriptor {
+  static const google::protobuf::Descriptor* Get() { return nullptr; }
+};
+
+template <typename MessageType>
+struct MessageDescriptor<
+    MessageType,
+    typename std::enable_if<IsProtobufMessage<MessageType>::value>::type> {
+  static const google::protobuf::Descriptor* Get() {
+    return MessageType::default_instance().GetDescriptor();
+  }
+};
+
 // The RPC service method concept describes types from which properties of an
 // RPC service can be inferred. The type RpcServiceMethod satisfies the RPC
 // service concept if:
@@ -20,6 +39,9 @@ DEFINE_HAS_MEMBER_TYPE(has_outgoing_type, OutgoingType);
 //      the service method
 //   3) it provides an 'OutgoingType' typedef; i.e. the proto message passed to
 //      the service method
+// Message types other than protobuf messages need a '::grpc::SerializationTraits'
+// specialization, see 'codec.h'. Raw methods use '::grpc::ByteBuffer' as both
+// IncomingType and OutgoingType.
 // Note: the IncomingType and OutgoingType specified above may be wrapped (or
 //       tagged) by async_grpc::Stream.
 template <typename RpcServiceMethodConcept>
@@ -43,24 +65,36 @@ struct RpcServiceMethodTraits {
     return RpcServiceMethodConcept::MethodName();
   }
 
-  // An object derived from ::google::protobuf::Message which is passed to a
-  // specific service method.
+  // The message passed to a specific service method, by default derived from
+  // ::google::protobuf::Message.
   using RequestType =
       StripStream<typename RpcServiceMethodConcept::IncomingType>;
 
-  // An object derived from ::google::protobuf::Message which is returned from a
-  // specific service method.
+  // The message returned from a specific service method, by default derived
+  // from ::google::protobuf::Message.
   using ResponseType =
       StripStream<typename RpcServiceMethodConcept::OutgoingType>;
 
-  static_assert(
-      std::is_base_of<::google::protobuf::Message, RequestType>::value,
-      "The RPC request type must be derived from ::google::protobuf::Message.");
+  // True if requests and responses are passed as serialized
+  // '::grpc::ByteBuffer's.
+  static constexpr bool IsRaw =
+      std::is_same<::grpc::ByteBuffer, RequestType>::value &&
+      std::is_same<::grpc::ByteBuffer, ResponseType>::value;
+
+  // True if requests and responses are protobuf messages, in which case the
+  // method must be defined in a proto service.
+  static constexpr bool IsProtobuf = IsProtobufMessage<RequestType>::value &&
+                                     IsProtobufMessage<ResponseType>::value;
+
+  static_assert(HasCodec<RequestType>::value,
+                "The RPC request type must be derived from "
+                "::google::protobuf::Message or specialize "
+                "::grpc::SerializationTraits.");
 
-  static_assert(
-      std::is_base_of<::google::protobuf::Message, ResponseType>::value,
-      "The RPC response type must be derived from "
-      "::google::protobuf::Message.");
+  static_assert(HasCodec<ResponseType>::value,
+                "The RPC response type must be derived from "
+                "::google::protobuf::Message or specialize "
+                "::grpc::SerializationTraits.");
 
   // The streaming type of the service method. See also
   // ::grpc::internal::RpcMethod.
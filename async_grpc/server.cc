@@ -16,6 +16,8 @@
 
 #include "async_grpc/server.h"
 
+#include <algorithm>
+
 #include "glog/logging.h"
 #if BUILD_TRACING
 #include "opencensus/exporters/trace/stackdriver/stackdriver_exporter.h"
@@ -41,10 +43,19 @@ void Server::Builder::SetNumEventThreads(const std::size_t num_event_threads) {
   options_.num_event_threads = num_event_threads;
 }
 
+void Server::Builder::SetNumWorkerThreads(
+    const std::size_t num_worker_threads) {
+  options_.num_worker_threads = num_worker_threads;
+}
+
 void Server::Builder::SetServerAddress(const std::string& server_address) {
   options_.server_address = server_address;
 }
 
+void Server::Builder::AddServerAddress(const std::string& server_address) {
+  options_.additional_server_addresses.push_back(server_address);
+}
+
 void Server::Builder::SetMaxReceiveMessageSize(int max_receive_message_size) {
   CHECK_GT(max_receive_message_size, 0) << "max_receive_message_size must be larger than 0.";
   options_.max_receive_message_size = max_receive_message_size;
@@ -67,6 +78,10 @@ void Server::Builder::DisableTracing() {
   options_.enable_tracing = false;
 }
 
+void Server::Builder::EnableInProcessBypass() {
+  options_.enable_in_process_bypass = true;
+}
+
 void Server::Builder::SetTracingSamplerProbability(double tracing_sampler_probability) {
   options_.tracing_sampler_probability = tracing_sampler_probability;
 }
@@ -100,8 +115,15 @@ std::unique_ptr<Server> Server::Builder::Build() {
 }
 
 Server::Server(const Options& options) : options_(options) {
-  server_builder_.AddListeningPort(options_.server_address,
-                                   ::grpc::InsecureServerCredentials());
+  if (!options_.server_address.empty()) {
+    server_builder_.AddListeningPort(options_.server_address,
+                                     ::grpc::InsecureServerCredentials());
+  }
+  for (const std::string& server_address :
+       options_.additional_server_addresses) {
+    server_builder_.AddListeningPort(server_address,
+                                     ::grpc::InsecureServerCredentials());
+  }
 
   // Set max message sizes.
   server_builder_.SetMaxReceiveMessageSize(options.max_receive_message_size);
@@ -116,6 +138,11 @@ Server::Server(const Options& options) : options_(options) {
     completion_queue_threads_.emplace_back(
         server_builder_.AddCompletionQueue());
   }
+
+  if (options_.num_worker_threads > 0) {
+    worker_pool_ =
+        common::make_unique<WorkerPool>(options_.num_worker_threads);
+  }
 }
 
 void Server::AddService(
@@ -125,7 +152,11 @@ void Server::AddService(
   const auto result = services_.emplace(
       std::piecewise_construct, std::make_tuple(service_name),
       std::make_tuple(service_name, rpc_handler_infos,
-                      [this]() { return SelectNextEventQueueRoundRobin(); }));
+                      [this]() { return SelectNextEventQueueRoundRobin(); },
+                      [this](EventQueue* event_queue) {
+                        return GetTimerWheel(event_queue);
+                      },
+                      worker_pool_.get()));
   CHECK(result.second) << "A service named " << service_name
                        << " already exists.";
   server_builder_.RegisterService(&result.first->second);
@@ -149,13 +180,32 @@ EventQueue* Server::SelectNextEventQueueRoundRobin() {
   return event_queue_threads_.at(current_event_queue_id_).event_queue();
 }
 
-void Server::RunEventQueue(EventQueue* event_queue) {
+TimerWheel* Server::GetTimerWheel(EventQueue* event_queue) {
+  for (auto& event_queue_thread : event_queue_threads_) {
+    if (event_queue_thread.event_queue() == event_queue) {
+      return event_queue_thread.timer_wheel();
+    }
+  }
+  LOG(FATAL) << "Unknown event queue " << event_queue;
+}
+
+void Server::RunEventQueue(EventQueue* event_queue, TimerWheel* timer_wheel) {
   while (!shutting_down_) {
-    Rpc::UniqueEventPtr rpc_event =
-        event_queue->PopWithTimeout(kPopEventTimeout);
+    // Wakes up for the next timer, see 'RpcHandler::ScheduleAfter()'.
+    common::Duration timeout = kPopEventTimeout;
+    const TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+    const TimerWheel::Clock::time_point next_deadline =
+        timer_wheel->NextDeadline();
+    if (next_deadline < now + kPopEventTimeout) {
+      timeout = std::max(
+          common::Duration::zero(),
+          std::chrono::duration_cast<common::Duration>(next_deadline - now));
+    }
+    Rpc::UniqueEventPtr rpc_event = event_queue->PopWithTimeout(timeout);
     if (rpc_event) {
       rpc_event->Handle();
     }
+    timer_wheel->Advance(TimerWheel::Clock::now());
   }
 
   // Finish processing the rest of the items.
@@ -181,6 +231,7 @@ void Server::Start() {
 
   // Start the gRPC server process.
   server_ = server_builder_.BuildAndStart();
+  CHECK(server_) << "Failed to start the server, is an address in use?";
 
   // Start serving all services on all completion queues.
   for (auto& service : services_) {
@@ -190,8 +241,10 @@ void Server::Start() {
 
   // Start threads to process all event queues.
   for (auto& event_queue_thread : event_queue_threads_) {
-    event_queue_thread.Start(
-        [this](EventQueue* event_queue) { RunEventQueue(event_queue); });
+    TimerWheel* timer_wheel = event_queue_thread.timer_wheel();
+    event_queue_thread.Start([this, timer_wheel](EventQueue* event_queue) {
+      RunEventQueue(event_queue, timer_wheel);
+    });
   }
 
   // Start threads to process all completion queues.
@@ -215,6 +268,15 @@ void Server::Shutdown() {
   LOG(INFO) << "Shutting down server.";
   shutting_down_ = true;
 
+  // Stop starting local calls before the services cancel the running ones.
+  {
+    common::MutexLocker locker(&in_process_channels_lock_);
+    for (const auto& channel : in_process_channels_) {
+      LocalCallRegistry::Unregister(channel.get());
+    }
+    in_process_channels_.clear();
+  }
+
   // Tell the services to stop serving RPCs.
   for (auto& service : services_) {
     service.second.StopServing();
@@ -230,6 +292,11 @@ void Server::Shutdown() {
     completion_queue_threads.Shutdown();
   }
 
+  // Workers may still post results to the event threads.
+  if (worker_pool_) {
+    worker_pool_->Shutdown();
+  }
+
   for (auto& event_queue_thread : event_queue_threads_) {
     event_queue_thread.Shutdown();
   }
@@ -237,6 +304,69 @@ void Server::Shutdown() {
   LOG(INFO) << "Shutdown complete.";
 }
 
+std::shared_ptr<::grpc::Channel> Server::InProcessChannel() {
+  CHECK(server_) << "The server must be started first.";
+  ::grpc::ChannelArguments channel_arguments;
+  channel_arguments.SetMaxReceiveMessageSize(options_.max_send_message_size);
+  channel_arguments.SetMaxSendMessageSize(options_.max_receive_message_size);
+  std::shared_ptr<::grpc::Channel> channel =
+      server_->InProcessChannel(channel_arguments);
+  if (!options_.enable_in_process_bypass) {
+    return channel;
+  }
+  LocalCallRegistry::Register(
+      channel.get(),
+      [this](const std::string& method_full_name,
+             const google::protobuf::Descriptor* request_descriptor,
+             const google::protobuf::Descriptor* response_descriptor,
+             std::shared_ptr<LocalCall> local_call) {
+        std::string service_full_name;
+        std::string method_name;
+        std::tie(service_full_name, method_name) =
+            Builder::ParseMethodFullName(method_full_name);
+        auto it = services_.find(service_full_name);
+        if (it == services_.end()) {
+          return false;
+        }
+        return it->second.StartLocalCall(method_name, request_descriptor,
+                                         response_descriptor,
+                                         std::move(local_call));
+      });
+  common::MutexLocker locker(&in_process_channels_lock_);
+  in_process_channels_.push_back(channel);
+  return channel;
+}
+
+int64 Server::GetNumReapedIdleRpcs() {
+  int64 num_reaped_idle_rpcs = 0;
+  for (const auto& service : services_) {
+    num_reaped_idle_rpcs += service.second.num_reaped_idle_rpcs();
+  }
+  return num_reaped_idle_rpcs;
+}
+
+CompressionStats Server::GetCompressionStats(
+    const std::string& method_full_name) {
+  std::string service_full_name;
+  std::string method_name;
+  std::tie(service_full_name, method_name) =
+      Builder::ParseMethodFullName(method_full_name);
+  auto it = services_.find(service_full_name);
+  CHECK(it != services_.end()) << "Unknown method " << method_full_name;
+  return it->second.GetCompressionStats(method_name);
+}
+
+ResponseCacheStats Server::GetResponseCacheStats(
+    const std::string& method_full_name) {
+  std::string service_full_name;
+  std::string method_name;
+  std::tie(service_full_name, method_name) =
+      Builder::ParseMethodFullName(method_full_name);
+  auto it = services_.find(service_full_name);
+  CHECK(it != services_.end()) << "Unknown method " << method_full_name;
+  return it->second.GetResponseCacheStats(method_name);
+}
+
 void Server::SetExecutionContext(
     std::unique_ptr<ExecutionContext> execution_context) {
   // After the server has been started the 'ExecutionHandle' cannot be changed
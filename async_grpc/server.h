@@ -22,14 +22,17 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "async_grpc/common/make_unique.h"
 #include "async_grpc/completion_queue_thread.h"
 #include "async_grpc/event_queue_thread.h"
 #include "async_grpc/execution_context.h"
+#include "async_grpc/raw_rpc_handler.h"
 #include "async_grpc/rpc_handler.h"
 #include "async_grpc/rpc_service_method_traits.h"
 #include "async_grpc/service.h"
+#include "async_grpc/worker_pool.h"
 
 #include "grpc++/grpc++.h"
 
@@ -41,6 +44,10 @@ constexpr double kDefaultTracingSamplerProbability = 0.01;  // 1 Percent
 
 }  // namespace
 
+// True for handlers such as 'BatchingRpcHandler' which share state among all
+// Rpcs of their method.
+DEFINE_HAS_MEMBER_TYPE(has_shared_state, SharedState);
+
 class Server {
  protected:
   // All options that configure server behaviour such as number of threads,
@@ -55,12 +62,15 @@ class Server {
     size_t num_grpc_threads;
     size_t num_event_threads;
     std::string server_address;
+    std::vector<std::string> additional_server_addresses;
     int max_receive_message_size = kDefaultMaxMessageSize;
     int max_send_message_size = kDefaultMaxMessageSize;
     bool enable_tracing = false;
     double tracing_sampler_probability = kDefaultTracingSamplerProbability;
     std::string tracing_task_name;
     std::string tracing_gcp_project_id;
+    bool enable_in_process_bypass = false;
+    size_t num_worker_threads = 0;
   };
 
  public:
@@ -72,7 +82,14 @@ class Server {
     std::unique_ptr<Server> Build();
     void SetNumGrpcThreads(std::size_t num_grpc_threads);
     void SetNumEventThreads(std::size_t num_event_threads);
+    // Threads for 'RpcHandler::ParallelFor()'. None by default.
+    void SetNumWorkerThreads(std::size_t num_worker_threads);
+    // An empty 'server_address' makes the server only reachable through
+    // 'InProcessChannel()'.
     void SetServerAddress(const std::string& server_address);
+    // Makes the server listen on 'server_address' as well, e.g. on a Unix
+    // domain socket 'unix:/tmp/server.sock' for clients on the same host.
+    void AddServerAddress(const std::string& server_address);
     void SetMaxReceiveMessageSize(int max_receive_message_size);
     void SetMaxSendMessageSize(int max_send_message_size);
     void EnableTracing();
@@ -80,9 +97,19 @@ class Server {
     void SetTracingSamplerProbability(double tracing_sampler_probability);
     void SetTracingTaskName(const std::string& tracing_task_name);
     void SetTracingGcpProjectId(const std::string& tracing_gcp_project_id);
+    // Lets 'Client's and 'AsyncClient's using an 'InProcessChannel()' hand
+    // protobuf messages to the handlers directly instead of serializing them.
+    // Handlers observe the same events as for remote calls. Calls to methods
+    // with other codecs still go through gRPC.
+    void EnableInProcessBypass();
 
     template <typename RpcHandlerType>
     void RegisterHandler() {
+      RegisterHandler<RpcHandlerType>(RpcHandlerOptions());
+    }
+
+    template <typename RpcHandlerType>
+    void RegisterHandler(const RpcHandlerOptions& rpc_handler_options) {
       using RpcServiceMethod = typename RpcHandlerType::RpcServiceMethod;
       using RequestType = typename RpcServiceMethod::RequestType;
       using ResponseType = typename RpcServiceMethod::ResponseType;
@@ -96,17 +123,22 @@ class Server {
       rpc_handlers_[service_full_name].emplace(
           method_name,
           RpcHandlerInfo{
-              RequestType::default_instance().GetDescriptor(),
-              ResponseType::default_instance().GetDescriptor(),
-              [](Rpc* const rpc, ExecutionContext* const execution_context) {
-                std::unique_ptr<RpcHandlerInterface> rpc_handler =
-                    common::make_unique<RpcHandlerType>();
-                rpc_handler->SetRpc(rpc);
-                rpc_handler->SetExecutionContext(execution_context);
-                rpc_handler->Initialize();
-                return rpc_handler;
-              },
-              RpcServiceMethod::StreamType, method_full_name});
+              MessageDescriptor<RequestType>::Get(),
+              MessageDescriptor<ResponseType>::Get(),
+              CreateRpcHandlerFactory<RpcHandlerType>(
+                  rpc_handler_options,
+                  std::integral_constant<
+                      bool, has_shared_state<RpcHandlerType>::value>()),
+              RpcServiceMethod::StreamType, method_full_name,
+              CreateRateLimiter(rpc_handler_options.rate_limit),
+              rpc_handler_options.idle_timeout,
+              rpc_handler_options.use_arena,
+              CreateCompressor(rpc_handler_options.compression),
+              rpc_handler_options.max_request_batch_size,
+              rpc_handler_options.request_batch_window,
+              CreateRequestCoalescer(
+                  rpc_handler_options.coalesce_identical_requests),
+              CreateResponseCache(rpc_handler_options.response_cache)});
     }
     static std::tuple<std::string /* service_full_name */,
                       std::string /* method_name */>
@@ -115,6 +147,40 @@ class Server {
    private:
     using ServiceInfo = std::map<std::string, RpcHandlerInfo>;
 
+    template <typename RpcHandlerType>
+    static RpcHandlerFactory CreateRpcHandlerFactory(
+        const RpcHandlerOptions& rpc_handler_options, std::false_type) {
+      return [](Rpc* const rpc, ExecutionContext* const execution_context) {
+        std::unique_ptr<RpcHandlerInterface> rpc_handler =
+            common::make_unique<RpcHandlerType>();
+        rpc_handler->SetRpc(rpc);
+        rpc_handler->SetExecutionContext(execution_context);
+        rpc_handler->Initialize();
+        return rpc_handler;
+      };
+    }
+
+    // Each registration gets its own 'SharedState', so that servers in the
+    // same process do not share it.
+    template <typename RpcHandlerType>
+    static RpcHandlerFactory CreateRpcHandlerFactory(
+        const RpcHandlerOptions& rpc_handler_options, std::true_type) {
+      auto shared_state =
+          std::make_shared<typename RpcHandlerType::SharedState>(
+              rpc_handler_options);
+      return [shared_state](Rpc* const rpc,
+                            ExecutionContext* const execution_context) {
+        auto typed_rpc_handler = common::make_unique<RpcHandlerType>();
+        typed_rpc_handler->SetSharedState(shared_state);
+        std::unique_ptr<RpcHandlerInterface> rpc_handler =
+            std::move(typed_rpc_handler);
+        rpc_handler->SetRpc(rpc);
+        rpc_handler->SetExecutionContext(execution_context);
+        rpc_handler->Initialize();
+        return rpc_handler;
+      };
+    }
+
     template <typename RpcHandlerType>
     void CheckHandlerCompatibility(const std::string& service_full_name,
                                    const std::string& method_name) {
@@ -122,6 +188,11 @@ class Server {
       using RequestType = typename RpcServiceMethod::RequestType;
       using ResponseType = typename RpcServiceMethod::ResponseType;
 
+      if (!RpcServiceMethod::IsProtobuf) {
+        // Raw methods and methods with other codecs do not need to be known to
+        // the proto descriptor pool.
+        return;
+      }
       const auto* pool = google::protobuf::DescriptorPool::generated_pool();
       const auto* service = pool->FindServiceByName(service_full_name);
       CHECK(service) << "Unknown service " << service_full_name;
@@ -129,9 +200,9 @@ class Server {
       CHECK(method_descriptor) << "Unknown method " << method_name
                                << " in service " << service_full_name;
       const auto* request_type = method_descriptor->input_type();
-      CHECK_EQ(RequestType::default_instance().GetDescriptor(), request_type);
+      CHECK_EQ(MessageDescriptor<RequestType>::Get(), request_type);
       const auto* response_type = method_descriptor->output_type();
-      CHECK_EQ(ResponseType::default_instance().GetDescriptor(), response_type);
+      CHECK_EQ(MessageDescriptor<ResponseType>::Get(), response_type);
       const auto rpc_type = RpcServiceMethod::StreamType;
       switch (rpc_type) {
         case ::grpc::internal::RpcMethod::NORMAL_RPC:
@@ -170,6 +241,10 @@ class Server {
   // Shuts down the server and all of its services.
   void Shutdown();
 
+  // Returns a channel to this server that does not use the network. Must be
+  // called after 'Start()'. See also 'Builder::EnableInProcessBypass()'.
+  std::shared_ptr<::grpc::Channel> InProcessChannel();
+
   // Sets the server-wide context object shared between RPC handlers.
   void SetExecutionContext(std::unique_ptr<ExecutionContext> execution_context);
 
@@ -177,12 +252,28 @@ class Server {
   ExecutionContext::Synchronized<T> GetContext() {
     return {execution_context_->lock(), execution_context_.get()};
   }
+  template <typename T>
+  ExecutionContext::SharedSynchronized<T> GetSharedContext() {
+    return {execution_context_->lock(), execution_context_.get()};
+  }
 
   template <typename T>
   T* GetUnsynchronizedContext() {
     return dynamic_cast<T*>(execution_context_.get());
   }
 
+  // Returns the number of streams that were cancelled by the server because
+  // they exceeded their method's idle timeout.
+  int64 GetNumReapedIdleRpcs();
+
+  // Returns the compression counters of a method registered with
+  // 'RpcHandlerOptions::compression'.
+  CompressionStats GetCompressionStats(const std::string& method_full_name);
+
+  // Returns the cache counters of a method registered with
+  // 'RpcHandlerOptions::response_cache'.
+  ResponseCacheStats GetResponseCacheStats(const std::string& method_full_name);
+
  protected:
   Server(const Options& options);
   void AddService(
@@ -193,8 +284,9 @@ class Server {
   Server(const Server&) = delete;
   Server& operator=(const Server&) = delete;
   void RunCompletionQueue(::grpc::ServerCompletionQueue* completion_queue);
-  void RunEventQueue(Rpc::EventQueue* event_queue);
+  void RunEventQueue(Rpc::EventQueue* event_queue, TimerWheel* timer_wheel);
   Rpc::EventQueue* SelectNextEventQueueRoundRobin();
+  TimerWheel* GetTimerWheel(Rpc::EventQueue* event_queue);
 
   Options options_;
 
@@ -204,6 +296,12 @@ class Server {
   ::grpc::ServerBuilder server_builder_;
   std::unique_ptr<::grpc::Server> server_;
 
+  // Channels registered with the 'LocalCallRegistry'. Kept alive until the
+  // server shuts down so that their addresses are not reused.
+  common::Mutex in_process_channels_lock_;
+  std::vector<std::shared_ptr<::grpc::Channel>> in_process_channels_
+      GUARDED_BY(in_process_channels_lock_);
+
   // Threads processing the completion queues.
   std::vector<CompletionQueueThread> completion_queue_threads_;
 
@@ -212,6 +310,9 @@ class Server {
   common::Mutex current_event_queue_id_lock_;
   int current_event_queue_id_ = 0;
 
+  // Runs the CPU-heavy work handlers split off the event threads.
+  std::unique_ptr<WorkerPool> worker_pool_;
+
   // Map of service names to services.
   std::map<std::string, Service> services_;
 
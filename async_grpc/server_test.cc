@@ -16,16 +16,23 @@
 
 #include "async_grpc/server.h"
 
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "async_grpc/async_client.h"
+#include "async_grpc/batching_rpc_handler.h"
+#include "async_grpc/chunked_transfer.h"
 #include "async_grpc/client.h"
 #include "async_grpc/execution_context.h"
+#include "async_grpc/proto/benchmark.pb.h"
 #include "async_grpc/proto/math_service.pb.h"
 #include "async_grpc/retry.h"
 #include "async_grpc/rpc_handler.h"
+#include "async_grpc/shared_payload.h"
 #include "glog/logging.h"
 #include "google/protobuf/descriptor.h"
 #include "grpc++/grpc++.h"
@@ -34,12 +41,33 @@
 namespace async_grpc {
 namespace {
 
+// A message type without protobuf that is sent as its memory representation.
+struct PodVector {
+  double x;
+  double y;
+  double z;
+};
+
+}  // namespace
+}  // namespace async_grpc
+
+namespace grpc {
+template <>
+class SerializationTraits<async_grpc::PodVector>
+    : public async_grpc::PodSerializationTraits<async_grpc::PodVector> {};
+}  // namespace grpc
+
+namespace async_grpc {
+namespace {
+
 using EchoResponder = std::function<bool()>;
 
 class MathServerContext : public ExecutionContext {
  public:
   int additional_increment() { return 10; }
   std::promise<EchoResponder> echo_responder;
+  std::promise<bool> deferred_echo_cancelled;
+  std::promise<bool> idle_echo_cancelled;
 };
 
 struct GetSumMethod {
@@ -67,6 +95,43 @@ class GetSumHandler : public RpcHandler<GetSumMethod> {
   int sum_ = 0;
 };
 
+struct GetBatchedSumMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetBatchedSum";
+  }
+  using IncomingType = Stream<proto::GetSumRequest>;
+  using OutgoingType = proto::GetSumResponse;
+};
+
+constexpr size_t kMaxRequestBatchSize = 10;
+std::atomic<int> num_request_batches(0);
+
+class GetBatchedSumHandler : public RpcHandler<GetBatchedSumMethod> {
+ public:
+  void OnRequest(const proto::GetSumRequest& request) override {
+    LOG(FATAL) << "Requests are delivered in batches.";
+  }
+
+  void OnRequestBatch(
+      const std::vector<const proto::GetSumRequest*>& requests) override {
+    EXPECT_FALSE(requests.empty());
+    EXPECT_LE(requests.size(), kMaxRequestBatchSize);
+    ++num_request_batches;
+    for (const proto::GetSumRequest* request : requests) {
+      sum_ += request->input();
+    }
+  }
+
+  void OnReadsDone() override {
+    auto response = common::make_unique<proto::GetSumResponse>();
+    response->set_output(sum_);
+    Send(std::move(response));
+  }
+
+ private:
+  int sum_ = 0;
+};
+
 struct GetRunningSumMethod {
   static constexpr const char* MethodName() {
     return "/async_grpc.proto.Math/GetRunningSum";
@@ -115,6 +180,177 @@ class GetSquareHandler : public RpcHandler<GetSquareMethod> {
   }
 };
 
+struct GetArenaSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetArenaSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+class GetArenaSquareHandler : public RpcHandler<GetArenaSquareMethod> {
+ public:
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    EXPECT_NE(GetArena(), nullptr);
+    EXPECT_EQ(request.GetArena(), GetArena());
+    auto* response =
+        google::protobuf::Arena::CreateMessage<proto::GetSquareResponse>(
+            GetArena());
+    response->set_output(request.input() * request.input());
+    Send(*response);
+  }
+};
+
+struct GetBatchedSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetBatchedSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+constexpr size_t kMaxSquareBatchSize = 4;
+std::atomic<int> num_square_batches(0);
+
+class GetBatchedSquareHandler
+    : public BatchingRpcHandler<GetBatchedSquareMethod> {
+ public:
+  std::vector<std::unique_ptr<proto::GetSquareResponse>> OnBatch(
+      const std::vector<const proto::GetSquareRequest*>& requests) override {
+    EXPECT_LE(requests.size(), kMaxSquareBatchSize);
+    ++num_square_batches;
+    std::vector<std::unique_ptr<proto::GetSquareResponse>> responses;
+    for (const proto::GetSquareRequest* request : requests) {
+      if (request->input() < 0) {
+        responses.emplace_back();
+        continue;
+      }
+      responses.push_back(common::make_unique<proto::GetSquareResponse>());
+      responses.back()->set_output(request->input() * request->input());
+    }
+    return responses;
+  }
+};
+
+struct GetCoalescedSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetCoalescedSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+std::atomic<int> num_coalesced_square_handlers(0);
+
+// Answers after a delay so that identical calls can attach to it.
+class GetCoalescedSquareHandler
+    : public RpcHandler<GetCoalescedSquareMethod> {
+ public:
+  GetCoalescedSquareHandler() { ++num_coalesced_square_handlers; }
+
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    const int input = request.input();
+    ScheduleAfter(common::FromMilliseconds(200), [this, input]() {
+      if (input < 0) {
+        Finish(::grpc::Status(::grpc::INVALID_ARGUMENT, "negative input"));
+        return;
+      }
+      auto response = common::make_unique<proto::GetSquareResponse>();
+      response->set_output(input * input);
+      Send(std::move(response));
+    });
+  }
+};
+
+struct GetCachedSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetCachedSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+std::atomic<int> num_cached_square_handlers(0);
+
+class GetCachedSquareHandler : public RpcHandler<GetCachedSquareMethod> {
+ public:
+  GetCachedSquareHandler() { ++num_cached_square_handlers; }
+
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    auto response = common::make_unique<proto::GetSquareResponse>();
+    response->set_output(request.input() * request.input());
+    Send(std::move(response));
+  }
+};
+
+struct GetRateLimitedSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetRateLimitedSquare";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+class GetRateLimitedSquareHandler
+    : public RpcHandler<GetRateLimitedSquareMethod> {
+ public:
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    auto response = common::make_unique<proto::GetSquareResponse>();
+    response->set_output(request.input() * request.input());
+    Send(std::move(response));
+  }
+};
+
+struct GetRateLimitedSumMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetRateLimitedSum";
+  }
+  using IncomingType = Stream<proto::GetSumRequest>;
+  using OutgoingType = proto::GetSumResponse;
+};
+
+class GetRateLimitedSumHandler : public RpcHandler<GetRateLimitedSumMethod> {
+ public:
+  void OnRequest(const proto::GetSumRequest& request) override {
+    sum_ += request.input();
+  }
+
+  void OnReadsDone() override {
+    auto response = common::make_unique<proto::GetSumResponse>();
+    response->set_output(sum_);
+    Send(std::move(response));
+  }
+
+ private:
+  int sum_ = 0;
+};
+
+struct GetSumOfSquaresMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetSumOfSquares";
+  }
+  using IncomingType = proto::GetSquareRequest;
+  using OutgoingType = proto::GetSquareResponse;
+};
+
+// Returns the sum of the squares of 1 to 'input'.
+class GetSumOfSquaresHandler : public RpcHandler<GetSumOfSquaresMethod> {
+ public:
+  void OnRequest(const proto::GetSquareRequest& request) override {
+    ParallelFor(request.input(),
+                [](size_t i) { return static_cast<int>((i + 1) * (i + 1)); },
+                [this](std::vector<int> squares) {
+                  auto response =
+                      common::make_unique<proto::GetSquareResponse>();
+                  for (size_t i = 0; i < squares.size(); ++i) {
+                    CHECK_EQ(squares[i], static_cast<int>((i + 1) * (i + 1)));
+                    response->set_output(response->output() + squares[i]);
+                  }
+                  Send(std::move(response));
+                });
+  }
+};
+
 struct GetEchoMethod {
   static constexpr const char* MethodName() {
     return "/async_grpc.proto.Math/GetEcho";
@@ -137,6 +373,47 @@ class GetEchoHandler : public RpcHandler<GetEchoMethod> {
   }
 };
 
+struct GetDeferredEchoMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetDeferredEcho";
+  }
+  using IncomingType = proto::GetEchoRequest;
+  using OutgoingType = proto::GetEchoResponse;
+};
+
+// Never responds, but reports when the client gives up on the call.
+class GetDeferredEchoHandler : public RpcHandler<GetDeferredEchoMethod> {
+ public:
+  void OnRequest(const proto::GetEchoRequest& request) override {}
+
+  void OnCancel() override {
+    GetContext<MathServerContext>()->deferred_echo_cancelled.set_value(
+        GetWriter().IsCancelled());
+  }
+};
+
+struct GetIdleEchoMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetIdleEcho";
+  }
+  using IncomingType = proto::GetEchoRequest;
+  using OutgoingType = proto::GetEchoResponse;
+};
+
+const common::Duration kIdleTimeout = common::FromMilliseconds(100);
+
+// Never responds, so that the server cancels the call once it was idle for
+// 'kIdleTimeout'.
+class GetIdleEchoHandler : public RpcHandler<GetIdleEchoMethod> {
+ public:
+  void OnRequest(const proto::GetEchoRequest& request) override {}
+
+  void OnCancel() override {
+    GetContext<MathServerContext>()->idle_echo_cancelled.set_value(
+        GetWriter().IsCancelled());
+  }
+};
+
 struct GetSequenceMethod {
   static constexpr const char* MethodName() {
     return "/async_grpc.proto.Math/GetSequence";
@@ -157,90 +434,768 @@ class GetSequenceHandler : public RpcHandler<GetSequenceMethod> {
   }
 };
 
-// TODO(cschuet): Due to the hard-coded part these tests will become flaky when
-// run in parallel. It would be nice to find a way to solve that. gRPC also
-// allows to communicate over UNIX domain sockets.
-const std::string kServerAddress = "localhost:50051";
-const std::size_t kNumThreads = 1;
-
-class ServerTest : public ::testing::Test {
- protected:
-  void SetUp() override {
-    Server::Builder server_builder;
-    server_builder.SetServerAddress(kServerAddress);
-    server_builder.SetNumGrpcThreads(kNumThreads);
-    server_builder.SetNumEventThreads(kNumThreads);
-    server_builder.RegisterHandler<GetSumHandler>();
-    server_builder.RegisterHandler<GetSquareHandler>();
-    server_builder.RegisterHandler<GetRunningSumHandler>();
-    server_builder.RegisterHandler<GetEchoHandler>();
-    server_builder.RegisterHandler<GetSequenceHandler>();
-    server_ = server_builder.Build();
+struct GetPacedSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetPacedSequence";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
 
-    client_channel_ = ::grpc::CreateChannel(
-        kServerAddress, ::grpc::InsecureChannelCredentials());
+// Streams the sequence without ever holding more than two undelivered
+// responses.
+class GetPacedSequenceHandler : public RpcHandler<GetPacedSequenceMethod> {
+ public:
+  void Initialize() override {
+    SetSendQueueWaterMarks(2 /* high_water_mark */, 1 /* low_water_mark */);
+  }
 
-    server_->SetExecutionContext(common::make_unique<MathServerContext>());
-    server_->Start();
+  void OnRequest(const proto::GetSequenceRequest& request) override {
+    length_ = request.input();
+    SendUntilFull();
   }
 
-  void TearDown() override {
-    server_->Shutdown();
-    CompletionQueuePool::Shutdown();
+  void OnWritable() override { SendUntilFull(); }
+
+ private:
+  void SendUntilFull() {
+    while (next_ < length_) {
+      auto response = common::make_unique<proto::GetSequenceResponse>();
+      response->set_output(next_);
+      if (!TrySend(&response)) {
+        CHECK(response);
+        return;
+      }
+      ++next_;
+    }
+    Finish(::grpc::Status::OK);
   }
 
-  std::unique_ptr<Server> server_;
-  std::shared_ptr<::grpc::Channel> client_channel_;
+  int length_ = 0;
+  int next_ = 0;
 };
 
-TEST_F(ServerTest, StartAndStopServerTest) {}
-
-TEST_F(ServerTest, ProcessRpcStreamTest) {
-  Client<GetSumMethod> client(client_channel_);
-  for (int i = 0; i < 3; ++i) {
-    proto::GetSumRequest request;
-    request.set_input(i);
-    EXPECT_TRUE(client.Write(request));
+struct GetConflatedSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetConflatedSequence";
   }
-  EXPECT_TRUE(client.StreamWritesDone());
-  EXPECT_TRUE(client.StreamFinish().ok());
-  EXPECT_EQ(client.response().output(), 33);
-}
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
 
-TEST_F(ServerTest, ProcessUnaryRpcTest) {
-  Client<GetSquareMethod> client(client_channel_);
-  proto::GetSquareRequest request;
-  request.set_input(11);
-  EXPECT_TRUE(client.Write(request));
-  EXPECT_EQ(client.response().output(), 121);
-}
+// Conflates the sequence modulo 3. Since all responses are queued before the
+// event thread gets a chance to send any, only the latest value of each
+// residue class reaches the client.
+class GetConflatedSequenceHandler
+    : public RpcHandler<GetConflatedSequenceMethod> {
+ public:
+  void Initialize() override {
+    ConflateResponses([](const proto::GetSequenceResponse& response) {
+      return std::to_string(response.output() % 3);
+    });
+  }
 
-TEST_F(ServerTest, ProcessBidiStreamingRpcTest) {
-  Client<GetRunningSumMethod> client(client_channel_);
-  for (int i = 0; i < 3; ++i) {
-    proto::GetSumRequest request;
-    request.set_input(i);
-    EXPECT_TRUE(client.Write(request));
+  void OnRequest(const proto::GetSequenceRequest& request) override {
+    for (int i = 0; i < request.input(); ++i) {
+      auto response = common::make_unique<proto::GetSequenceResponse>();
+      response->set_output(i);
+      Send(std::move(response));
+    }
+    Finish(::grpc::Status::OK);
   }
-  client.StreamWritesDone();
-  proto::GetSumResponse response;
-  std::list<int> expected_responses = {0, 0, 1, 1, 3, 3};
-  while (client.StreamRead(&response)) {
-    EXPECT_EQ(expected_responses.front(), response.output());
-    expected_responses.pop_front();
+};
+
+struct GetDroppingSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetDroppingSequence";
   }
-  EXPECT_TRUE(expected_responses.empty());
-  EXPECT_TRUE(client.StreamFinish().ok());
-}
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
 
-TEST_F(ServerTest, WriteFromOtherThread) {
-  Server* server = server_.get();
-  std::thread response_thread([server]() {
-    std::future<EchoResponder> responder_future =
-        server->GetContext<MathServerContext>()->echo_responder.get_future();
-    responder_future.wait();
-    auto responder = responder_future.get();
-    CHECK(responder());
+constexpr size_t kMaxQueuedResponses = 3;
+
+// Queues the whole sequence at once, of which only the last
+// 'kMaxQueuedResponses' values reach the client.
+class GetDroppingSequenceHandler
+    : public RpcHandler<GetDroppingSequenceMethod> {
+ public:
+  void Initialize() override { DropOldestResponses(kMaxQueuedResponses); }
+
+  void OnRequest(const proto::GetSequenceRequest& request) override {
+    for (int i = 0; i < request.input(); ++i) {
+      auto response = common::make_unique<proto::GetSequenceResponse>();
+      response->set_output(i);
+      Send(std::move(response));
+    }
+    Finish(::grpc::Status::OK);
+  }
+};
+
+struct GetDisconnectingSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetDisconnectingSequence";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
+
+// Queues the whole sequence at once, which fails the call once more than
+// 'kMaxQueuedResponses' values wait to be sent.
+class GetDisconnectingSequenceHandler
+    : public RpcHandler<GetDisconnectingSequenceMethod> {
+ public:
+  void Initialize() override { DisconnectSlowConsumer(kMaxQueuedResponses); }
+
+  void OnRequest(const proto::GetSequenceRequest& request) override {
+    for (int i = 0; i < request.input(); ++i) {
+      auto response = common::make_unique<proto::GetSequenceResponse>();
+      response->set_output(i);
+      Send(std::move(response));
+    }
+    Finish(::grpc::Status::OK);
+  }
+};
+
+struct GetReplicatedSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Math/GetReplicatedSequence";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
+
+// Sends the same response 'input' times but serializes it only once.
+class GetReplicatedSequenceHandler
+    : public RpcHandler<GetReplicatedSequenceMethod> {
+ public:
+  void OnRequest(const proto::GetSequenceRequest& request) override {
+    proto::GetSequenceResponse response;
+    response.set_output(request.input());
+    const ::grpc::ByteBuffer serialized_response = SerializeResponse(response);
+    for (int i = 0; i < request.input(); ++i) {
+      SendSerialized(serialized_response);
+    }
+    Finish(::grpc::Status::OK);
+  }
+};
+
+// Methods with other codecs need not be defined in any proto.
+struct ScalePodVectorMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.PodMath/Scale";
+  }
+  using IncomingType = PodVector;
+  using OutgoingType = PodVector;
+};
+
+class ScalePodVectorHandler : public RpcHandler<ScalePodVectorMethod> {
+ public:
+  void OnRequest(const PodVector& request) override {
+    Send(common::make_unique<PodVector>(
+        PodVector{2. * request.x, 2. * request.y, 2. * request.z}));
+  }
+};
+
+struct GetSharedSquareMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.SharedMath/GetSquare";
+  }
+  using IncomingType = SharedPayload<proto::GetSquareRequest>;
+  using OutgoingType = SharedPayload<proto::GetSquareResponse>;
+};
+
+class GetSharedSquareHandler : public RpcHandler<GetSharedSquareMethod> {
+ public:
+  void OnRequest(
+      const SharedPayload<proto::GetSquareRequest>& request) override {
+    EXPECT_TRUE(request.allow_shared_memory);
+    auto response =
+        common::make_unique<SharedPayload<proto::GetSquareResponse>>();
+    response->message.set_output(request.message.input() *
+                                 request.message.input());
+    Send(std::move(response));
+  }
+};
+
+// Raw methods need not be defined in any proto.
+struct RawEchoMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.RawEcho/Echo";
+  }
+  using IncomingType = Stream<::grpc::ByteBuffer>;
+  using OutgoingType = Stream<::grpc::ByteBuffer>;
+};
+
+class RawEchoHandler : public RawRpcHandler<RawEchoMethod> {
+ public:
+  void OnRequest(const ::grpc::ByteBuffer& request) override {
+    Send(request);
+  }
+
+  void OnReadsDone() override { Finish(::grpc::Status::OK); }
+};
+
+// The client side of 'RawEchoMethod' sends and receives proto messages.
+struct RawEchoClientMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.RawEcho/Echo";
+  }
+  using IncomingType = Stream<proto::GetSumRequest>;
+  using OutgoingType = Stream<proto::GetSumRequest>;
+};
+
+proto::PointCloud MakePointCloud(int num_points) {
+  proto::PointCloud point_cloud;
+  for (int i = 0; i < num_points; ++i) {
+    point_cloud.add_intensities(i);
+  }
+  return point_cloud;
+}
+
+// Sends a point cloud with as many points as requested in chunks of 1 kB,
+// holding at most two undelivered chunks.
+struct GetChunkedPointCloudMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Chunked/GetPointCloud";
+  }
+  using IncomingType = ::grpc::ByteBuffer;
+  using OutgoingType = Stream<::grpc::ByteBuffer>;
+};
+
+class GetChunkedPointCloudHandler
+    : public RawRpcHandler<GetChunkedPointCloudMethod> {
+ public:
+  void OnRequest(const ::grpc::ByteBuffer& request) override {
+    SetSendQueueWaterMarks(2 /* high_water_mark */, 1 /* low_water_mark */);
+    ::grpc::ByteBuffer buffer(request);
+    proto::GetSequenceRequest sequence_request;
+    CHECK(::grpc::SerializationTraits<google::protobuf::Message>::Deserialize(
+              &buffer, &sequence_request)
+              .ok());
+    writer_ = common::make_unique<ChunkedMessageWriter>(
+        MakePointCloud(sequence_request.input()), 1024 /* chunk_size */);
+    OnWritable();
+  }
+
+  void OnWritable() override {
+    if (writer_->WriteChunks(
+            [this](::grpc::ByteBuffer* chunk) { return TrySend(chunk); })) {
+      Finish(::grpc::Status::OK);
+    }
+  }
+
+ private:
+  std::unique_ptr<ChunkedMessageWriter> writer_;
+};
+
+struct GetChunkedPointCloudClientMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Chunked/GetPointCloud";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<::grpc::ByteBuffer>;
+};
+
+// Reassembles chunked point clouds and responds with the number of points.
+struct CountChunkedPointCloudsMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Chunked/CountPoints";
+  }
+  using IncomingType = Stream<::grpc::ByteBuffer>;
+  using OutgoingType = ::grpc::ByteBuffer;
+};
+
+class CountChunkedPointCloudsHandler
+    : public RawRpcHandler<CountChunkedPointCloudsMethod> {
+ public:
+  void OnRequest(const ::grpc::ByteBuffer& request) override {
+    CHECK(reader_.AddChunk(request).ok());
+    if (reader_.HasMessage()) {
+      proto::PointCloud point_cloud;
+      CHECK(reader_.TakeMessage(&point_cloud).ok());
+      num_points_ += point_cloud.intensities_size();
+    }
+  }
+
+  void OnReadsDone() override {
+    proto::GetSumResponse response;
+    response.set_output(num_points_);
+    ::grpc::ByteBuffer buffer;
+    bool own_buffer;
+    CHECK(::grpc::SerializationTraits<google::protobuf::Message>::Serialize(
+              response, &buffer, &own_buffer)
+              .ok());
+    Send(std::move(buffer));
+  }
+
+ private:
+  ChunkedMessageReader reader_;
+  int num_points_ = 0;
+};
+
+struct CountChunkedPointCloudsClientMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Chunked/CountPoints";
+  }
+  using IncomingType = Stream<::grpc::ByteBuffer>;
+  using OutgoingType = proto::GetSumResponse;
+};
+
+// Sends one response every 20 ms, using timers instead of blocking the event
+// thread.
+struct GetTickingSequenceMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Timer/GetTickingSequence";
+  }
+  using IncomingType = ::grpc::ByteBuffer;
+  using OutgoingType = Stream<::grpc::ByteBuffer>;
+};
+
+std::atomic<int> num_timers_after_finish(0);
+
+class GetTickingSequenceHandler
+    : public RawRpcHandler<GetTickingSequenceMethod> {
+ public:
+  void OnRequest(const ::grpc::ByteBuffer& request) override {
+    ::grpc::ByteBuffer buffer(request);
+    proto::GetSequenceRequest sequence_request;
+    CHECK(::grpc::SerializationTraits<google::protobuf::Message>::Deserialize(
+              &buffer, &sequence_request)
+              .ok());
+    length_ = sequence_request.input();
+    start_ = std::chrono::steady_clock::now();
+    ScheduleAfter(common::FromMilliseconds(20), [this]() { Tick(); });
+  }
+
+ private:
+  void Tick() {
+    proto::GetSequenceResponse response;
+    response.set_output(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+    ::grpc::ByteBuffer buffer;
+    bool own_buffer;
+    CHECK(::grpc::SerializationTraits<google::protobuf::Message>::Serialize(
+              response, &buffer, &own_buffer)
+              .ok());
+    Send(std::move(buffer));
+    if (++num_sent_ < length_) {
+      ScheduleAfter(common::FromMilliseconds(20), [this]() { Tick(); });
+      return;
+    }
+    // Dropped since the call is finished by then.
+    ScheduleAfter(common::Duration::zero(),
+                  []() { ++num_timers_after_finish; });
+    Finish(::grpc::Status::OK);
+  }
+
+  std::chrono::steady_clock::time_point start_;
+  int length_ = 0;
+  int num_sent_ = 0;
+};
+
+struct GetTickingSequenceClientMethod {
+  static constexpr const char* MethodName() {
+    return "/async_grpc.proto.Timer/GetTickingSequence";
+  }
+  using IncomingType = proto::GetSequenceRequest;
+  using OutgoingType = Stream<proto::GetSequenceResponse>;
+};
+
+// TODO(cschuet): Due to the hard-coded part these tests will become flaky when
+// run in parallel. It would be nice to find a way to solve that. gRPC also
+// allows to communicate over UNIX domain sockets.
+const std::string kServerAddress = "localhost:50051";
+const std::string kUnixServerAddress = "unix:/tmp/async_grpc_server_test.sock";
+const std::size_t kNumThreads = 1;
+const std::size_t kNumWorkerThreads = 4;
+
+class ServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    Server::Builder server_builder;
+    server_builder.SetServerAddress(kServerAddress);
+    server_builder.AddServerAddress(kUnixServerAddress);
+    server_builder.SetNumGrpcThreads(kNumThreads);
+    server_builder.SetNumEventThreads(kNumThreads);
+    server_builder.SetNumWorkerThreads(kNumWorkerThreads);
+    server_builder.RegisterHandler<GetSumHandler>();
+    RpcHandlerOptions compression_options;
+    compression_options.compression.algorithms = {GRPC_COMPRESS_GZIP};
+    compression_options.compression.min_message_size = 0;
+    server_builder.RegisterHandler<GetSquareHandler>(compression_options);
+    RpcHandlerOptions arena_options;
+    arena_options.use_arena = true;
+    server_builder.RegisterHandler<GetArenaSquareHandler>(arena_options);
+    RpcHandlerOptions batch_options;
+    batch_options.max_request_batch_size = kMaxRequestBatchSize;
+    batch_options.request_batch_window = common::FromMilliseconds(20);
+    server_builder.RegisterHandler<GetBatchedSumHandler>(batch_options);
+    RpcHandlerOptions unary_batch_options;
+    unary_batch_options.max_request_batch_size = kMaxSquareBatchSize;
+    unary_batch_options.request_batch_window = common::FromMilliseconds(100);
+    server_builder.RegisterHandler<GetBatchedSquareHandler>(
+        unary_batch_options);
+    RpcHandlerOptions coalescing_options;
+    coalescing_options.coalesce_identical_requests = true;
+    server_builder.RegisterHandler<GetCoalescedSquareHandler>(
+        coalescing_options);
+    RpcHandlerOptions caching_options;
+    caching_options.response_cache.max_bytes = 1 << 20;
+    server_builder.RegisterHandler<GetCachedSquareHandler>(caching_options);
+    RpcHandlerOptions call_rate_limit_options;
+    call_rate_limit_options.rate_limit.calls.tokens_per_second = 1.;
+    call_rate_limit_options.rate_limit.calls.burst = 2.;
+    server_builder.RegisterHandler<GetRateLimitedSquareHandler>(
+        call_rate_limit_options);
+    RpcHandlerOptions message_rate_limit_options;
+    message_rate_limit_options.rate_limit.messages.tokens_per_second = 20.;
+    message_rate_limit_options.rate_limit.messages.burst = 1.;
+    server_builder.RegisterHandler<GetRateLimitedSumHandler>(
+        message_rate_limit_options);
+    server_builder.RegisterHandler<GetSumOfSquaresHandler>();
+    server_builder.RegisterHandler<GetRunningSumHandler>();
+    server_builder.RegisterHandler<GetEchoHandler>();
+    server_builder.RegisterHandler<GetDeferredEchoHandler>();
+    RpcHandlerOptions idle_timeout_options;
+    idle_timeout_options.idle_timeout = kIdleTimeout;
+    server_builder.RegisterHandler<GetIdleEchoHandler>(idle_timeout_options);
+    server_builder.RegisterHandler<GetSequenceHandler>(compression_options);
+    server_builder.RegisterHandler<GetPacedSequenceHandler>();
+    server_builder.RegisterHandler<GetConflatedSequenceHandler>();
+    server_builder.RegisterHandler<GetDroppingSequenceHandler>();
+    server_builder.RegisterHandler<GetDisconnectingSequenceHandler>();
+    server_builder.RegisterHandler<GetReplicatedSequenceHandler>();
+    server_builder.RegisterHandler<ScalePodVectorHandler>();
+    server_builder.RegisterHandler<RawEchoHandler>();
+    server_builder.RegisterHandler<GetSharedSquareHandler>();
+    server_builder.RegisterHandler<GetChunkedPointCloudHandler>();
+    server_builder.RegisterHandler<CountChunkedPointCloudsHandler>();
+    server_builder.RegisterHandler<GetTickingSequenceHandler>();
+    server_builder.EnableInProcessBypass();
+    server_ = server_builder.Build();
+
+    client_channel_ = ::grpc::CreateChannel(
+        kServerAddress, ::grpc::InsecureChannelCredentials());
+
+    server_->SetExecutionContext(common::make_unique<MathServerContext>());
+    server_->Start();
+  }
+
+  void TearDown() override {
+    server_->Shutdown();
+    CompletionQueuePool::Shutdown();
+  }
+
+  std::unique_ptr<Server> server_;
+  std::shared_ptr<::grpc::Channel> client_channel_;
+};
+
+TEST_F(ServerTest, StartAndStopServerTest) {}
+
+TEST_F(ServerTest, ProcessRpcStreamTest) {
+  Client<GetSumMethod> client(client_channel_);
+  for (int i = 0; i < 3; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 33);
+}
+
+TEST_F(ServerTest, ProcessBatchedRpcStreamTest) {
+  num_request_batches = 0;
+  Client<GetBatchedSumMethod> client(client_channel_);
+  for (int i = 0; i < 1000; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 999 * 1000 / 2);
+  EXPECT_GE(num_request_batches, 1000 / kMaxRequestBatchSize);
+}
+
+TEST_F(ServerTest, ProcessBatchedRpcStreamWindowTest) {
+  num_request_batches = 0;
+  Client<GetBatchedSumMethod> client(client_channel_);
+  proto::GetSumRequest request;
+  request.set_input(1);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(client.Write(request));
+  }
+  // The window closes and delivers the first three requests.
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_EQ(num_request_batches, 1);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 4);
+  EXPECT_EQ(num_request_batches, 2);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcTest) {
+  Client<GetSquareMethod> client(client_channel_);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcOverUnixSocketTest) {
+  Client<GetSquareMethod> client(::grpc::CreateChannel(
+      kUnixServerAddress, ::grpc::InsecureChannelCredentials()));
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcWithArenaTest) {
+  Client<GetArenaSquareMethod> client(client_channel_);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+}
+
+TEST_F(ServerTest, ProcessBatchedUnaryRpcsTest) {
+  num_square_batches = 0;
+  std::vector<std::future<int>> outputs;
+  for (int i = 0; i < 10; ++i) {
+    outputs.push_back(std::async(std::launch::async, [this, i]() {
+      Client<GetBatchedSquareMethod> client(client_channel_);
+      proto::GetSquareRequest request;
+      request.set_input(i);
+      EXPECT_TRUE(client.Write(request));
+      return client.response().output();
+    }));
+  }
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(outputs[i].get(), i * i);
+  }
+  EXPECT_GE(num_square_batches, 3);
+  EXPECT_LT(num_square_batches, 10);
+}
+
+TEST_F(ServerTest, BatchedUnaryRpcWindowTest) {
+  num_square_batches = 0;
+  Client<GetBatchedSquareMethod> client(client_channel_);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+  EXPECT_EQ(num_square_batches, 1);
+
+  Client<GetBatchedSquareMethod> failing_client(client_channel_);
+  request.set_input(-1);
+  ::grpc::Status status;
+  EXPECT_FALSE(failing_client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::INTERNAL);
+}
+
+TEST_F(ServerTest, CoalesceIdenticalUnaryRpcsTest) {
+  num_coalesced_square_handlers = 0;
+  // Half of the calls carry the same request, the others one that fails.
+  std::vector<std::future<std::pair<::grpc::Status, int>>> results;
+  for (int i = 0; i < 10; ++i) {
+    const int input = i % 2 == 0 ? 11 : -1;
+    results.push_back(std::async(std::launch::async, [this, input]() {
+      Client<GetCoalescedSquareMethod> client(client_channel_);
+      proto::GetSquareRequest request;
+      request.set_input(input);
+      ::grpc::Status status;
+      client.Write(request, &status);
+      return std::make_pair(status, client.response().output());
+    }));
+  }
+  for (int i = 0; i < 10; ++i) {
+    const auto result = results[i].get();
+    if (i % 2 == 0) {
+      EXPECT_TRUE(result.first.ok());
+      EXPECT_EQ(result.second, 121);
+    } else {
+      EXPECT_EQ(result.first.error_code(), ::grpc::INVALID_ARGUMENT);
+    }
+  }
+  EXPECT_GE(num_coalesced_square_handlers, 2);
+  EXPECT_LT(num_coalesced_square_handlers, 10);
+}
+
+TEST_F(ServerTest, RejectCallsOverRateLimitTest) {
+  // The burst admits two calls, the next token is a second away.
+  for (int i = 0; i < 2; ++i) {
+    Client<GetRateLimitedSquareMethod> client(client_channel_);
+    proto::GetSquareRequest request;
+    request.set_input(11);
+    EXPECT_TRUE(client.Write(request));
+    EXPECT_EQ(client.response().output(), 121);
+  }
+  Client<GetRateLimitedSquareMethod> client(client_channel_);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  ::grpc::Status status;
+  EXPECT_FALSE(client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::RESOURCE_EXHAUSTED);
+}
+
+TEST_F(ServerTest, DelayReadsOverRateLimitTest) {
+  const auto start = std::chrono::steady_clock::now();
+  Client<GetRateLimitedSumMethod> client(client_channel_);
+  for (int i = 0; i < 5; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 10);
+  // Reads after the first one wait 50 ms each for their token.
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(150));
+}
+
+TEST_F(ServerTest, PromoteFollowerOfCancelledCoalescedRpcTest) {
+  num_coalesced_square_handlers = 0;
+  // The leader's deadline expires before its handler answers.
+  auto leader = std::async(std::launch::async, [this]() {
+    Client<GetCoalescedSquareMethod> client(client_channel_,
+                                            common::FromMilliseconds(50));
+    proto::GetSquareRequest request;
+    request.set_input(12);
+    ::grpc::Status status;
+    EXPECT_FALSE(client.Write(request, &status));
+    return status.error_code();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  std::vector<std::future<int>> outputs;
+  for (int i = 0; i < 3; ++i) {
+    outputs.push_back(std::async(std::launch::async, [this]() {
+      Client<GetCoalescedSquareMethod> client(client_channel_);
+      proto::GetSquareRequest request;
+      request.set_input(12);
+      EXPECT_TRUE(client.Write(request));
+      return client.response().output();
+    }));
+  }
+  EXPECT_EQ(leader.get(), ::grpc::DEADLINE_EXCEEDED);
+  for (auto& output : outputs) {
+    EXPECT_EQ(output.get(), 144);
+  }
+  // One follower took over and ran the handler a second time.
+  EXPECT_EQ(num_coalesced_square_handlers, 2);
+}
+
+TEST_F(ServerTest, AnswerUnaryRpcsFromResponseCacheTest) {
+  num_cached_square_handlers = 0;
+  const auto get_cached_square = [this](int input) {
+    Client<GetCachedSquareMethod> client(client_channel_);
+    proto::GetSquareRequest request;
+    request.set_input(input);
+    EXPECT_TRUE(client.Write(request));
+    return client.response().output();
+  };
+  EXPECT_EQ(get_cached_square(11), 121);
+  EXPECT_EQ(get_cached_square(11), 121);
+  EXPECT_EQ(get_cached_square(12), 144);
+  EXPECT_EQ(num_cached_square_handlers, 2);
+  ResponseCacheStats stats = server_->GetResponseCacheStats(
+      "/async_grpc.proto.Math/GetCachedSquare");
+  EXPECT_EQ(stats.num_hits, 1);
+  EXPECT_EQ(stats.num_misses, 2);
+  EXPECT_EQ(stats.num_entries, 2);
+
+  server_->GetUnsynchronizedContext<MathServerContext>()
+      ->InvalidateResponseCaches();
+  EXPECT_EQ(get_cached_square(11), 121);
+  EXPECT_EQ(num_cached_square_handlers, 3);
+  stats = server_->GetResponseCacheStats(
+      "/async_grpc.proto.Math/GetCachedSquare");
+  EXPECT_EQ(stats.num_misses, 3);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcOnWorkerThreadsTest) {
+  for (int input : {0, 1, 3, 100}) {
+    Client<GetSumOfSquaresMethod> client(client_channel_);
+    proto::GetSquareRequest request;
+    request.set_input(input);
+    EXPECT_TRUE(client.Write(request));
+    EXPECT_EQ(client.response().output(),
+              input * (input + 1) * (2 * input + 1) / 6);
+  }
+}
+
+TEST_F(ServerTest, ProcessBidiStreamingRpcTest) {
+  Client<GetRunningSumMethod> client(client_channel_);
+  for (int i = 0; i < 3; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  client.StreamWritesDone();
+  proto::GetSumResponse response;
+  std::list<int> expected_responses = {0, 0, 1, 1, 3, 3};
+  while (client.StreamRead(&response)) {
+    EXPECT_EQ(expected_responses.front(), response.output());
+    expected_responses.pop_front();
+  }
+  EXPECT_TRUE(expected_responses.empty());
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcWithPodCodecTest) {
+  Client<ScalePodVectorMethod> client(client_channel_);
+  EXPECT_TRUE(client.Write(PodVector{1., 2., 3.}));
+  EXPECT_EQ(client.response().x, 2.);
+  EXPECT_EQ(client.response().y, 4.);
+  EXPECT_EQ(client.response().z, 6.);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcWithSharedPayloadTest) {
+  SharedMemoryOptions options;
+  options.threshold = 0;
+  SharedMemoryTransport::Enable(options);
+  Client<GetSharedSquareMethod> client(client_channel_);
+  SharedPayload<proto::GetSquareRequest> request;
+  request.message.set_input(11);
+  request.allow_shared_memory = true;
+  EXPECT_TRUE(client.Write(request));
+  // The client connected through the loopback interface.
+  EXPECT_TRUE(client.response().allow_shared_memory);
+  EXPECT_EQ(client.response().message.output(), 121);
+}
+
+TEST_F(ServerTest, ProcessRawBidiStreamingRpcTest) {
+  Client<RawEchoClientMethod> client(client_channel_);
+  for (int i = 0; i < 3; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  client.StreamWritesDone();
+  proto::GetSumRequest response;
+  std::list<int> expected_responses = {0, 1, 2};
+  while (client.StreamRead(&response)) {
+    EXPECT_EQ(expected_responses.front(), response.input());
+    expected_responses.pop_front();
+  }
+  EXPECT_TRUE(expected_responses.empty());
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, WriteFromOtherThread) {
+  Server* server = server_.get();
+  std::thread response_thread([server]() {
+    std::future<EchoResponder> responder_future =
+        server->GetContext<MathServerContext>()->echo_responder.get_future();
+    responder_future.wait();
+    auto responder = responder_future.get();
+    CHECK(responder());
   });
 
   Client<GetEchoMethod> client(client_channel_);
@@ -251,6 +1206,72 @@ TEST_F(ServerTest, WriteFromOtherThread) {
   EXPECT_EQ(client.response().output(), 13);
 }
 
+TEST_F(ServerTest, CancellationReachesHandler) {
+  std::future<bool> cancelled_future =
+      server_->GetContext<MathServerContext>()
+          ->deferred_echo_cancelled.get_future();
+  Client<GetDeferredEchoMethod> client(client_channel_,
+                                       common::FromSeconds(0.1));
+  proto::GetEchoRequest request;
+  ::grpc::Status status;
+  EXPECT_FALSE(client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::DEADLINE_EXCEEDED);
+  ASSERT_EQ(cancelled_future.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_TRUE(cancelled_future.get());
+}
+
+TEST_F(ServerTest, CancelIdleRpcTest) {
+  std::future<bool> cancelled_future =
+      server_->GetContext<MathServerContext>()
+          ->idle_echo_cancelled.get_future();
+  EXPECT_EQ(server_->GetNumReapedIdleRpcs(), 0);
+  Client<GetIdleEchoMethod> client(client_channel_);
+  proto::GetEchoRequest request;
+  ::grpc::Status status;
+  EXPECT_FALSE(client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::CANCELLED);
+  ASSERT_EQ(cancelled_future.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_TRUE(cancelled_future.get());
+  EXPECT_EQ(server_->GetNumReapedIdleRpcs(), 1);
+}
+
+TEST_F(ServerTest, ProcessUnaryRpcWithCompressionTest) {
+  CompressionOptions options;
+  options.algorithms = {GRPC_COMPRESS_DEFLATE};
+  options.min_message_size = 0;
+  auto compressor = CreateCompressor(options);
+  Client<GetSquareMethod> client(client_channel_);
+  client.SetCompressor(compressor);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+  EXPECT_EQ(compressor->GetStats().num_compressed_messages, 1);
+  EXPECT_EQ(server_->GetCompressionStats(GetSquareMethod::MethodName())
+                .num_compressed_messages,
+            1);
+}
+
+TEST_F(ServerTest, ProcessServerStreamingRpcWithCompressionTest) {
+  Client<GetSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(12);
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int i = 0; i < 12; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), i);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+  const CompressionStats stats =
+      server_->GetCompressionStats(GetSequenceMethod::MethodName());
+  EXPECT_EQ(stats.num_compressed_messages, 12);
+  EXPECT_EQ(stats.num_uncompressed_messages, 0);
+}
+
 TEST_F(ServerTest, ProcessServerStreamingRpcTest) {
   Client<GetSequenceMethod> client(client_channel_);
   proto::GetSequenceRequest request;
@@ -266,6 +1287,123 @@ TEST_F(ServerTest, ProcessServerStreamingRpcTest) {
   EXPECT_TRUE(client.StreamFinish().ok());
 }
 
+TEST_F(ServerTest, ProcessPreSerializedServerStreamingRpcTest) {
+  Client<GetReplicatedSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(5);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), 5);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, ProcessPacedServerStreamingRpcTest) {
+  Client<GetPacedSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(20);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), i);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, ProcessConflatedServerStreamingRpcTest) {
+  Client<GetConflatedSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(10);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int expected_output : {9, 7, 8}) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), expected_output);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, DropOldestResponsesOfServerStreamingRpcTest) {
+  Client<GetDroppingSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(10);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int expected_output : {7, 8, 9}) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), expected_output);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, DisconnectSlowConsumerOfServerStreamingRpcTest) {
+  Client<GetDisconnectingSequenceMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(10);
+
+  client.Write(request);
+  // The queued responses are discarded along with the call.
+  proto::GetSequenceResponse response;
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_EQ(client.StreamFinish().error_code(), ::grpc::RESOURCE_EXHAUSTED);
+}
+
+TEST_F(ServerTest, ProcessChunkedServerStreamingRpcTest) {
+  Client<GetChunkedPointCloudClientMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(10000);
+
+  client.Write(request);
+  proto::PointCloud point_cloud;
+  EXPECT_TRUE(ReadChunkedMessage(&client, &point_cloud).ok());
+  EXPECT_EQ(point_cloud.SerializeAsString(),
+            MakePointCloud(10000).SerializeAsString());
+  ::grpc::ByteBuffer chunk;
+  EXPECT_FALSE(client.StreamRead(&chunk));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, ProcessChunkedClientStreamingRpcTest) {
+  Client<CountChunkedPointCloudsClientMethod> client(client_channel_);
+  EXPECT_TRUE(WriteChunkedMessage(&client, MakePointCloud(10000),
+                                  1024 /* chunk_size */));
+  EXPECT_TRUE(WriteChunkedMessage(&client, MakePointCloud(0)));
+  EXPECT_TRUE(WriteChunkedMessage(&client, MakePointCloud(5)));
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 10005);
+}
+
+TEST_F(ServerTest, ScheduleAfterTest) {
+  Client<GetTickingSequenceClientMethod> client(client_channel_);
+  proto::GetSequenceRequest request;
+  request.set_input(3);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int i = 1; i <= 3; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    // The event thread wakes up for timers with a resolution of 10 ms.
+    EXPECT_GE(response.output(), 20 * i);
+    EXPECT_LT(response.output(), 20 * i + 100);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(num_timers_after_finish, 0);
+}
+
 TEST_F(ServerTest, RetryWithUnrecoverableError) {
   Client<GetSquareMethod> client(
       client_channel_, common::FromSeconds(5),
@@ -334,5 +1472,154 @@ TEST_F(ServerTest, AsyncClientServerStreaming) {
   cv.wait(lock, [&done] { return done; });
 }
 
+TEST_F(ServerTest, AsyncClientServerStreamingDeletedByFinalCallback) {
+  std::mutex m;
+  std::condition_variable cv;
+  bool done = false;
+
+  std::unique_ptr<AsyncClient<GetSequenceMethod>> async_client;
+  async_client = common::make_unique<AsyncClient<GetSequenceMethod>>(
+      client_channel_,
+      [&done, &m, &cv, &async_client](
+          const ::grpc::Status& status,
+          const proto::GetSequenceResponse* response) {
+        EXPECT_TRUE(status.ok());
+        if (!response) {
+          async_client.reset();
+          {
+            std::lock_guard<std::mutex> lock(m);
+            done = true;
+          }
+          cv.notify_all();
+        }
+      });
+  proto::GetSequenceRequest request;
+  request.set_input(3);
+  async_client->WriteAsync(request);
+
+  std::unique_lock<std::mutex> lock(m);
+  cv.wait(lock, [&done] { return done; });
+}
+
+TEST_F(ServerTest, InProcessBypassUnaryRpcTest) {
+  std::shared_ptr<::grpc::Channel> channel = server_->InProcessChannel();
+  EXPECT_TRUE(LocalCallRegistry::IsRegistered(channel.get()));
+  Client<GetSquareMethod> client(channel);
+  proto::GetSquareRequest request;
+  request.set_input(11);
+  EXPECT_TRUE(client.Write(request));
+  EXPECT_EQ(client.response().output(), 121);
+
+  request.set_input(-11);
+  ::grpc::Status status;
+  EXPECT_FALSE(client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::INTERNAL);
+}
+
+TEST_F(ServerTest, InProcessBypassBatchedRpcStreamTest) {
+  Client<GetBatchedSumMethod> client(server_->InProcessChannel());
+  for (int i = 0; i < 100; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(client.Write(request));
+  }
+  EXPECT_TRUE(client.StreamWritesDone());
+  EXPECT_TRUE(client.StreamFinish().ok());
+  EXPECT_EQ(client.response().output(), 99 * 100 / 2);
+}
+
+TEST_F(ServerTest, InProcessBypassStreamingRpcTest) {
+  std::shared_ptr<::grpc::Channel> channel = server_->InProcessChannel();
+  Client<GetSumMethod> sum_client(channel);
+  Client<GetRunningSumMethod> running_sum_client(channel);
+  for (int i = 0; i < 3; ++i) {
+    proto::GetSumRequest request;
+    request.set_input(i);
+    EXPECT_TRUE(sum_client.Write(request));
+    EXPECT_TRUE(running_sum_client.Write(request));
+  }
+  EXPECT_TRUE(sum_client.StreamWritesDone());
+  EXPECT_TRUE(sum_client.StreamFinish().ok());
+  EXPECT_EQ(sum_client.response().output(), 33);
+
+  running_sum_client.StreamWritesDone();
+  proto::GetSumResponse response;
+  std::list<int> expected_responses = {0, 0, 1, 1, 3, 3};
+  while (running_sum_client.StreamRead(&response)) {
+    EXPECT_EQ(expected_responses.front(), response.output());
+    expected_responses.pop_front();
+  }
+  EXPECT_TRUE(expected_responses.empty());
+  EXPECT_TRUE(running_sum_client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, InProcessBypassServerStreamingRpcTest) {
+  std::shared_ptr<::grpc::Channel> channel = server_->InProcessChannel();
+  // Serialized responses are parsed for the client.
+  Client<GetReplicatedSequenceMethod> client(channel);
+  proto::GetSequenceRequest request;
+  request.set_input(20);
+
+  client.Write(request);
+  proto::GetSequenceResponse response;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(client.StreamRead(&response));
+    EXPECT_EQ(response.output(), 20);
+  }
+  EXPECT_FALSE(client.StreamRead(&response));
+  EXPECT_TRUE(client.StreamFinish().ok());
+}
+
+TEST_F(ServerTest, InProcessBypassCancellationReachesHandler) {
+  std::future<bool> cancelled_future =
+      server_->GetContext<MathServerContext>()
+          ->deferred_echo_cancelled.get_future();
+  Client<GetDeferredEchoMethod> client(server_->InProcessChannel(),
+                                       common::FromSeconds(0.1));
+  proto::GetEchoRequest request;
+  ::grpc::Status status;
+  EXPECT_FALSE(client.Write(request, &status));
+  EXPECT_EQ(status.error_code(), ::grpc::DEADLINE_EXCEEDED);
+  ASSERT_EQ(cancelled_future.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_TRUE(cancelled_future.get());
+}
+
+TEST_F(ServerTest, InProcessBypassAsyncClientServerStreaming) {
+  std::mutex m;
+  std::condition_variable cv;
+  bool done = false;
+  int counter = 0;
+
+  AsyncClient<GetSequenceMethod> async_client(
+      server_->InProcessChannel(),
+      [&done, &m, &cv, &counter](const ::grpc::Status& status,
+                                 const proto::GetSequenceResponse* response) {
+        EXPECT_TRUE(status.ok());
+        if (!response) {
+          {
+            std::lock_guard<std::mutex> lock(m);
+            done = true;
+          }
+          cv.notify_all();
+        } else {
+          EXPECT_EQ(response->output(), counter++);
+        }
+      });
+  proto::GetSequenceRequest request;
+  request.set_input(10);
+  async_client.WriteAsync(request);
+
+  std::unique_lock<std::mutex> lock(m);
+  cv.wait(lock, [&done] { return done; });
+  EXPECT_EQ(counter, 10);
+}
+
+TEST_F(ServerTest, InProcessBypassFallsBackForOtherCodecs) {
+  Client<ScalePodVectorMethod> client(server_->InProcessChannel());
+  EXPECT_TRUE(client.Write(PodVector{1., 2., 3.}));
+  EXPECT_EQ(client.response().z, 6.);
+}
+
 }  // namespace
 }  // namespace async_grpc
@@ -16,7 +16,9 @@
 
 #include "async_grpc/server.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <iterator>
 
 #include "glog/logging.h"
 #include "grpc++/impl/codegen/proto_utils.h"
@@ -25,9 +27,14 @@ namespace async_grpc {
 
 Service::Service(const std::string& service_name,
                  const std::map<std::string, RpcHandlerInfo>& rpc_handler_infos,
-                 EventQueueSelector event_queue_selector)
+                 EventQueueSelector event_queue_selector,
+                 TimerWheelSelector timer_wheel_selector,
+                 WorkerPool* const worker_pool)
     : rpc_handler_infos_(rpc_handler_infos),
-      event_queue_selector_(event_queue_selector) {
+      event_queue_selector_(event_queue_selector),
+      timer_wheel_selector_(timer_wheel_selector),
+      worker_pool_(worker_pool),
+      num_reaped_idle_rpcs_(0) {
   for (const auto& rpc_handler_info : rpc_handler_infos_) {
     // The 'handler' below is set to 'nullptr' indicating that we want to
     // handle this method asynchronously.
@@ -40,10 +47,14 @@ Service::Service(const std::string& service_name,
 void Service::StartServing(
     std::vector<CompletionQueueThread>& completion_queue_threads,
     ExecutionContext* execution_context) {
+  // Local calls only use the completion queue for alarms.
+  local_completion_queue_ =
+      completion_queue_threads.front().completion_queue();
+  execution_context_ = execution_context;
   int i = 0;
   for (const auto& rpc_handler_info : rpc_handler_infos_) {
     for (auto& completion_queue_thread : completion_queue_threads) {
-      std::shared_ptr<Rpc> rpc = active_rpcs_.Add(common::make_unique<Rpc>(
+      std::shared_ptr<Rpc> rpc = active_rpcs_.Add(Rpc::Create(
           i, completion_queue_thread.completion_queue(),
           event_queue_selector_(), execution_context, rpc_handler_info.second,
           this, active_rpcs_.GetWeakPtrFactory()));
@@ -53,7 +64,78 @@ void Service::StartServing(
   }
 }
 
-void Service::StopServing() { shutting_down_ = true; }
+void Service::StopServing() {
+  shutting_down_ = true;
+
+  // Local calls are not cancelled by the gRPC server shutdown.
+  std::vector<std::weak_ptr<LocalCall>> local_calls;
+  {
+    common::MutexLocker locker(&local_calls_lock_);
+    local_calls_stopped_ = true;
+    local_calls.swap(local_calls_);
+  }
+  for (const auto& weak_local_call : local_calls) {
+    if (auto local_call = weak_local_call.lock()) {
+      local_call->Cancel(
+          ::grpc::Status(::grpc::UNAVAILABLE, "Server shutting down."));
+    }
+  }
+}
+
+bool Service::StartLocalCall(
+    const std::string& method_name,
+    const google::protobuf::Descriptor* request_descriptor,
+    const google::protobuf::Descriptor* response_descriptor,
+    std::shared_ptr<LocalCall> local_call) {
+  auto it = rpc_handler_infos_.find(method_name);
+  if (it == rpc_handler_infos_.end() ||
+      it->second.request_descriptor == nullptr ||
+      it->second.request_descriptor != request_descriptor ||
+      it->second.response_descriptor != response_descriptor) {
+    return false;
+  }
+  const int method_index = std::distance(rpc_handler_infos_.begin(), it);
+  common::MutexLocker locker(&local_calls_lock_);
+  if (local_calls_stopped_) {
+    return false;
+  }
+  local_calls_.erase(
+      std::remove_if(local_calls_.begin(), local_calls_.end(),
+                     [](const std::weak_ptr<LocalCall>& weak_local_call) {
+                       return weak_local_call.expired();
+                     }),
+      local_calls_.end());
+  local_calls_.push_back(local_call);
+  active_rpcs_
+      .Add(Rpc::Create(
+          method_index, local_completion_queue_, event_queue_selector_(),
+          execution_context_, it->second, this,
+          active_rpcs_.GetWeakPtrFactory()))
+      ->StartLocalCall(std::move(local_call));
+  return true;
+}
+
+CompressionStats Service::GetCompressionStats(
+    const std::string& method_name) const {
+  auto it = rpc_handler_infos_.find(method_name);
+  CHECK(it != rpc_handler_infos_.end()) << "Unknown method " << method_name;
+  CHECK(it->second.compressor)
+      << "Method " << method_name << " does not compress its responses.";
+  return it->second.compressor->GetStats();
+}
+
+ResponseCacheStats Service::GetResponseCacheStats(
+    const std::string& method_name) const {
+  auto it = rpc_handler_infos_.find(method_name);
+  CHECK(it != rpc_handler_infos_.end()) << "Unknown method " << method_name;
+  CHECK(it->second.response_cache)
+      << "Method " << method_name << " does not cache its responses.";
+  return it->second.response_cache->GetStats();
+}
+
+TimerWheel* Service::GetTimerWheel(EventQueue* event_queue) {
+  return timer_wheel_selector_(event_queue);
+}
 
 void Service::HandleEvent(Rpc::Event event, Rpc* rpc, bool ok) {
   switch (event) {
@@ -63,8 +145,16 @@ void Service::HandleEvent(Rpc::Event event, Rpc* rpc, bool ok) {
     case Rpc::Event::READ:
       HandleRead(rpc, ok);
       break;
+    case Rpc::Event::RESUME_READ:
+      HandleResumeRead(rpc, ok);
+      break;
     case Rpc::Event::WRITE_NEEDED:
+      HandleWrite(rpc, ok);
+      break;
     case Rpc::Event::WRITE:
+      if (ok) {
+        rpc->RecordActivity();
+      }
       HandleWrite(rpc, ok);
       break;
     case Rpc::Event::FINISH:
@@ -73,10 +163,26 @@ void Service::HandleEvent(Rpc::Event event, Rpc* rpc, bool ok) {
     case Rpc::Event::DONE:
       HandleDone(rpc, ok);
       break;
+    case Rpc::Event::CALLBACK:
+      LOG(FATAL) << "Callbacks are run by 'Rpc::CallbackEvent'.";
+      break;
   }
 }
 
 void Service::HandleNewConnection(Rpc* rpc, bool ok) {
+  if (rpc->is_local()) {
+    // Local calls are started one by one, see 'StartLocalCall()'.
+    if (shutting_down_) {
+      rpc->Finish(::grpc::Status(::grpc::UNAVAILABLE, "Server shutting down."));
+    } else if (rpc->TryAcquireCallToken()) {
+      rpc->OnConnection();
+    } else {
+      rpc->Finish(::grpc::Status(::grpc::RESOURCE_EXHAUSTED,
+                                 "Call rate limit exceeded."));
+    }
+    return;
+  }
+
   if (shutting_down_) {
     if (ok) {
       LOG(WARNING) << "Server shutting down. Refusing to handle new RPCs.";
@@ -91,7 +197,12 @@ void Service::HandleNewConnection(Rpc* rpc, bool ok) {
   }
 
   if (ok) {
-    rpc->OnConnection();
+    if (rpc->TryAcquireCallToken()) {
+      rpc->OnConnection();
+    } else {
+      rpc->Finish(::grpc::Status(::grpc::RESOURCE_EXHAUSTED,
+                                 "Call rate limit exceeded."));
+    }
   }
 
   // Create new active rpc to handle next connection and register it for the
@@ -103,8 +214,16 @@ void Service::HandleNewConnection(Rpc* rpc, bool ok) {
 
 void Service::HandleRead(Rpc* rpc, bool ok) {
   if (ok) {
+    rpc->RecordActivity();
     rpc->OnRequest();
-    rpc->RequestStreamingReadIfNeeded();
+    // Throttle clients streaming faster than the message rate limit by
+    // holding back the next read.
+    const common::Duration read_delay = rpc->AcquireMessageToken();
+    if (read_delay > common::Duration::zero()) {
+      rpc->RequestStreamingReadAfter(read_delay);
+    } else {
+      rpc->RequestStreamingReadIfNeeded();
+    }
     return;
   }
 
@@ -114,6 +233,16 @@ void Service::HandleRead(Rpc* rpc, bool ok) {
   RemoveIfNotPending(rpc);
 }
 
+void Service::HandleResumeRead(Rpc* rpc, bool ok) {
+  if (ok) {
+    rpc->RequestStreamingReadIfNeeded();
+    return;
+  }
+
+  // The alarm was cancelled.
+  RemoveIfNotPending(rpc);
+}
+
 void Service::HandleWrite(Rpc* rpc, bool ok) {
   if (!ok) {
     LOG(ERROR) << "Write failed";
@@ -135,7 +264,11 @@ void Service::HandleFinish(Rpc* rpc, bool ok) {
   RemoveIfNotPending(rpc);
 }
 
-void Service::HandleDone(Rpc* rpc, bool ok) { RemoveIfNotPending(rpc); }
+void Service::HandleDone(Rpc* rpc, bool ok) {
+  rpc->OnDone();
+
+  RemoveIfNotPending(rpc);
+}
 
 void Service::RemoveIfNotPending(Rpc* rpc) {
   if (!rpc->IsAnyEventPending()) {
@@ -17,11 +17,16 @@
 #ifndef CPP_GRPC_SERVICE_H
 #define CPP_GRPC_SERVICE_H
 
+#include <atomic>
+
 #include "async_grpc/completion_queue_thread.h"
 #include "async_grpc/event_queue_thread.h"
 #include "async_grpc/execution_context.h"
+#include "async_grpc/local_call.h"
 #include "async_grpc/rpc.h"
 #include "async_grpc/rpc_handler.h"
+#include "async_grpc/timer_wheel.h"
+#include "async_grpc/worker_pool.h"
 #include "grpc++/impl/codegen/service_type.h"
 
 namespace async_grpc {
@@ -33,19 +38,37 @@ namespace async_grpc {
 class Service : public ::grpc::Service {
  public:
   using EventQueueSelector = std::function<EventQueue*()>;
+  // Returns the timer wheel of the event thread processing 'event_queue'.
+  using TimerWheelSelector = std::function<TimerWheel*(EventQueue*)>;
   friend class Rpc;
 
   Service(const std::string& service_name,
           const std::map<std::string, RpcHandlerInfo>& rpc_handlers,
-          EventQueueSelector event_queue_selector);
+          EventQueueSelector event_queue_selector,
+          TimerWheelSelector timer_wheel_selector, WorkerPool* worker_pool);
   void StartServing(std::vector<CompletionQueueThread>& completion_queues,
                     ExecutionContext* execution_context);
   void HandleEvent(Rpc::Event event, Rpc* rpc, bool ok);
   void StopServing();
+  // Serves 'local_call' to method 'method_name' of this service without
+  // going through gRPC. Returns false if the method is unknown, its messages
+  // do not match the descriptors or the service is shutting down.
+  bool StartLocalCall(const std::string& method_name,
+                      const google::protobuf::Descriptor* request_descriptor,
+                      const google::protobuf::Descriptor* response_descriptor,
+                      std::shared_ptr<LocalCall> local_call);
+  TimerWheel* GetTimerWheel(EventQueue* event_queue);
+  // Returns 'nullptr' unless the server has worker threads.
+  WorkerPool* worker_pool() { return worker_pool_; }
+  int64 num_reaped_idle_rpcs() const { return num_reaped_idle_rpcs_; }
+  CompressionStats GetCompressionStats(const std::string& method_name) const;
+  ResponseCacheStats GetResponseCacheStats(
+      const std::string& method_name) const;
 
  private:
   void HandleNewConnection(Rpc* rpc, bool ok);
   void HandleRead(Rpc* rpc, bool ok);
+  void HandleResumeRead(Rpc* rpc, bool ok);
   void HandleWrite(Rpc* rpc, bool ok);
   void HandleFinish(Rpc* rpc, bool ok);
   void HandleDone(Rpc* rpc, bool ok);
@@ -54,8 +77,19 @@ class Service : public ::grpc::Service {
 
   std::map<std::string, RpcHandlerInfo> rpc_handler_infos_;
   EventQueueSelector event_queue_selector_;
+  TimerWheelSelector timer_wheel_selector_;
+  WorkerPool* const worker_pool_;
   ActiveRpcs active_rpcs_;
+  std::atomic<int64> num_reaped_idle_rpcs_;
   bool shutting_down_ = false;
+
+  // Used to serve local calls, see 'StartLocalCall()'.
+  ::grpc::ServerCompletionQueue* local_completion_queue_ = nullptr;
+  ExecutionContext* execution_context_ = nullptr;
+  common::Mutex local_calls_lock_;
+  bool local_calls_stopped_ GUARDED_BY(local_calls_lock_) = false;
+  std::vector<std::weak_ptr<LocalCall>> local_calls_
+      GUARDED_BY(local_calls_lock_);
 };
 
 }  // namespace async_grpc
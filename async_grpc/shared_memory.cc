@@ -0,0 +1,415 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/shared_memory.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <random>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+namespace {
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+// The ring starts with its id, followed by the records.
+constexpr size_t kRingHeaderSize = 64;
+
+// Name of the memfd backing every ring, as shown by '/proc/<pid>/fd/<fd>'.
+constexpr char kRingName[] = "async_grpc";
+constexpr char kRingLinkPrefix[] = "/memfd:async_grpc";
+
+// Bounds the rings of other processes that stay mapped.
+constexpr size_t kMaxCachedMappings = 64;
+
+// See 'SharedMemoryTransport::PeerScope'.
+enum PeerState { kNoPeerScope = -1, kRemotePeer = 0, kLocalPeer = 1 };
+thread_local int peer_state = kNoPeerScope;
+
+// Precedes the payload of every record. 'sequence' is zero while the record
+// is being written or overwritten.
+struct RecordHeader {
+  std::atomic<uint64_t> sequence;
+  uint64_t length;
+};
+
+constexpr size_t kRecordAlignment = 8;
+
+size_t RecordSize(size_t length) {
+  const size_t size = sizeof(RecordHeader) + length;
+  return (size + kRecordAlignment - 1) / kRecordAlignment * kRecordAlignment;
+}
+
+::grpc::Status ErrnoStatus(const std::string& what,
+                           const std::string& filename) {
+  return ::grpc::Status(::grpc::INTERNAL, what + " '" + filename +
+                                              "' failed: " + strerror(errno));
+}
+
+// A ring of another process mapped read-only.
+struct Mapping {
+  Mapping(const char* data, size_t size) : data(data), size(size) {}
+  ~Mapping() { CHECK_EQ(munmap(const_cast<char*>(data), size), 0); }
+
+  const char* const data;
+  const size_t size;
+};
+
+// Least recently used first. Mappings still in use by a reader stay valid
+// when they are evicted.
+struct MappingCache {
+  using Key = std::pair<int32_t, int32_t>;
+  using Entry = std::pair<Key, std::shared_ptr<const Mapping>>;
+
+  common::Mutex lock;
+  std::list<Entry> entries GUARDED_BY(lock);
+  std::map<Key, std::list<Entry>::iterator> index GUARDED_BY(lock);
+};
+
+MappingCache* GetMappingCache() {
+  static MappingCache* const kInstance = new MappingCache();
+  return kInstance;
+}
+
+uint64_t RingId(const char* data) {
+  uint64_t ring_id;
+  std::memcpy(&ring_id, data, sizeof(ring_id));
+  return ring_id;
+}
+
+// Maps the ring 'descriptor' points to, reusing earlier mappings unless the
+// file descriptor now refers to a different ring.
+::grpc::Status GetMapping(const SharedMemoryDescriptor& descriptor,
+                          std::shared_ptr<const Mapping>* mapping) {
+  MappingCache* cache = GetMappingCache();
+  const MappingCache::Key key(descriptor.pid, descriptor.fd);
+  {
+    common::MutexLocker locker(&cache->lock);
+    auto it = cache->index.find(key);
+    if (it != cache->index.end() &&
+        RingId(it->second->second->data) == descriptor.ring_id) {
+      cache->entries.splice(cache->entries.end(), cache->entries, it->second);
+      *mapping = it->second->second;
+      return ::grpc::Status::OK;
+    }
+  }
+
+  const std::string filename = "/proc/" + std::to_string(descriptor.pid) +
+                               "/fd/" + std::to_string(descriptor.fd);
+  const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoStatus("Opening", filename);
+  }
+  // Checks the file we opened rather than 'filename', which the client could
+  // have swapped in the meantime.
+  char link[256] = {};
+  const std::string fd_filename = "/proc/self/fd/" + std::to_string(fd);
+  if (readlink(fd_filename.c_str(), link, sizeof(link) - 1) < 0 ||
+      std::strncmp(link, kRingLinkPrefix, strlen(kRingLinkPrefix)) != 0) {
+    close(fd);
+    return ::grpc::Status(::grpc::INVALID_ARGUMENT,
+                          "'" + filename + "' is no shared memory ring.");
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    // 'close()' may overwrite 'errno'.
+    const ::grpc::Status status = ErrnoStatus("Stating", filename);
+    close(fd);
+    return status;
+  }
+  const size_t size = file_stat.st_size;
+  if (size < kRingHeaderSize) {
+    close(fd);
+    return ::grpc::Status(::grpc::UNAVAILABLE,
+                          "'" + filename + "' is no shared memory ring.");
+  }
+  void* const map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    const ::grpc::Status status = ErrnoStatus("Mapping", filename);
+    close(fd);
+    return status;
+  }
+  close(fd);
+  auto new_mapping =
+      std::make_shared<const Mapping>(static_cast<const char*>(map), size);
+  if (RingId(new_mapping->data) != descriptor.ring_id) {
+    return ::grpc::Status(::grpc::UNAVAILABLE,
+                          "The shared memory ring is gone.");
+  }
+  common::MutexLocker locker(&cache->lock);
+  auto it = cache->index.find(key);
+  if (it != cache->index.end()) {
+    cache->entries.erase(it->second);
+    cache->index.erase(it);
+  }
+  while (cache->entries.size() >= kMaxCachedMappings) {
+    cache->index.erase(cache->entries.front().first);
+    cache->entries.pop_front();
+  }
+  cache->entries.emplace_back(key, new_mapping);
+  cache->index.emplace(key, std::prev(cache->entries.end()));
+  *mapping = std::move(new_mapping);
+  return ::grpc::Status::OK;
+}
+
+struct TransportState {
+  common::Mutex lock;
+  std::unique_ptr<SharedMemoryRing> ring GUARDED_BY(lock);
+  std::atomic<size_t> threshold{0};
+  std::atomic<SharedMemoryRing*> enabled_ring{nullptr};
+};
+
+TransportState* GetTransportState() {
+  static TransportState* const kInstance = new TransportState();
+  return kInstance;
+}
+
+}  // namespace
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::Create(size_t size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+  CHECK_GT(size, kRingHeaderSize);
+  const int fd = syscall(SYS_memfd_create, kRingName, MFD_CLOEXEC);
+  if (fd < 0) {
+    LOG(WARNING) << "memfd_create failed: " << strerror(errno);
+    return nullptr;
+  }
+  if (ftruncate(fd, size) != 0) {
+    LOG(WARNING) << "Resizing shared memory ring failed: " << strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  void* const map =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    LOG(WARNING) << "Mapping shared memory ring failed: " << strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  // Tells rings apart whose process and file descriptor were reused.
+  std::random_device random_device;
+  const uint64_t ring_id =
+      (static_cast<uint64_t>(random_device()) << 32 ^ random_device()) ^
+      std::chrono::steady_clock::now().time_since_epoch().count();
+  std::memcpy(map, &ring_id, sizeof(ring_id));
+  return std::unique_ptr<SharedMemoryRing>(
+      new SharedMemoryRing(fd, static_cast<char*>(map), size, ring_id));
+#else
+  return nullptr;
+#endif
+}
+
+SharedMemoryRing::SharedMemoryRing(int fd, char* data, size_t size,
+                                   uint64_t ring_id)
+    : fd_(fd),
+      data_(data),
+      size_(size),
+      ring_id_(ring_id),
+      head_(kRingHeaderSize) {}
+
+SharedMemoryRing::~SharedMemoryRing() {
+  CHECK_EQ(munmap(data_, size_), 0);
+  close(fd_);
+}
+
+bool SharedMemoryRing::Write(const google::protobuf::MessageLite& message,
+                             SharedMemoryDescriptor* descriptor) {
+  const size_t length = message.ByteSizeLong();
+  const size_t record_size = RecordSize(length);
+  if (record_size > size_ - kRingHeaderSize) {
+    return false;
+  }
+  common::MutexLocker locker(&mutex_);
+  uint64_t offset = head_;
+  if (offset + record_size > size_) {
+    InvalidateLocked(offset, size_ - offset);
+    offset = kRingHeaderSize;
+  }
+  InvalidateLocked(offset, record_size);
+  auto* header = reinterpret_cast<RecordHeader*>(data_ + offset);
+  header->length = length;
+  message.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(data_ + offset + sizeof(RecordHeader)));
+  const uint64_t sequence = next_sequence_++;
+  // Publishes the payload to readers.
+  header->sequence.store(sequence, std::memory_order_release);
+  records_.push_back(Record{offset, record_size});
+  head_ = offset + record_size;
+
+  descriptor->host_id = SharedMemoryTransport::HostId();
+  descriptor->ring_id = ring_id_;
+  descriptor->pid = getpid();
+  descriptor->fd = fd_;
+  descriptor->offset = offset;
+  descriptor->length = length;
+  descriptor->sequence = sequence;
+  return true;
+}
+
+void SharedMemoryRing::InvalidateLocked(uint64_t offset, uint64_t size) {
+  // Records are written in ring order, so the ones in the way of the writer
+  // are always the oldest.
+  while (!records_.empty() && records_.front().offset < offset + size &&
+         records_.front().offset + records_.front().size > offset) {
+    reinterpret_cast<RecordHeader*>(data_ + records_.front().offset)
+        ->sequence.store(0, std::memory_order_relaxed);
+    records_.pop_front();
+  }
+  // Readers must observe the invalidation before the new payload.
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedMemoryTransport::Enable(const SharedMemoryOptions& options) {
+  TransportState* state = GetTransportState();
+  common::MutexLocker locker(&state->lock);
+  state->threshold.store(options.threshold);
+  if (state->ring) {
+    return;
+  }
+  state->ring = SharedMemoryRing::Create(options.ring_size);
+  if (!state->ring) {
+    LOG(WARNING) << "Shared memory is not available, sending all payloads "
+                    "inline.";
+    return;
+  }
+  state->enabled_ring.store(state->ring.get());
+}
+
+bool SharedMemoryTransport::IsEnabled() {
+  return GetTransportState()->enabled_ring.load() != nullptr;
+}
+
+bool SharedMemoryTransport::TryWrite(
+    const google::protobuf::MessageLite& message,
+    SharedMemoryDescriptor* descriptor) {
+  TransportState* state = GetTransportState();
+  // The ring lives until the process exits once it was created.
+  SharedMemoryRing* ring = state->enabled_ring.load();
+  if (ring == nullptr || message.ByteSizeLong() < state->threshold.load()) {
+    return false;
+  }
+  return ring->Write(message, descriptor);
+}
+
+::grpc::Status SharedMemoryTransport::Read(
+    const SharedMemoryDescriptor& descriptor,
+    google::protobuf::MessageLite* message) {
+  if (peer_state == kRemotePeer) {
+    return ::grpc::Status(::grpc::INVALID_ARGUMENT,
+                          "Shared memory payload from a remote peer.");
+  }
+  if (descriptor.host_id != HostId()) {
+    return ::grpc::Status(::grpc::UNAVAILABLE,
+                          "Shared memory payload from another host.");
+  }
+  std::shared_ptr<const Mapping> mapping;
+  ::grpc::Status status = GetMapping(descriptor, &mapping);
+  if (!status.ok()) {
+    return status;
+  }
+  if (descriptor.offset < kRingHeaderSize ||
+      descriptor.offset % kRecordAlignment != 0 ||
+      descriptor.offset > mapping->size ||
+      mapping->size - descriptor.offset < sizeof(RecordHeader) ||
+      descriptor.length >
+          mapping->size - descriptor.offset - sizeof(RecordHeader) ||
+      descriptor.length > static_cast<uint64_t>(INT_MAX)) {
+    return ::grpc::Status(::grpc::INTERNAL,
+                          "Shared memory descriptor out of range.");
+  }
+  const auto* header =
+      reinterpret_cast<const RecordHeader*>(mapping->data + descriptor.offset);
+  const auto overwritten = [&]() {
+    return ::grpc::Status(::grpc::DATA_LOSS,
+                          "Shared memory payload was overwritten.");
+  };
+  if (header->sequence.load(std::memory_order_acquire) !=
+          descriptor.sequence ||
+      header->length != descriptor.length) {
+    return overwritten();
+  }
+  const bool parsed = message->ParseFromArray(
+      mapping->data + descriptor.offset + sizeof(RecordHeader),
+      descriptor.length);
+  // The writer may have started overwriting the payload while parsing.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header->sequence.load(std::memory_order_relaxed) !=
+      descriptor.sequence) {
+    return overwritten();
+  }
+  if (!parsed) {
+    return ::grpc::Status(::grpc::INTERNAL,
+                          "Failed to parse shared memory payload.");
+  }
+  return ::grpc::Status::OK;
+}
+
+uint64_t SharedMemoryTransport::HostId() {
+  static const uint64_t kHostId = []() {
+    std::string boot_id;
+    std::ifstream("/proc/sys/kernel/random/boot_id") >> boot_id;
+    if (boot_id.empty()) {
+      char hostname[256] = {};
+      gethostname(hostname, sizeof(hostname) - 1);
+      boot_id = hostname;
+    }
+    return static_cast<uint64_t>(std::hash<std::string>()(boot_id));
+  }();
+  return kHostId;
+}
+
+SharedMemoryTransport::PeerScope::PeerScope(bool peer_is_local)
+    : previous_peer_state_(peer_state) {
+  peer_state = peer_is_local ? kLocalPeer : kRemotePeer;
+}
+
+SharedMemoryTransport::PeerScope::~PeerScope() {
+  peer_state = previous_peer_state_;
+}
+
+bool IsLocalPeer(const std::string& peer) {
+  static const char* const kLocalPrefixes[] = {"unix:", "inproc",
+                                               "ipv4:127.", "ipv6:[::1]"};
+  for (const char* prefix : kLocalPrefixes) {
+    if (peer.compare(0, strlen(prefix), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace async_grpc
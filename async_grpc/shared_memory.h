@@ -0,0 +1,136 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_SHARED_MEMORY_H
+#define CPP_GRPC_SHARED_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "async_grpc/common/mutex.h"
+#include "google/protobuf/message_lite.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+
+struct SharedMemoryOptions {
+  // Size of the ring every process writes its large payloads to.
+  size_t ring_size = 64 << 20;
+  // Smaller payloads are sent inline.
+  size_t threshold = 1 << 20;
+};
+
+// Locates a payload in the shared memory ring of a process on this host. Sent
+// over the gRPC call instead of the payload.
+struct SharedMemoryDescriptor {
+  uint64_t host_id;
+  uint64_t ring_id;
+  int32_t pid;
+  int32_t fd;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t sequence;
+};
+
+// A 'memfd' backed ring buffer that payloads are serialized into. Readers in
+// other processes map it through '/proc/<pid>/fd/<fd>', which requires them
+// to run as the same user. Payloads stay readable until the ring wraps around
+// and overwrites them; readers detect this and fail with DATA_LOSS, so the
+// ring needs to be large enough to hold all payloads in flight. Only
+// available on Linux.
+class SharedMemoryRing {
+ public:
+  // Returns 'nullptr' if shared memory is not supported.
+  static std::unique_ptr<SharedMemoryRing> Create(size_t size);
+  ~SharedMemoryRing();
+
+  SharedMemoryRing(const SharedMemoryRing&) = delete;
+  SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+
+  // Serializes 'message' into the ring. Returns false if it does not fit.
+  // Thread-safe.
+  bool Write(const google::protobuf::MessageLite& message,
+             SharedMemoryDescriptor* descriptor) EXCLUDES(mutex_);
+
+ private:
+  struct Record {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  SharedMemoryRing(int fd, char* data, size_t size, uint64_t ring_id);
+  // Marks records overlapping '[offset, offset + size)' as overwritten.
+  void InvalidateLocked(uint64_t offset, uint64_t size) REQUIRES(mutex_);
+
+  const int fd_;
+  char* const data_;
+  const size_t size_;
+  const uint64_t ring_id_;
+
+  common::Mutex mutex_;
+  uint64_t head_ GUARDED_BY(mutex_);
+  uint64_t next_sequence_ GUARDED_BY(mutex_) = 1;
+  // Readable records, oldest first.
+  std::deque<Record> records_ GUARDED_BY(mutex_);
+};
+
+// Process-wide switch for the shared memory side channel, see
+// 'SharedPayload'.
+class SharedMemoryTransport {
+ public:
+  // Creates this process' ring. Without it payloads are always sent inline,
+  // but descriptors from other processes can still be read.
+  static void Enable(const SharedMemoryOptions& options);
+  static bool IsEnabled();
+
+  // Writes 'message' to the ring if it is at least 'threshold' bytes large.
+  static bool TryWrite(const google::protobuf::MessageLite& message,
+                       SharedMemoryDescriptor* descriptor);
+
+  // Parses the payload 'descriptor' points to straight from shared memory.
+  // Only rings created by 'SharedMemoryRing' are mapped; descriptors pointing
+  // at other files fail with INVALID_ARGUMENT.
+  static ::grpc::Status Read(const SharedMemoryDescriptor& descriptor,
+                             google::protobuf::MessageLite* message);
+
+  // Identifies the running kernel, i.e. the host.
+  static uint64_t HostId();
+
+  // While in scope, 'Read()' on this thread fails with INVALID_ARGUMENT
+  // unless 'peer_is_local'. Servers decode requests within one, so that
+  // remote clients cannot make them resolve descriptors.
+  class PeerScope {
+   public:
+    explicit PeerScope(bool peer_is_local);
+    ~PeerScope();
+
+    PeerScope(const PeerScope&) = delete;
+    PeerScope& operator=(const PeerScope&) = delete;
+
+   private:
+    const int previous_peer_state_;
+  };
+};
+
+// Returns true if 'peer', as reported by gRPC, is a process on this host.
+bool IsLocalPeer(const std::string& peer);
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_SHARED_MEMORY_H
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/shared_memory.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "async_grpc/proto/benchmark.pb.h"
+#include "async_grpc/shared_payload.h"
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+proto::PointCloud MakePointCloud(int num_points) {
+  proto::PointCloud point_cloud;
+  for (int i = 0; i < num_points; ++i) {
+    proto::Point* point = point_cloud.add_points();
+    point->set_x(i);
+    point->set_y(2 * i);
+    point->set_z(3 * i);
+    point_cloud.add_intensities(0.5f * i);
+  }
+  return point_cloud;
+}
+
+TEST(SharedMemoryTest, RingRoundTrip) {
+  auto ring = SharedMemoryRing::Create(1 << 20);
+  ASSERT_NE(ring, nullptr);
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  SharedMemoryDescriptor descriptor;
+  ASSERT_TRUE(ring->Write(point_cloud, &descriptor));
+  EXPECT_EQ(descriptor.length, point_cloud.ByteSizeLong());
+
+  proto::PointCloud read_point_cloud;
+  ASSERT_TRUE(SharedMemoryTransport::Read(descriptor, &read_point_cloud).ok());
+  EXPECT_EQ(read_point_cloud.SerializeAsString(),
+            point_cloud.SerializeAsString());
+}
+
+TEST(SharedMemoryTest, DetectsOverwrittenPayloads) {
+  auto ring = SharedMemoryRing::Create(64 << 10);
+  ASSERT_NE(ring, nullptr);
+  const proto::PointCloud point_cloud = MakePointCloud(1000);
+  SharedMemoryDescriptor first_descriptor;
+  ASSERT_TRUE(ring->Write(point_cloud, &first_descriptor));
+  SharedMemoryDescriptor last_descriptor;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring->Write(point_cloud, &last_descriptor));
+  }
+
+  proto::PointCloud read_point_cloud;
+  EXPECT_EQ(SharedMemoryTransport::Read(first_descriptor, &read_point_cloud)
+                .error_code(),
+            ::grpc::DATA_LOSS);
+  EXPECT_TRUE(
+      SharedMemoryTransport::Read(last_descriptor, &read_point_cloud).ok());
+  EXPECT_EQ(read_point_cloud.points_size(), 1000);
+}
+
+TEST(SharedMemoryTest, RejectsPayloadsLargerThanRing) {
+  auto ring = SharedMemoryRing::Create(4 << 10);
+  ASSERT_NE(ring, nullptr);
+  SharedMemoryDescriptor descriptor;
+  EXPECT_FALSE(ring->Write(MakePointCloud(1000), &descriptor));
+}
+
+TEST(SharedMemoryTest, SharedPayloadRoundTrip) {
+  SharedMemoryOptions options;
+  options.threshold = 1000;
+  SharedMemoryTransport::Enable(options);
+  ASSERT_TRUE(SharedMemoryTransport::IsEnabled());
+
+  SharedPayload<proto::PointCloud> payload;
+  payload.message = MakePointCloud(1000);
+  payload.allow_shared_memory = true;
+  ::grpc::ByteBuffer buffer;
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Serialize(payload, &buffer)
+          .ok());
+  EXPECT_EQ(buffer.Length(), 1 + sizeof(SharedMemoryDescriptor));
+
+  SharedPayload<proto::PointCloud> read_payload;
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Deserialize(&buffer,
+                                                           &read_payload)
+          .ok());
+  EXPECT_TRUE(read_payload.allow_shared_memory);
+  EXPECT_EQ(read_payload.message.SerializeAsString(),
+            payload.message.SerializeAsString());
+}
+
+TEST(SharedMemoryTest, SharedPayloadFallsBackToInline) {
+  SharedMemoryOptions options;
+  options.threshold = 1000;
+  SharedMemoryTransport::Enable(options);
+
+  // Below the threshold.
+  SharedPayload<proto::PointCloud> payload;
+  payload.message = MakePointCloud(10);
+  payload.allow_shared_memory = true;
+  ::grpc::ByteBuffer buffer;
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Serialize(payload, &buffer)
+          .ok());
+  EXPECT_EQ(buffer.Length(), 1 + payload.message.ByteSizeLong());
+  SharedPayload<proto::PointCloud> read_payload;
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Deserialize(&buffer,
+                                                           &read_payload)
+          .ok());
+  EXPECT_FALSE(read_payload.allow_shared_memory);
+  EXPECT_EQ(read_payload.message.points_size(), 10);
+
+  // Remote peer.
+  payload.message = MakePointCloud(1000);
+  PrepareForPeer(&payload, false /* peer_on_same_host */);
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Serialize(payload, &buffer)
+          .ok());
+  EXPECT_EQ(buffer.Length(), 1 + payload.message.ByteSizeLong());
+  ASSERT_TRUE(
+      Codec<SharedPayload<proto::PointCloud>>::Deserialize(&buffer,
+                                                           &read_payload)
+          .ok());
+  EXPECT_EQ(read_payload.message.points_size(), 1000);
+}
+
+TEST(SharedMemoryTest, RejectsDescriptorsFromOtherHosts) {
+  auto ring = SharedMemoryRing::Create(1 << 20);
+  ASSERT_NE(ring, nullptr);
+  SharedMemoryDescriptor descriptor;
+  ASSERT_TRUE(ring->Write(MakePointCloud(10), &descriptor));
+  ++descriptor.host_id;
+  proto::PointCloud read_point_cloud;
+  EXPECT_EQ(
+      SharedMemoryTransport::Read(descriptor, &read_point_cloud).error_code(),
+      ::grpc::UNAVAILABLE);
+}
+
+TEST(SharedMemoryTest, RejectsDescriptorsFromRemotePeers) {
+  auto ring = SharedMemoryRing::Create(1 << 20);
+  ASSERT_NE(ring, nullptr);
+  SharedMemoryDescriptor descriptor;
+  ASSERT_TRUE(ring->Write(MakePointCloud(10), &descriptor));
+  proto::PointCloud read_point_cloud;
+  {
+    SharedMemoryTransport::PeerScope peer_scope(false /* peer_is_local */);
+    EXPECT_EQ(
+        SharedMemoryTransport::Read(descriptor, &read_point_cloud).error_code(),
+        ::grpc::INVALID_ARGUMENT);
+  }
+  SharedMemoryTransport::PeerScope peer_scope(true /* peer_is_local */);
+  EXPECT_TRUE(SharedMemoryTransport::Read(descriptor, &read_point_cloud).ok());
+}
+
+TEST(SharedMemoryTest, RejectsDescriptorsOfOtherFiles) {
+  auto ring = SharedMemoryRing::Create(1 << 20);
+  ASSERT_NE(ring, nullptr);
+  SharedMemoryDescriptor descriptor;
+  ASSERT_TRUE(ring->Write(MakePointCloud(10), &descriptor));
+  const int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  descriptor.fd = fd;
+  proto::PointCloud read_point_cloud;
+  EXPECT_EQ(
+      SharedMemoryTransport::Read(descriptor, &read_point_cloud).error_code(),
+      ::grpc::INVALID_ARGUMENT);
+  close(fd);
+}
+
+TEST(SharedMemoryTest, RejectsDescriptorsOutOfRange) {
+  auto ring = SharedMemoryRing::Create(1 << 20);
+  ASSERT_NE(ring, nullptr);
+  SharedMemoryDescriptor descriptor;
+  ASSERT_TRUE(ring->Write(MakePointCloud(10), &descriptor));
+  proto::PointCloud read_point_cloud;
+  for (const uint64_t length :
+       {uint64_t{1} << 20, ~uint64_t{0}, ~uint64_t{0} - 8}) {
+    SharedMemoryDescriptor out_of_range = descriptor;
+    out_of_range.length = length;
+    EXPECT_EQ(SharedMemoryTransport::Read(out_of_range, &read_point_cloud)
+                  .error_code(),
+              ::grpc::INTERNAL);
+  }
+  SharedMemoryDescriptor out_of_range = descriptor;
+  out_of_range.offset = ~uint64_t{0} - 7;
+  EXPECT_EQ(
+      SharedMemoryTransport::Read(out_of_range, &read_point_cloud).error_code(),
+      ::grpc::INTERNAL);
+}
+
+TEST(SharedMemoryTest, IsLocalPeer) {
+  EXPECT_TRUE(IsLocalPeer("ipv4:127.0.0.1:43210"));
+  EXPECT_TRUE(IsLocalPeer("ipv6:[::1]:43210"));
+  EXPECT_TRUE(IsLocalPeer("unix:/tmp/socket"));
+  EXPECT_FALSE(IsLocalPeer("ipv4:10.0.0.7:43210"));
+  EXPECT_FALSE(IsLocalPeer("ipv6:[2001:db8::1]:43210"));
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_SHARED_PAYLOAD_H
+#define CPP_GRPC_SHARED_PAYLOAD_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "async_grpc/codec.h"
+#include "async_grpc/shared_memory.h"
+#include "google/protobuf/message.h"
+#include "grpc++/grpc++.h"
+#include "grpc++/impl/codegen/proto_utils.h"
+
+namespace async_grpc {
+
+// Wraps a protobuf message that is passed through the shared memory ring of
+// the sender, see 'SharedMemoryTransport', if it is large enough and
+// 'allow_shared_memory' is set. Only a 'SharedMemoryDescriptor' then travels
+// over the call and the receiver parses the message straight from shared
+// memory. Otherwise the message is sent inline. Use it as request or response
+// type of a method:
+//   using ResponseType = async_grpc::SharedPayload<proto::PointCloud>;
+// Responses written by an 'RpcHandler' through 'Send(std::unique_ptr<>)' or
+// its 'Writer' use shared memory if the client's address shows it runs on the
+// same host. Clients have to decide for their requests.
+template <typename MessageType>
+struct SharedPayload {
+  static_assert(std::is_base_of<::google::protobuf::Message, MessageType>::value,
+                "SharedPayload requires a protobuf message.");
+
+  MessageType message;
+  bool allow_shared_memory = false;
+};
+
+template <typename MessageType>
+void PrepareForPeer(SharedPayload<MessageType>* payload,
+                    bool peer_on_same_host) {
+  payload->allow_shared_memory = peer_on_same_host;
+}
+
+template <typename MessageType>
+class SharedPayloadSerializationTraits {
+  enum : uint8_t { kInline = 0, kDescriptor = 1 };
+
+ public:
+  static ::grpc::Status Serialize(const SharedPayload<MessageType>& payload,
+                                  ::grpc::ByteBuffer* buffer,
+                                  bool* own_buffer) {
+    *own_buffer = true;
+    SharedMemoryDescriptor descriptor;
+    if (payload.allow_shared_memory &&
+        SharedMemoryTransport::TryWrite(payload.message, &descriptor)) {
+      char data[1 + sizeof(descriptor)];
+      data[0] = kDescriptor;
+      std::memcpy(data + 1, &descriptor, sizeof(descriptor));
+      ::grpc::Slice slice(data, sizeof(data));
+      *buffer = ::grpc::ByteBuffer(&slice, 1 /* nslices */);
+      return ::grpc::Status::OK;
+    }
+    ::grpc::ByteBuffer message_buffer;
+    bool own_message_buffer;
+    ::grpc::Status status = ::grpc::SerializationTraits<MessageType>::Serialize(
+        payload.message, &message_buffer, &own_message_buffer);
+    if (!status.ok()) {
+      return status;
+    }
+    // Prepends the tag without copying the message.
+    std::vector<::grpc::Slice> slices;
+    status = message_buffer.Dump(&slices);
+    if (!status.ok()) {
+      return status;
+    }
+    const char tag = kInline;
+    slices.insert(slices.begin(), ::grpc::Slice(&tag, 1));
+    *buffer = ::grpc::ByteBuffer(slices.data(), slices.size());
+    return ::grpc::Status::OK;
+  }
+
+  static ::grpc::Status Deserialize(::grpc::ByteBuffer* buffer,
+                                    SharedPayload<MessageType>* payload) {
+    std::vector<::grpc::Slice> slices;
+    ::grpc::Status status = buffer->Dump(&slices);
+    buffer->Clear();
+    if (!status.ok()) {
+      return status;
+    }
+    while (!slices.empty() && slices.front().size() == 0) {
+      slices.erase(slices.begin());
+    }
+    if (slices.empty()) {
+      return ::grpc::Status(::grpc::INTERNAL, "Empty shared payload.");
+    }
+    const uint8_t tag = slices.front().begin()[0];
+    payload->allow_shared_memory = tag == kDescriptor;
+    if (tag == kInline) {
+      slices.front() = slices.front().sub(1, slices.front().size());
+      ::grpc::ByteBuffer message_buffer(slices.data(), slices.size());
+      return ::grpc::SerializationTraits<MessageType>::Deserialize(
+          &message_buffer, &payload->message);
+    }
+    if (tag != kDescriptor) {
+      return ::grpc::Status(::grpc::INTERNAL, "Malformed shared payload.");
+    }
+    char data[1 + sizeof(SharedMemoryDescriptor)];
+    size_t size = 0;
+    for (const ::grpc::Slice& slice : slices) {
+      if (size + slice.size() <= sizeof(data)) {
+        std::memcpy(data + size, slice.begin(), slice.size());
+      }
+      size += slice.size();
+    }
+    if (size != sizeof(data)) {
+      return ::grpc::Status(::grpc::INTERNAL, "Malformed shared payload.");
+    }
+    SharedMemoryDescriptor descriptor;
+    std::memcpy(&descriptor, data + 1, sizeof(descriptor));
+    return SharedMemoryTransport::Read(descriptor, &payload->message);
+  }
+};
+
+}  // namespace async_grpc
+
+namespace grpc {
+
+template <typename MessageType>
+class SerializationTraits<async_grpc::SharedPayload<MessageType>>
+    : public async_grpc::SharedPayloadSerializationTraits<MessageType> {};
+
+}  // namespace grpc
+
+#endif  // CPP_GRPC_SHARED_PAYLOAD_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/timer_wheel.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+
+TimerWheel::TimerWheel(const common::Duration tick, const size_t num_slots)
+    : tick_(std::chrono::duration_cast<Clock::duration>(tick)),
+      start_(Clock::now()),
+      slots_(num_slots),
+      next_timer_tick_(std::numeric_limits<int64>::max()) {
+  CHECK_GT(tick_.count(), 0);
+  CHECK_GT(num_slots, 0u);
+}
+
+void TimerWheel::Schedule(const Clock::time_point deadline,
+                          Callback callback) {
+  const int64 tick = std::max(ToTick(deadline), current_tick_ + 1);
+  slots_[tick % slots_.size()].push_back(Timer{tick, std::move(callback)});
+  ++num_timers_;
+  next_timer_tick_ = std::min(next_timer_tick_, tick);
+}
+
+void TimerWheel::Advance(const Clock::time_point now) {
+  // Timers expire once 'now' has reached the end of their tick.
+  const int64 target_tick = (now - start_) / tick_;
+  if (target_tick <= current_tick_) {
+    return;
+  }
+
+  // After a full revolution every slot has been visited once.
+  const int64 num_slots = slots_.size();
+  const int64 first_tick =
+      std::max(current_tick_ + 1, target_tick - num_slots + 1);
+  std::vector<Callback> due_callbacks;
+  for (int64 tick = first_tick; tick <= target_tick; ++tick) {
+    std::vector<Timer>& slot = slots_[tick % num_slots];
+    auto due_begin = std::partition(
+        slot.begin(), slot.end(),
+        [target_tick](const Timer& timer) { return timer.tick > target_tick; });
+    for (auto it = due_begin; it != slot.end(); ++it) {
+      due_callbacks.push_back(std::move(it->callback));
+    }
+    slot.erase(due_begin, slot.end());
+  }
+  current_tick_ = target_tick;
+  num_timers_ -= due_callbacks.size();
+  if (next_timer_tick_ <= target_tick) {
+    next_timer_tick_valid_ = false;
+    next_timer_tick_ = std::numeric_limits<int64>::max();
+  }
+
+  // Run callbacks last, since they may schedule new timers.
+  for (const Callback& callback : due_callbacks) {
+    callback();
+  }
+}
+
+TimerWheel::Clock::time_point TimerWheel::NextDeadline() {
+  if (num_timers_ == 0) {
+    return Clock::time_point::max();
+  }
+  if (!next_timer_tick_valid_) {
+    // The first slot holding a timer for its own tick has the earliest one.
+    // Timers of later revolutions only count if no slot does.
+    const int64 num_slots = slots_.size();
+    for (int64 tick = current_tick_ + 1; tick <= current_tick_ + num_slots;
+         ++tick) {
+      for (const Timer& timer : slots_[tick % num_slots]) {
+        next_timer_tick_ = std::min(next_timer_tick_, timer.tick);
+      }
+      if (next_timer_tick_ == tick) {
+        break;
+      }
+    }
+    next_timer_tick_valid_ = true;
+  }
+  return start_ + next_timer_tick_ * tick_;
+}
+
+int64 TimerWheel::ToTick(const Clock::time_point time) const {
+  // Round up so that timers never fire early.
+  const Clock::duration since_start = time - start_;
+  return (since_start + tick_ - Clock::duration(1)) / tick_;
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_TIMER_WHEEL_H
+#define CPP_GRPC_TIMER_WHEEL_H
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "async_grpc/common/port.h"
+#include "async_grpc/common/time.h"
+
+namespace async_grpc {
+
+// A hashed timer wheel. Timers are rounded up to the next 'tick' and stored in
+// one of 'num_slots' slots, so scheduling is O(1) and advancing the wheel only
+// looks at the slots that passed. Timers further out than one revolution stay
+// in their slot until their tick comes around.
+//
+// A 'TimerWheel' is not thread-safe. Each event thread owns one which it
+// advances between events, so callbacks run on that event thread.
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+
+  TimerWheel(common::Duration tick, size_t num_slots);
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Runs 'callback' on the first call to 'Advance()' at or after 'deadline'.
+  void Schedule(Clock::time_point deadline, Callback callback);
+
+  // Runs all callbacks that are due at 'now'.
+  void Advance(Clock::time_point now);
+
+  // Returns the time at which 'Advance()' has the next callback to run, or
+  // 'Clock::time_point::max()' if no timer is scheduled. Lets the owner sleep
+  // until then.
+  Clock::time_point NextDeadline();
+
+  size_t num_timers() const { return num_timers_; }
+
+ private:
+  struct Timer {
+    int64 tick;
+    Callback callback;
+  };
+
+  int64 ToTick(Clock::time_point time) const;
+
+  const Clock::duration tick_;
+  const Clock::time_point start_;
+  std::vector<std::vector<Timer>> slots_;
+  int64 current_tick_ = 0;
+  size_t num_timers_ = 0;
+  // Lower bound of the earliest tick with a timer, recomputed by
+  // 'NextDeadline()' once it passed.
+  int64 next_timer_tick_;
+  bool next_timer_tick_valid_ = true;
+};
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_TIMER_WHEEL_H
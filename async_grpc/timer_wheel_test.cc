@@ -0,0 +1,97 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/timer_wheel.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+using Clock = TimerWheel::Clock;
+
+TEST(TimerWheelTest, RunsCallbacksWhenDue) {
+  TimerWheel timer_wheel(common::FromMilliseconds(10), 8 /* num_slots */);
+  const Clock::time_point now = Clock::now();
+  std::vector<int> fired;
+  timer_wheel.Schedule(now + std::chrono::milliseconds(50),
+                       [&fired]() { fired.push_back(50); });
+  timer_wheel.Schedule(now + std::chrono::milliseconds(20),
+                       [&fired]() { fired.push_back(20); });
+  EXPECT_EQ(timer_wheel.num_timers(), 2u);
+
+  timer_wheel.Advance(now + std::chrono::milliseconds(15));
+  EXPECT_TRUE(fired.empty());
+  timer_wheel.Advance(now + std::chrono::milliseconds(35));
+  EXPECT_EQ(fired, std::vector<int>({20}));
+  timer_wheel.Advance(now + std::chrono::milliseconds(60));
+  EXPECT_EQ(fired, std::vector<int>({20, 50}));
+  EXPECT_EQ(timer_wheel.num_timers(), 0u);
+}
+
+TEST(TimerWheelTest, HandlesTimersBeyondOneRevolution) {
+  TimerWheel timer_wheel(common::FromMilliseconds(10), 4 /* num_slots */);
+  const Clock::time_point now = Clock::now();
+  bool fired = false;
+  timer_wheel.Schedule(now + std::chrono::milliseconds(100),
+                       [&fired]() { fired = true; });
+  for (int ms = 10; ms < 100; ms += 10) {
+    timer_wheel.Advance(now + std::chrono::milliseconds(ms));
+    EXPECT_FALSE(fired);
+  }
+  timer_wheel.Advance(now + std::chrono::milliseconds(120));
+  EXPECT_TRUE(fired);
+}
+
+TEST(TimerWheelTest, CallbacksCanReschedule) {
+  TimerWheel timer_wheel(common::FromMilliseconds(10), 8 /* num_slots */);
+  const Clock::time_point now = Clock::now();
+  int num_fired = 0;
+  timer_wheel.Schedule(now, [&]() {
+    ++num_fired;
+    timer_wheel.Schedule(now + std::chrono::milliseconds(30),
+                         [&num_fired]() { ++num_fired; });
+  });
+  timer_wheel.Advance(now + std::chrono::milliseconds(20));
+  EXPECT_EQ(num_fired, 1);
+  timer_wheel.Advance(now + std::chrono::milliseconds(40));
+  EXPECT_EQ(num_fired, 2);
+}
+
+TEST(TimerWheelTest, NextDeadline) {
+  TimerWheel timer_wheel(common::FromMilliseconds(10), 4 /* num_slots */);
+  const Clock::time_point now = Clock::now();
+  EXPECT_EQ(timer_wheel.NextDeadline(), Clock::time_point::max());
+  timer_wheel.Schedule(now + std::chrono::milliseconds(100), []() {});
+  timer_wheel.Schedule(now + std::chrono::milliseconds(25), []() {});
+  const Clock::time_point first_deadline = timer_wheel.NextDeadline();
+  EXPECT_GE(first_deadline, now + std::chrono::milliseconds(25));
+  EXPECT_LT(first_deadline, now + std::chrono::milliseconds(35));
+
+  // Once the first timer fired, the one beyond a revolution is next.
+  timer_wheel.Advance(first_deadline);
+  EXPECT_EQ(timer_wheel.num_timers(), 1u);
+  const Clock::time_point second_deadline = timer_wheel.NextDeadline();
+  EXPECT_GE(second_deadline, now + std::chrono::milliseconds(100));
+  EXPECT_LT(second_deadline, now + std::chrono::milliseconds(110));
+  timer_wheel.Advance(second_deadline);
+  EXPECT_EQ(timer_wheel.NextDeadline(), Clock::time_point::max());
+}
+
+}  // namespace
+}  // namespace async_grpc
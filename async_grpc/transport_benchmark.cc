@@ -0,0 +1,132 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the latency of unary calls from a client in the same process as
+// the server over TCP loopback, a Unix domain socket, gRPC's in-process
+// transport and the in-process bypass.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "async_grpc/client.h"
+#include "async_grpc/proto/benchmark.pb.h"
+#include "async_grpc/rpc_handler.h"
+#include "async_grpc/server.h"
+#include "glog/logging.h"
+#include "grpc++/grpc++.h"
+
+namespace async_grpc {
+namespace {
+
+constexpr int kNumIterations = 2000;
+const std::string kTcpServerAddress = "localhost:50061";
+const std::string kUnixServerAddress =
+    "unix:/tmp/async_grpc_transport_benchmark.sock";
+
+DEFINE_HANDLER_SIGNATURE(EchoSignature, proto::PointCloud, proto::PointCloud,
+                         "/async_grpc.proto.Benchmark/Echo")
+
+class EchoHandler : public RpcHandler<EchoSignature> {
+ public:
+  void OnRequest(const proto::PointCloud& request) override {
+    Send(common::make_unique<proto::PointCloud>(request));
+  }
+};
+
+proto::PointCloud CreatePointCloud(int num_points) {
+  proto::PointCloud point_cloud;
+  for (int i = 0; i < num_points; ++i) {
+    proto::Point* point = point_cloud.add_points();
+    point->set_x(i);
+    point->set_y(2.f * i);
+    point->set_z(0.5f * i);
+    point_cloud.add_intensities(i % 255);
+  }
+  return point_cloud;
+}
+
+double MeasureMicrosecondsPerCall(std::shared_ptr<::grpc::Channel> channel,
+                                  const proto::PointCloud& request) {
+  auto call = [&channel, &request]() {
+    Client<EchoSignature> client(channel);
+    CHECK(client.Write(request));
+  };
+  call();  // Warm up, e.g. connect.
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kNumIterations; ++i) {
+    call();
+  }
+  const std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kNumIterations;
+}
+
+std::unique_ptr<Server> StartServer(bool enable_in_process_bypass) {
+  Server::Builder server_builder;
+  server_builder.SetServerAddress(kTcpServerAddress);
+  server_builder.AddServerAddress(kUnixServerAddress);
+  server_builder.SetNumGrpcThreads(1);
+  server_builder.SetNumEventThreads(1);
+  server_builder.RegisterHandler<EchoHandler>();
+  if (enable_in_process_bypass) {
+    server_builder.EnableInProcessBypass();
+  }
+  std::unique_ptr<Server> server = server_builder.Build();
+  server->Start();
+  return server;
+}
+
+void Run() {
+  std::printf("%-20s %16s %16s\n", "transport", "empty [us]",
+              "1000 points [us]");
+  const proto::PointCloud empty_request;
+  const proto::PointCloud large_request = CreatePointCloud(1000);
+  auto report = [&empty_request, &large_request](
+                    const char* transport,
+                    std::shared_ptr<::grpc::Channel> channel) {
+    const double empty_us = MeasureMicrosecondsPerCall(channel, empty_request);
+    const double large_us = MeasureMicrosecondsPerCall(channel, large_request);
+    std::printf("%-20s %16.1f %16.1f\n", transport, empty_us, large_us);
+  };
+
+  {
+    std::unique_ptr<Server> server = StartServer(false);
+    report("tcp loopback", ::grpc::CreateChannel(
+                               kTcpServerAddress,
+                               ::grpc::InsecureChannelCredentials()));
+    report("unix socket", ::grpc::CreateChannel(
+                              kUnixServerAddress,
+                              ::grpc::InsecureChannelCredentials()));
+    report("in-process", server->InProcessChannel());
+    server->Shutdown();
+  }
+  {
+    std::unique_ptr<Server> server = StartServer(true);
+    report("in-process bypass", server->InProcessChannel());
+    server->Shutdown();
+  }
+}
+
+}  // namespace
+}  // namespace async_grpc
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  async_grpc::Run();
+  return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/worker_pool.h"
+
+#include "glog/logging.h"
+
+namespace async_grpc {
+
+WorkerPool::WorkerPool(size_t num_threads) : shut_down_(false) {
+  CHECK_GT(num_threads, 0);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+WorkerPool::~WorkerPool() { Shutdown(); }
+
+void WorkerPool::Schedule(std::function<void()> work) {
+  CHECK(work);
+  if (shut_down_) {
+    return;
+  }
+  work_queue_.Push(std::move(work));
+}
+
+void WorkerPool::Shutdown() {
+  if (shut_down_.exchange(true)) {
+    return;
+  }
+  // An empty function stops one thread once the work before it is done.
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    work_queue_.Push(nullptr);
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Run() {
+  while (std::function<void()> work = work_queue_.Pop()) {
+    work();
+  }
+}
+
+}  // namespace async_grpc
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CPP_GRPC_WORKER_POOL_H
+#define CPP_GRPC_WORKER_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "async_grpc/common/blocking_queue.h"
+
+namespace async_grpc {
+
+// Threads for CPU-heavy work that handlers split off the event threads, see
+// 'RpcHandler::ParallelFor()'.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t num_threads);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  size_t num_threads() const { return threads_.size(); }
+  void Schedule(std::function<void()> work);
+  // Runs the work scheduled so far and joins the threads. Work scheduled
+  // afterwards is dropped.
+  void Shutdown();
+
+ private:
+  void Run();
+
+  common::BlockingQueue<std::function<void()>> work_queue_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> shut_down_;
+};
+
+// Runs 'task(i)' for every 'i' in [0, 'num_tasks') on 'worker_pool' and passes
+// the results, ordered by 'i', to 'done' on the worker that finished last.
+// At most one runner per thread is scheduled; runners pull the next index
+// until all are taken, which balances tasks of uneven cost. 'keep_going()' is
+// polled before each task: once it returns false no further tasks start and
+// 'done' is not called.
+template <typename Task, typename KeepGoing, typename Done>
+void ParallelFor(WorkerPool* worker_pool, size_t num_tasks, Task task,
+                 KeepGoing keep_going, Done done) {
+  using Result = decltype(std::declval<Task&>()(size_t()));
+  static_assert(!std::is_same<Result, bool>::value,
+                "std::vector<bool> cannot be written concurrently.");
+  struct State {
+    State(size_t num_tasks, Task task, KeepGoing keep_going, Done done)
+        : num_tasks(num_tasks),
+          task(std::move(task)),
+          keep_going(std::move(keep_going)),
+          done(std::move(done)),
+          results(num_tasks) {}
+
+    const size_t num_tasks;
+    Task task;
+    KeepGoing keep_going;
+    Done done;
+    std::vector<Result> results;
+    std::atomic<size_t> next_index{0};
+    std::atomic<size_t> num_finished{0};
+    std::atomic<bool> stopped{false};
+  };
+  if (num_tasks == 0) {
+    done(std::vector<Result>());
+    return;
+  }
+  auto state = std::make_shared<State>(num_tasks, std::move(task),
+                                       std::move(keep_going), std::move(done));
+  const size_t num_runners = std::min(num_tasks, worker_pool->num_threads());
+  for (size_t i = 0; i < num_runners; ++i) {
+    worker_pool->Schedule([state]() {
+      size_t index;
+      while ((index = state->next_index++) < state->num_tasks) {
+        if (!state->stopped && !state->keep_going()) {
+          state->stopped = true;
+        }
+        if (!state->stopped) {
+          state->results[index] = state->task(index);
+        }
+        if (++state->num_finished == state->num_tasks && !state->stopped) {
+          state->done(std::move(state->results));
+        }
+      }
+    });
+  }
+}
+
+}  // namespace async_grpc
+
+#endif  // CPP_GRPC_WORKER_POOL_H
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "async_grpc/worker_pool.h"
+
+#include <atomic>
+#include <future>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace async_grpc {
+namespace {
+
+TEST(WorkerPoolTest, RunsScheduledWorkBeforeShutdown) {
+  std::atomic<int> num_runs(0);
+  WorkerPool worker_pool(3);
+  EXPECT_EQ(worker_pool.num_threads(), 3);
+  for (int i = 0; i < 100; ++i) {
+    worker_pool.Schedule([&num_runs]() { ++num_runs; });
+  }
+  worker_pool.Shutdown();
+  EXPECT_EQ(num_runs, 100);
+  worker_pool.Schedule([&num_runs]() { ++num_runs; });
+  EXPECT_EQ(num_runs, 100);
+}
+
+TEST(WorkerPoolTest, ParallelForReturnsResultsInOrder) {
+  WorkerPool worker_pool(4);
+  std::promise<std::vector<int>> results;
+  ParallelFor(&worker_pool, 1000, [](size_t i) { return static_cast<int>(i); },
+              []() { return true; },
+              [&results](std::vector<int> values) {
+                results.set_value(std::move(values));
+              });
+  const std::vector<int> values = results.get_future().get();
+  ASSERT_EQ(values.size(), 1000);
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i], i);
+  }
+}
+
+TEST(WorkerPoolTest, ParallelForWithoutTasks) {
+  WorkerPool worker_pool(1);
+  bool done = false;
+  ParallelFor(&worker_pool, 0, [](size_t i) { return static_cast<int>(i); },
+              []() { return true; },
+              [&done](std::vector<int> values) {
+                EXPECT_TRUE(values.empty());
+                done = true;
+              });
+  EXPECT_TRUE(done);
+}
+
+TEST(WorkerPoolTest, ParallelForStopsWhenNotKeepingGoing) {
+  std::atomic<int> num_tasks(0);
+  bool done = false;
+  {
+    WorkerPool worker_pool(2);
+    ParallelFor(&worker_pool, 100,
+                [&num_tasks](size_t i) {
+                  ++num_tasks;
+                  return static_cast<int>(i);
+                },
+                [&num_tasks]() { return num_tasks < 10; },
+                [&done](std::vector<int> values) { done = true; });
+  }
+  EXPECT_GE(num_tasks, 10);
+  EXPECT_LT(num_tasks, 100);
+  EXPECT_FALSE(done);
+}
+
+}  // namespace
+}  // namespace async_grpc
@@ -32,6 +32,17 @@ function(google_test NAME ARG_SRC)
   add_test(${NAME} ${NAME})
 endfunction()
 
+function(google_binary NAME ARG_SRC)
+  add_executable(${NAME} ${ARG_SRC})
+  set(TARGET_COMPILE_FLAGS "${TARGET_COMPILE_FLAGS} ${GOOG_CXX_FLAGS}")
+
+  set_target_properties(${NAME} PROPERTIES
+    COMPILE_FLAGS ${TARGET_COMPILE_FLAGS})
+
+  target_include_directories(${NAME} PUBLIC ${PROJECT_NAME})
+  target_link_libraries(${NAME} PUBLIC ${PROJECT_NAME})
+endfunction()
+
 # Create a variable 'VAR_NAME'='FLAG'. If VAR_NAME is already set, FLAG is
 # appended.
 function(google_add_flag VAR_NAME FLAG)